@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <poll.h>
 #include <sys/inotify.h>
 #include <sys/signal.h>
 #include "../include/tcp-socket.hpp"
@@ -13,11 +15,25 @@
 #include "../include/messenger.hpp"
 #include "../include/sender-message-handler.hpp"
 #include "../include/receiver-message-handler.hpp"
+#include "../include/data-channels.hpp"
+#include "../include/change-log.hpp"
+#include "../include/async-messenger.hpp"
+#include "../include/apply-pool.hpp"
+#include "../include/patch-journal.hpp"
+#include "../include/durability-manager.hpp"
+#include "../include/event-coalescer.hpp"
+#include <thread>
 
 #define PORT 9000
 #define SERVER_IP "127.0.0.1"
 #define DATA_DIR "./data"
 #define PEER_SNAP_FILE "./peer-snap-file.json"
+#define DATA_CHANNELS 4
+#define COMPRESSION 1
+#define RESUME_DIR "./.synclet-resume"
+#define JOURNAL_DIR "./.synclet-journal"
+#define RECONNECT_DELAY_MS 500
+#define MAX_RECONNECT_DELAY_MS 30000
 
 std::function<void(int)> signal_handler = nullptr;
 void signal_handler_wrap(int sig)
@@ -26,9 +42,24 @@ void signal_handler_wrap(int sig)
         signal_handler(sig);
 }
 
+// snapshot and dirs of peer are requested together
+Task<void> request_peer_state(ReceiverMessageHandler &receiver_message_handler,
+                              Executor &executor,
+                              DirSnapshot &peer_snap,
+                              std::vector<std::string> &peer_dir_list)
+{
+    TaskGroup requests(executor);
+    requests.spawn(receiver_message_handler.process_request_peer_snap_async(peer_snap));
+    requests.spawn(receiver_message_handler.process_request_peer_dir_list_async(peer_dir_list));
+
+    co_await requests.wait();
+}
+
 void initial_changes_handler(SnapshotManager &snap_manager,
+                             Executor &executor,
                              ReceiverMessageHandler &receiver_message_handler,
                              SenderMessageHandler &sender_message_handler,
+                             const ResumeStore &resume_store,
                              DirSnapshot &curr_snap,
                              DirSnapshot &peer_snap,
                              std::string &peer_snap_version,
@@ -60,11 +91,8 @@ void initial_changes_handler(SnapshotManager &snap_manager,
     // if no snap present or new snap available then fetch snap + update peer_snap and it's snap version
     if (!was_peer_snap_present || !was_peer_snap_version_same)
     {
-        // request peer snap
-        receiver_message_handler.process_request_peer_snap(peer_snap);
-
-        // request peer dirs list
-        receiver_message_handler.process_request_peer_dir_list(peer_dir_list);
+        // request peer snap and dirs list
+        executor.block_on(request_peer_state(receiver_message_handler, executor, peer_snap, peer_dir_list));
 
         peer_snap_version = fetched_peer_snap_version;
     }
@@ -112,11 +140,42 @@ void initial_changes_handler(SnapshotManager &snap_manager,
             sender_message_handler.handle_delete_dir(dir_changes.removed_dirs);
     }
 
-    // when files are created then sync them to peer
-    if (!file_changes.created_files.empty())
+    std::vector<FileModification> to_fetch;
+    std::vector<FileModification> to_change;
+
+    for (const auto &modified_file : file_changes.modified_files)
+    {
+        // more time_t -> more recent
+        // if the current file is more older then fetch the modified chunks from peer
+        if (curr_snap[modified_file.filename].mtime < peer_snap[modified_file.filename].mtime)
+            to_fetch.push_back(modified_file);
+
+        // if current file is newer then sync changes to peer
+        else
+            to_change.push_back(modified_file);
+    }
+
+    // when files are created or changed here then sync them to peer, smallest first
+    if (!file_changes.created_files.empty() || !to_change.empty())
     {
-        std::clog << "syncing new files to peer..." << std::endl;
-        sender_message_handler.handle_create_file(file_changes.created_files);
+        std::clog << "syncing new files and file changes to peer..." << std::endl;
+        sender_message_handler.handle_transfers(file_changes.created_files, to_change);
+    }
+
+    // partially downloaded files are always fetched again, never deleted on peer
+    std::vector<std::string> to_resume;
+    std::erase_if(file_changes.removed_files, [&](const std::string &filename)
+                  {
+                      if (!resume_store.load(filename))
+                          return false;
+
+                      to_resume.push_back(filename);
+                      return true; });
+
+    if (!to_resume.empty())
+    {
+        std::clog << "resuming partial downloads from peer..." << std::endl;
+        receiver_message_handler.process_fetch_files(to_resume, curr_snap);
     }
 
     // when files are not present
@@ -138,108 +197,457 @@ void initial_changes_handler(SnapshotManager &snap_manager,
         }
     }
 
-    // when files are modified
-    if (!file_changes.modified_files.empty())
+    // request peer to send these updated chunks and save them + update the curr_snap
+    if (!to_fetch.empty())
     {
-        std::vector<FileModification> to_fetch;
-        std::vector<FileModification> to_change;
-
-        for (const auto &modified_file : file_changes.modified_files)
-        {
-            // more time_t -> more recent
-            // if the current file is more older then fetch the modified chunks from peer
-            if (curr_snap[modified_file.filename].mtime < peer_snap[modified_file.filename].mtime)
-                to_fetch.push_back(modified_file);
-
-            // if current file is newer then sync changes to peer
-            else
-                to_change.push_back(modified_file);
-        }
-
-        // request peer to update these files
-        if (!to_change.empty())
-        {
-            std::clog << "syncing file changes to peer" << std::endl;
-            sender_message_handler.handle_modify_file(to_change);
-        }
-
-        // request peer to send these updated chunks and save them + update the curr_snap
-        if (!to_fetch.empty())
-        {
-            std::clog << "fetching modified files from peer" << std::endl;
-            receiver_message_handler.process_fetch_modified_chunks(to_fetch, curr_snap);
-        }
+        std::clog << "fetching modified files from peer" << std::endl;
+        executor.block_on(receiver_message_handler.process_fetch_modified_chunks_async(to_fetch, curr_snap));
     }
 
     // now after syncing all changes save the current snap as peer's snap
     if (!file_changes.created_files.empty() ||
         !file_changes.modified_files.empty() ||
-        !file_changes.removed_files.empty())
+        !file_changes.removed_files.empty() ||
+        !to_resume.empty())
     {
+        // the snap must not claim files which a crash could still take back
+        receiver_message_handler.make_durable();
+
         std::clog << "saving peer snap as cache" << std::endl;
         snap_manager.save_snapshot(curr_snap);
     }
 };
 
-int main()
+// everything that outlives a connection to the server
+struct ClientState
 {
-    try
+    SnapshotManager snap_manager{DATA_DIR, PEER_SNAP_FILE};
+    LinkShaping link_shaping = LinkShaping::from_env();
+
+    // per traffic class limits so that syncing doesn't starve other traffic
+    BandwidthLimiter bandwidth_limiter = BandwidthLimiter::from_env();
+
+    // checkpoints of big files being downloaded, kept outside the data dir
+    ResumeStore resume_store{RESUME_DIR};
+
+    // same size changes are written over files in place, kept outside the data dir
+    PatchJournal patch_journal{JOURNAL_DIR};
+
+    ChunkCompressor compressor;
+
+    // runs the coroutine handlers of the initial sync
+    Executor executor{Executor::threads_from_env()};
+
+    // fetched files are put together here while the executor receives the next ones
+    ApplyPool apply_pool = ApplyPool::from_env();
+
+    // received files are synced to disk in groups instead of one by one
+    DurabilityManager durability_manager = DurabilityManager::from_env();
+
+    // local changes by seq, server tells which seq it applied last when we reconnect
+    ChangeLog change_log = ChangeLog::from_env();
+
+    // same for every reconnect of this process
+    std::string session_id = generate_session_id();
+
+    // server seq we are in sync with, 0 till the first sync
+    uint64_t peer_seq = 0;
+    bool is_synced = false;
+
+    DirSnapshot curr_snap;
+    std::unique_ptr<Watcher> watcher;
+
+    // bursts of events on a file are sent as the one change they add up to
+    EventCoalescer coalescer = EventCoalescer::from_env();
+
+    // paths changed by pushes from server, the watcher reports our own writes to them too
+    std::unordered_set<std::string> peer_paths;
+};
+
+// log the paths before sending so that an event cut off by a disconnect is replayed
+void record_event(ChangeLog &change_log, const FileEvent &event)
+{
+    if (event.event_type == EventType::MOVED && event.old_filepath && event.new_filepath)
+    {
+        change_log.record(event.old_filepath->string(), event.is_directory);
+        change_log.record(event.new_filepath->string(), event.is_directory);
+    }
+    else
+        change_log.record(event.filepath.string(), event.is_directory);
+}
+
+// the file is on disk just as its snap says, or neither has it
+bool matches_snap(const ClientState &state, const std::string &path)
+{
+    const std::string fullpath = std::format("{}/{}", DATA_DIR, path);
+    const auto it = state.curr_snap.find(path);
+
+    if (!fs::is_regular_file(fullpath))
+        return it == state.curr_snap.end();
+
+    return it != state.curr_snap.end() &&
+           SnapshotManager::file_digest(SnapshotManager::createSnapshot(fullpath, DATA_DIR)) == SnapshotManager::file_digest(it->second);
+}
+
+// a change applied from a push comes back from the watcher, it must not go back to server
+bool is_echo(ClientState &state, const FileEvent &event)
+{
+    // a file we don't have is gone already, nothing to tell
+    if (!event.is_directory && event.event_type == EventType::DELETED && !state.curr_snap.contains(event.filepath.string()))
+        return true;
+
+    std::vector<std::string> paths{event.filepath.string()};
+    if (event.event_type == EventType::MOVED && event.old_filepath && event.new_filepath)
+        paths = {event.old_filepath->string(), event.new_filepath->string()};
+
+    for (const auto &path : paths)
+        if (!state.peer_paths.contains(path))
+            return false;
+
+    if (event.is_directory)
+        return true;
+
+    // a local edit after the push is a change of our own
+    for (const auto &path : paths)
+        if (!matches_snap(state, path))
+        {
+            for (const auto &path : paths)
+                state.peer_paths.erase(path);
+            return false;
+        }
+
+    return true;
+}
+
+// the chunks turn the file into the pushed version only if we have the version they
+// were made against, otherwise the whole file is fetched
+void apply_file_update(ClientState &state,
+                       Messenger &push_messenger,
+                       ReceiverMessageHandler &push_handler,
+                       ReceiverMessageHandler &receiver_message_handler,
+                       const FileUpdatePayload &payload)
+{
+    const auto it = state.curr_snap.find(payload.filename);
+    const std::string local_digest = it != state.curr_snap.end() ? SnapshotManager::file_digest(it->second) : "";
+
+    const bool is_up_to_date = local_digest == payload.file_digest;
+    const bool can_apply = !is_up_to_date && local_digest == payload.base_digest;
+
+    // modified chunks are put together in a temp file next to it
+    state.peer_paths.insert(payload.filename);
+    state.peer_paths.insert(payload.filename + ".incoming");
+
+    // a new file starts empty
+    if (can_apply && payload.base_digest.empty())
+        push_handler.process_create_file(FileCreateRemovePayload{.filename = payload.filename}, state.curr_snap);
+
+    for (size_t i = 0; i < payload.no_of_chunks; i++)
+    {
+        const Message &msg = push_messenger.receive_json_message();
+        auto chunk_payload = std::get_if<ModifiedChunkPayload>(&(msg.payload));
+
+        if (!chunk_payload || chunk_payload->filename != payload.filename)
+            throw std::runtime_error(std::format("invalid chunk pushed for {}", payload.filename));
+
+        if (can_apply)
+            push_handler.process_modified_chunk(*chunk_payload, state.curr_snap);
+        else if (chunk_payload->chunk_type != ChunkType::REMOVE)
+            push_messenger.receive_chunk_data(*chunk_payload);
+    }
+
+    if (!is_up_to_date && !can_apply)
     {
-        // configuring snap manager and watcher over the working dir
-        SnapshotManager snap_manager(DATA_DIR, PEER_SNAP_FILE);
+        std::clog << payload.filename << " differs from what the push was made against, fetching it whole" << std::endl;
+        receiver_message_handler.process_fetch_files({payload.filename}, state.curr_snap);
+        return;
+    }
+
+    // the chunks must add up to the pushed version, a torn push is replaced by the whole file
+    const std::string fullpath = std::format("{}/{}", DATA_DIR, payload.filename);
+    if (can_apply && SnapshotManager::file_digest(SnapshotManager::createSnapshot(fullpath, DATA_DIR)) != payload.file_digest)
+    {
+        std::clog << payload.filename << " came out different from the pushed version, fetching it whole" << std::endl;
+        receiver_message_handler.process_fetch_files({payload.filename}, state.curr_snap);
+    }
+}
 
-        // create connection to server
-        TcpConnection client(SERVER_IP, std::to_string(PORT));
+// applies one change of another client which server pushed
+void apply_push(ClientState &state,
+                Messenger &push_messenger,
+                ReceiverMessageHandler &push_handler,
+                ReceiverMessageHandler &receiver_message_handler)
+{
+    const Message &msg = push_messenger.receive_json_message();
 
-        // configuring messenger to send/receive messages
-        Messenger messenger(client);
+    std::clog << "pushed: " << message_type_to_string(msg.type) << std::endl;
 
-        // configuring sending message handler to sync changes
-        SenderMessageHandler sender_message_handler(messenger, DATA_DIR);
+    // pushes before it are applied, a reconnect needs nothing older than this from server
+    if (auto payload = std::get_if<ChangeSeqPayload>(&(msg.payload)))
+    {
+        push_handler.make_durable();
+        state.peer_seq = std::max(state.peer_seq, payload->seq);
+        return;
+    }
 
-        // configuring receiving message handler to request & receive message
-        ReceiverMessageHandler receiver_message_handler(DATA_DIR, messenger);
+    for (const auto &[path, _] : changed_paths(msg))
+        state.peer_paths.insert(path);
 
+    try
+    {
+        switch (msg.type)
+        {
+        case MessageType::FILE_UPDATE:
+            apply_file_update(state, push_messenger, push_handler, receiver_message_handler, std::get<FileUpdatePayload>(msg.payload));
+            break;
+        case MessageType::FILE_REMOVE:
+            push_handler.process_delete_file(std::get<FileCreateRemovePayload>(msg.payload), state.curr_snap);
+            break;
+        case MessageType::FILES_REMOVE:
+            push_handler.process_delete_file(std::get<FilesRemovedPayload>(msg.payload), state.curr_snap);
+            break;
+        case MessageType::FILE_MOVED:
+            push_handler.process_file_moved(std::get<FileMovedPayload>(msg.payload), state.curr_snap);
+            break;
+        case MessageType::DIR_CREATE:
+            push_handler.process_create_dir(std::get<DirCreateRemovePayload>(msg.payload));
+            break;
+        case MessageType::DIR_REMOVE:
+            push_handler.process_delete_dir(std::get<DirCreateRemovePayload>(msg.payload), state.curr_snap);
+            break;
+        case MessageType::DIRS_CREATE:
+            push_handler.process_create_dir(std::get<DirsCreatedRemovedPayload>(msg.payload));
+            break;
+        case MessageType::DIRS_REMOVE:
+            push_handler.process_delete_dir(std::get<DirsCreatedRemovedPayload>(msg.payload), state.curr_snap);
+            break;
+        case MessageType::DIR_MOVED:
+            push_handler.process_dir_moved(std::get<DirMovedPayload>(msg.payload), state.curr_snap);
+            break;
+        default:
+            std::cerr << "unexpected push: " << message_type_to_string(msg.type) << std::endl;
+            break;
+        }
+    }
+
+    // like a move of something we have already removed, the rest still applies
+    catch (const fs::filesystem_error &e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+
+    state.snap_manager.save_snapshot(state.curr_snap);
+}
+
+// one connection to the server, returns only by throwing once it breaks
+void run_session(ClientState &state, size_t &reconnect_delay)
+{
+    // create connection to server
+    TcpConnection client(SERVER_IP, std::to_string(PORT));
+    client.setLinkShaping(state.link_shaping);
+    reconnect_delay = RECONNECT_DELAY_MS;
+
+    // configuring messenger to send/receive messages
+    Messenger messenger(client);
+    messenger.set_bandwidth_limiter(&state.bandwidth_limiter);
+
+    // extra connections for striping big files
+    DataChannels data_channels;
+    data_channels.set_bandwidth_limiter(&state.bandwidth_limiter);
+
+    // configuring sending message handler to sync changes
+    SenderMessageHandler sender_message_handler(messenger, DATA_DIR);
+    sender_message_handler.set_data_channels(&data_channels);
+
+    // configuring receiving message handler to request & receive message
+    ReceiverMessageHandler receiver_message_handler(DATA_DIR, messenger);
+    receiver_message_handler.set_data_channels(&data_channels);
+    receiver_message_handler.set_resume_store(&state.resume_store);
+    receiver_message_handler.set_patch_journal(&state.patch_journal);
+    receiver_message_handler.set_durability_manager(&state.durability_manager);
+
+    // agree on chunk compression with server, 0 disables it
+    receiver_message_handler.process_handshake(state.compressor, get_env_number("SYNCLET_COMPRESSION", COMPRESSION) != 0);
+    messenger.set_compressor(&state.compressor);
+    data_channels.set_compressor(&state.compressor);
+
+    // pipelined requests over the same connection for the coroutine handlers
+    AsyncMessenger async_messenger(client, state.executor);
+    async_messenger.set_compressor(&state.compressor);
+    async_messenger.set_bandwidth_limiter(&state.bandwidth_limiter);
+    receiver_message_handler.set_async_messenger(&async_messenger);
+    receiver_message_handler.set_apply_pool(&state.apply_pool);
+
+    // open the data channels, 0 disables them
+    data_channels.open_channels(messenger,
+                                SERVER_IP,
+                                std::to_string(PORT),
+                                generate_session_id(),
+                                get_env_number("SYNCLET_DATA_CHANNELS", DATA_CHANNELS),
+                                state.link_shaping);
+
+    // changes of other clients are pushed on a connection of their own, subscribed
+    // before syncing so that nothing in between is missed
+    TcpConnection subscription(SERVER_IP, std::to_string(PORT));
+    subscription.setLinkShaping(state.link_shaping);
+
+    Messenger push_messenger(subscription);
+    ReceiverMessageHandler push_handler(DATA_DIR, push_messenger);
+    push_handler.set_patch_journal(&state.patch_journal);
+    push_handler.set_durability_manager(&state.durability_manager);
+    push_messenger.send_json_message(Message{
+        .type = MessageType::SUBSCRIBE,
+        .payload = SubscribePayload{.session_id = state.session_id}});
+
+    const SessionStatePayload &session_state = receiver_message_handler.process_session_resume(state.session_id, state.peer_seq);
+    const auto &missed_changes = state.change_log.changes_since(session_state.applied_seq);
+
+    // after a short break only what server missed from us is sent again
+    if (state.is_synced && session_state.is_known && !session_state.has_peer_changes && missed_changes)
+    {
+        std::clog << "resuming session at seq " << session_state.applied_seq << std::endl;
+
+        if (!missed_changes->empty())
+        {
+            sender_message_handler.handle_missed_changes(*missed_changes, state.curr_snap);
+            state.snap_manager.save_snapshot(state.curr_snap);
+        }
+    }
+    else
+    {
         // get current snap and peer's snap
-        auto [curr_snap_version, curr_snap] = snap_manager.scan_directory();
-        auto [peer_snap_version, peer_snap] = snap_manager.load_snapshot();
+        auto [curr_snap_version, curr_snap] = state.snap_manager.scan_directory();
+        auto [peer_snap_version, peer_snap] = state.snap_manager.load_snapshot();
+
+        // a partially downloaded file is not ours yet, what came of it waits next to it
+        for (const auto &filename : state.resume_store.pending_files())
+        {
+            curr_snap.erase(filename);
+            curr_snap.erase(filename + ".incoming");
+        }
 
-        initial_changes_handler(snap_manager,
+        initial_changes_handler(state.snap_manager,
+                                state.executor,
                                 receiver_message_handler,
                                 sender_message_handler,
+                                state.resume_store,
                                 curr_snap, peer_snap,
                                 peer_snap_version, curr_snap_version);
 
-        signal_handler = [&](int _)
+        state.curr_snap = std::move(curr_snap);
+
+        // the scan covers whatever happened till now, watch afresh from here
+        state.watcher.reset();
+        state.watcher = Watcher::create(DATA_DIR);
+        state.coalescer.clear();
+
+        std::clog << "initial sync traffic:" << std::endl;
+        state.bandwidth_limiter.print_stats();
+    }
+
+    sender_message_handler.handle_change_seq(state.session_id, state.change_log.current_seq());
+    uint64_t sent_seq = state.change_log.current_seq();
+    state.peer_seq = std::max(state.peer_seq, session_state.seq);
+    state.is_synced = true;
+
+    // dictionary for small chunks is trained from our files in background
+    state.compressor.maybe_retrain(state.curr_snap, DATA_DIR);
+
+    // continuously watch for changes to sync
+    std::clog << "waiting for file changes..." << std::endl;
+    while (true)
+    {
+        struct pollfd fds[] = {
+            {.fd = state.watcher->get_fd(), .events = POLLIN, .revents = 0},
+            {.fd = subscription.getFD(), .events = POLLIN, .revents = 0}};
+
+        // held events are due even when nothing new comes, queued transfers go on right away
+        const int timeout_ms = sender_message_handler.has_pending_transfers() ? 0 : state.coalescer.next_timeout_ms();
+        if (poll(fds, 2, timeout_ms) < 0)
         {
-            client.closeConnection();
-            snap_manager.save_snapshot(curr_snap);
-            exit(EXIT_SUCCESS);
-        };
-        signal(SIGINT, signal_handler_wrap);
-
-        // continuously watch for changes to sync
-        std::clog << "waiting for file changes..." << std::endl;
-        Watcher watcher(DATA_DIR);
-        while (true)
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(std::format("poll failed: {}", std::strerror(errno)));
+        }
+
+        // a push is applied before the events it causes are read
+        if (fds[1].revents)
+            apply_push(state, push_messenger, push_handler, receiver_message_handler);
+
+        if (fds[0].revents)
+            state.coalescer.add(state.watcher->poll_events());
+
+        // subtrees the watcher lost track of are compared with what we last saw of them
+        for (const auto &dir : state.watcher->take_dirty_dirs())
+            state.coalescer.add(state.snap_manager.rescan(dir, state.curr_snap));
+
+        const auto &events = state.coalescer.take_ready();
+
+        for (const auto &event : events)
         {
-            const auto &events = watcher.poll_events();
+            if (is_echo(state, event))
+                continue;
+
+            std::cout
+                << "filepath: " << event.filepath << std::endl
+                << "is_directory: " << event.is_directory << std::endl;
+
+            record_event(state.change_log, event);
+            sender_message_handler.handle_event(event, state.curr_snap);
+            state.snap_manager.save_snapshot(state.curr_snap);
+        }
 
-            for (const auto &event : events)
-            {
-                std::cout
-                    << "filepath: " << event.filepath << std::endl
-                    << "is_directory: " << event.is_directory << std::endl;
+        // one slice at a time, events read before the next one can get ahead of a big change
+        sender_message_handler.send_transfer_slice();
 
-                sender_message_handler.handle_event(event, curr_snap);
-                snap_manager.save_snapshot(curr_snap);
-            }
+        // server has everything up to the seq only once nothing is left in the queue
+        if (!sender_message_handler.has_pending_transfers() && state.change_log.current_seq() != sent_seq)
+        {
+            sender_message_handler.handle_change_seq(state.session_id, state.change_log.current_seq());
+            sent_seq = state.change_log.current_seq();
         }
+
+        if (!events.empty())
+            state.compressor.maybe_retrain(state.curr_snap, DATA_DIR);
     }
-    catch (const std::exception &e)
+}
+
+int main()
+{
+    ClientState state;
+
+    // a patch cut off by a crash is finished before any file is looked at
+    state.patch_journal.recover();
+
+    // a file we sent before and see created again, like an editor saving it, is a modification
+    state.coalescer.set_known_paths([&state](std::string_view path)
+                                    { return state.curr_snap.contains(std::string(path)); });
+
+    signal_handler = [&](int _)
+    {
+        state.snap_manager.save_snapshot(state.curr_snap);
+        state.bandwidth_limiter.print_stats();
+        state.coalescer.print_stats();
+        exit(EXIT_SUCCESS);
+    };
+    signal(SIGINT, signal_handler_wrap);
+
+    // keep reconnecting with growing delay, a session comes back without a full sync
+    size_t reconnect_delay = RECONNECT_DELAY_MS;
+    while (true)
     {
-        std::cerr << e.what() << '\n';
+        try
+        {
+            run_session(state, reconnect_delay);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << '\n';
+        }
+
+        std::clog << "reconnecting in " << reconnect_delay << " ms..." << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(reconnect_delay));
+        reconnect_delay = std::min<size_t>(reconnect_delay * 2, MAX_RECONNECT_DELAY_MS);
     }
 
     return 0;
-}
\ No newline at end of file
+}
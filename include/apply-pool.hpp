@@ -0,0 +1,98 @@
+#pragma once
+
+#include "executor.hpp"
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <unordered_set>
+#include <condition_variable>
+
+// workers which put received files together and snapshot them, so the thread reading the
+// connection can go on with the next file meanwhile. jobs of the same file run one after
+// another in the order they were submitted, jobs of different files run in parallel.
+// the queue is bounded, submitting waits while it is full so a slow disk slows the reading
+class ApplyPool
+{
+public:
+    ApplyPool(const size_t no_of_workers, const size_t max_queued);
+    ~ApplyPool();
+
+    ApplyPool(const ApplyPool &) = delete;
+    ApplyPool &operator=(const ApplyPool &) = delete;
+
+    // reads SYNCLET_APPLY_WORKERS and SYNCLET_APPLY_QUEUE
+    static ApplyPool from_env();
+
+    // job must not throw, whoever waits for it gets its result through its own channel
+    void submit(const std::string &filename, std::function<void()> job);
+
+    // runs job after the earlier jobs of the file and waits for it, like reading a file no apply
+    // writes meanwhile. must not be called from a job of the pool
+    void run(const std::string &filename, std::function<void()> job);
+
+    // co_await to run job on the pool, the coroutine continues on the executor afterwards
+    auto apply(Executor &executor, const std::string &filename, std::function<void()> job)
+    {
+        struct Awaiter
+        {
+            ApplyPool &pool;
+            Executor &executor;
+            std::string filename;
+            std::function<void()> job;
+            std::exception_ptr exception;
+
+            bool await_ready() noexcept { return false; }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                pool.submit(filename, [this, handle]()
+                            {
+                                try
+                                {
+                                    job();
+                                }
+                                catch (...)
+                                {
+                                    exception = std::current_exception();
+                                }
+                                executor.schedule(handle); });
+            }
+
+            void await_resume()
+            {
+                if (exception)
+                    std::rethrow_exception(exception);
+            }
+        };
+
+        return Awaiter{*this, executor, filename, std::move(job), nullptr};
+    }
+
+private:
+    struct Job
+    {
+        std::string filename;
+        std::function<void()> run;
+    };
+
+    const size_t max_queued;
+
+    std::mutex mutex;
+    std::condition_variable has_jobs;
+    std::condition_variable has_room;
+    std::deque<Job> queue;
+
+    // files a worker is applying right now, their next jobs wait
+    std::unordered_set<std::string> running_files;
+    bool is_stopping = false;
+
+    std::vector<std::thread> workers;
+
+    // first queued job whose file isn't being applied, queue.end() when none
+    std::deque<Job>::iterator next_runnable();
+
+    void worker_loop();
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "tcp-socket.hpp"
+#include "message.hpp"
+#include "chunk-compressor.hpp"
+#include "executor.hpp"
+#include "task.hpp"
+#include "bandwidth-limiter.hpp"
+
+// a reply and the raw data which followed it, like the data of a chunk
+struct AsyncReply
+{
+    Message message;
+    std::string data;
+};
+
+// awaitable requests over a connection. replies come back in the order of the requests,
+// so many requests can be in flight at once from different coroutines without a thread
+// waiting on each of them. it shares the connection with the blocking Messenger, only
+// one of the two may be used at a time
+class AsyncMessenger
+{
+public:
+    AsyncMessenger(TcpConnection &conn, Executor &executor);
+    void set_compressor(ChunkCompressor *compressor);
+
+    // requests count as control traffic, a coroutine waits for tokens without blocking a thread
+    void set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter);
+
+    Executor &get_executor();
+
+    // sends the request and returns its reply once every earlier reply is read
+    Task<AsyncReply> request(Message msg);
+
+private:
+    TcpConnection &connection;
+    Executor &executor;
+    ChunkCompressor *compressor = nullptr;
+    BandwidthLimiter *bandwidth_limiter = nullptr;
+
+    std::atomic<uint64_t> next_ticket = 0;
+    Sequencer send_turns;
+    Sequencer receive_turns;
+
+    // a failed send or receive leaves the stream out of order, so the rest fail too
+    std::atomic<bool> is_broken = false;
+
+    Task<void> send_all(std::string data);
+    Task<std::string> receive_exact(const size_t size);
+    Task<Message> receive_json_message();
+    Task<std::string> receive_chunk_data(SendChunkPayload payload);
+};
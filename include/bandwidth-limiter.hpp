@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// what the bytes on the wire are for, each class is limited on its own
+enum class TrafficClass : uint8_t
+{
+    CONTROL = 0x00, // requests, replies, file/dir events
+    INTERACTIVE,    // small realtime changes
+    BULK            // whole files and chunk downloads
+};
+
+// bytes per second and how many bytes can go at once after being idle, 0 rate means unlimited
+struct ClassLimit
+{
+    size_t rate = 0;
+    size_t burst = 0;
+};
+
+struct TrafficStats
+{
+    size_t bytes_sent = 0;
+    size_t bytes_borrowed = 0;
+    std::chrono::nanoseconds waited{0};
+};
+
+// token bucket per traffic class, tokens an idle class can't hold spill into a shared
+// pool which busy classes borrow from, so a limit only bites when the others are busy
+class BandwidthLimiter
+{
+public:
+    static constexpr size_t NO_OF_CLASSES = 3;
+
+    explicit BandwidthLimiter(const std::array<ClassLimit, NO_OF_CLASSES> &limits = {});
+
+    // reads SYNCLET_RATE_<CLASS>_KBPS and SYNCLET_BURST_<CLASS>_KB
+    static BandwidthLimiter from_env();
+
+    // can be changed while senders are waiting
+    void set_limit(const TrafficClass traffic_class, const ClassLimit &limit);
+    ClassLimit get_limit(const TrafficClass traffic_class) const;
+
+    // blocks till bytes can be sent in the given class
+    void acquire(const TrafficClass traffic_class, const size_t bytes);
+
+    // for senders which must not block: how long till the class can send again, zero when it can now
+    std::chrono::nanoseconds delay(const TrafficClass traffic_class);
+
+    // counts bytes already sent in the class, what its tokens can't cover is borrowed or paid back later
+    void consume(const TrafficClass traffic_class, const size_t bytes);
+
+    // biggest piece to acquire at once so that a big chunk never needs more than the burst
+    size_t slice_size(const TrafficClass traffic_class) const;
+
+    TrafficStats get_stats(const TrafficClass traffic_class) const;
+    void print_stats() const;
+
+private:
+    struct Bucket
+    {
+        ClassLimit limit;
+        double tokens = 0;
+        TrafficStats stats;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable limit_changed;
+
+    std::array<Bucket, NO_OF_CLASSES> buckets;
+    double spare_tokens = 0;
+    std::chrono::steady_clock::time_point last_refill;
+
+    void refill();
+};
+
+std::string traffic_class_to_string(const TrafficClass traffic_class);
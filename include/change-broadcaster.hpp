@@ -0,0 +1,52 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include "reactor.hpp"
+#include "message.hpp"
+
+// a file before and after a client's message got applied, no prev_snap when it is new
+struct FileUpdate
+{
+    std::optional<FileSnapshot> prev_snap;
+    FileSnapshot curr_snap;
+};
+
+// pushes what one client changed to every other client on its subscription connection.
+// a push is encoded once and its frames are shared by the queues of all subscribers,
+// so the chunk data of a file update is read from disk only once however many get it
+class ChangeBroadcaster
+{
+public:
+    ChangeBroadcaster(Reactor &reactor, const std::string &working_dir);
+
+    void subscribe(const uint64_t connection_id, const std::string &session_id);
+    void unsubscribe(const uint64_t connection_id);
+
+    // false when no client other than origin listens, then nothing needs to be built
+    bool has_subscribers(const std::string &origin) const;
+
+    // a change which carries no data, like a remove or a move, goes as it came
+    std::vector<Frame> encode_change(const Message &msg) const;
+
+    // FILE_UPDATE followed by the modified chunks turning prev_snap into curr_snap. the chunks
+    // are read from the file, so call it where nothing writes the file meanwhile. nothing is
+    // pushed when the file already moved past curr_snap, its next update is pushed instead
+    std::vector<Frame> encode_file_update(const FileUpdate &file_update) const;
+
+    // server seq the pushes before it bring a subscriber to
+    static Frame encode_seq(const uint64_t seq);
+
+    void broadcast(const std::vector<Frame> &frames, const std::string &origin);
+
+private:
+    Reactor &reactor;
+    const std::string working_dir;
+
+    // subscription connections and the sessions they belong to
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::string> subscribers;
+};
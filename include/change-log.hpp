@@ -0,0 +1,41 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+// a path which changed, the change itself is read from disk again when replaying
+struct ChangeRecord
+{
+    uint64_t seq;
+    std::string path;
+    bool is_directory;
+
+    // session the change came from, empty for local changes
+    std::string origin;
+};
+
+// the last few changes numbered by a sequence which only goes up, so that a peer which
+// reconnects after a short break gets only what it missed instead of a full snapshot
+class ChangeLog
+{
+public:
+    explicit ChangeLog(const size_t capacity);
+
+    // reads SYNCLET_CHANGE_LOG_SIZE
+    static ChangeLog from_env();
+
+    uint64_t record(const std::string &path, const bool is_directory, const std::string &origin = "");
+
+    uint64_t current_seq() const;
+
+    // changes after the given seq, nullopt when some of them are already trimmed
+    std::optional<std::vector<ChangeRecord>> changes_since(const uint64_t seq) const;
+
+private:
+    const size_t capacity;
+    uint64_t seq = 0;
+    std::deque<ChangeRecord> records;
+};
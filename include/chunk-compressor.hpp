@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <map>
+#include <optional>
+#include <zstd.h>
+#include "message-types.hpp"
+#include "snapshot-manager.hpp"
+
+struct CompressedChunk
+{
+    Compression compression;
+    std::string data;
+    uint32_t dict_version = 0;
+};
+
+// zstd dictionary trained from our own chunks, small chunks compress far better with it
+struct ZstdDictionary
+{
+    uint32_t version;
+    std::string data;
+    std::shared_ptr<ZSTD_CDict> cdict;
+};
+
+// a chunk of some file picked for training the dictionary
+struct DictionarySample
+{
+    std::string filepath;
+    size_t offset;
+    size_t chunk_size;
+};
+
+// compresses chunk data before it goes on the wire, chunks which look already
+// compressed (media, archives) are sent raw and the level follows the link speed
+class ChunkCompressor
+{
+public:
+    explicit ChunkCompressor(const Compression compression = Compression::NONE);
+    ~ChunkCompressor();
+
+    void set_compression(const Compression compression);
+    Compression get_compression() const;
+
+    // small chunks use the given dictionary, peer must have received it before
+    CompressedChunk compress(const std::string &data, const std::shared_ptr<const ZstdDictionary> &dictionary = nullptr);
+    std::string decompress(const Compression compression, const std::string &data, const size_t raw_size, const uint32_t dict_version = 0) const;
+
+    // latest dictionary trained on this side, null until the first training finishes
+    std::shared_ptr<const ZstdDictionary> get_dictionary() const;
+
+    // dictionary peer will compress its small chunks with
+    void add_peer_dictionary(const uint32_t version, const std::string &data);
+
+    // trains a new dictionary from the snapshot chunks on a background thread once the retrain interval passed
+    void maybe_retrain(const DirSnapshot &snaps, const std::string &working_dir);
+
+    // whether maybe_retrain would train now, for callers which have to gather the snaps first
+    bool is_retrain_due() const;
+
+    // feedback from the send path about how fast the link drains
+    void record_send(const size_t bytes, const std::chrono::nanoseconds took);
+
+    // what this build can offer in the handshake, best first
+    static std::vector<Compression> supported();
+
+    // the best of the offered ones which we support too
+    static Compression pick(const std::vector<Compression> &offered);
+
+private:
+    // below this compressing costs more than it saves
+    const size_t MIN_COMPRESS_SIZE = 128;
+
+    // bits per byte above which data is treated as already compressed
+    const double MAX_ENTROPY = 7.2;
+
+    // re-evaluate the level after these many chunks
+    const int ADAPT_EVERY = 16;
+
+    // chunks up to this size are compressed with the dictionary
+    const size_t DICT_MAX_CHUNK_SIZE = 64 * 1024;
+
+    // dictionary size and how much sample data to train it from, ~100x the dictionary as zstd suggests
+    const size_t DICT_CAPACITY = 64 * 1024;
+    const size_t DICT_SAMPLE_BYTES = 4 * 1024 * 1024;
+    const size_t DICT_MIN_SAMPLES = 16;
+
+    // dictionaries are bound to one level when created
+    const int DICT_LEVEL = 3;
+
+    // older peer dictionaries are dropped, chunks in flight may still use the previous one
+    const size_t MAX_PEER_DICTIONARIES = 4;
+
+    std::atomic<Compression> compression = Compression::NONE;
+    std::atomic<int> level = 0;
+
+    std::mutex stats_mutex;
+    double link_bytes_per_sec = 0;
+    double compress_bytes_per_sec = 0;
+    int chunks_since_adapt = 0;
+
+    // 0 disables the dictionaries
+    const std::chrono::seconds retrain_interval;
+    std::optional<std::chrono::steady_clock::time_point> last_training;
+    std::thread trainer;
+    std::atomic<bool> training = false;
+    uint32_t last_dict_version = 0;
+
+    mutable std::mutex dictionary_mutex;
+    std::shared_ptr<const ZstdDictionary> dictionary;
+    std::map<uint32_t, std::shared_ptr<ZSTD_DDict>> peer_dictionaries;
+
+    static bool looks_compressible(const std::string &data, const double max_entropy);
+    static std::pair<int, int> level_range(const Compression compression);
+    std::string compress_with(const Compression compression, const int level, const std::string &data) const;
+    void record_compress(const size_t bytes, const std::chrono::nanoseconds took);
+    void adapt_level();
+    std::vector<DictionarySample> pick_dictionary_samples(const DirSnapshot &snaps, const std::string &working_dir) const;
+    void train_dictionary(const std::vector<DictionarySample> &samples);
+};
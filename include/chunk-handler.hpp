@@ -5,8 +5,12 @@
 #include <fstream>
 #include <format>
 #include <set>
+#include <map>
+#include <mutex>
+#include <memory>
 #include <charconv>
 #include "file-pair-session.hpp"
+#include "patch-journal.hpp"
 #include "message-types.hpp"
 #include "utils.hpp"
 
@@ -22,16 +26,72 @@ struct ChunkMetadata
 };
 #pragma pack(pop)
 
+// changes of one file staged until its last chunk comes. chunks are indexed in memory by
+// offset, their data stays in memory too till the store gets bigger than
+// SYNCLET_STAGING_MEMORY and then goes to one append-only spill file
 class ChunkHandler{
     public:
     ChunkHandler(const std::string& filename);
-    void save_chunk(ChunkMetadata&,const std::string& chunk_data);
-    void finalize_file(const std::string& original_filepath);
+    ~ChunkHandler();
+
+    ChunkHandler(const ChunkHandler&) = delete;
+    ChunkHandler& operator=(const ChunkHandler&) = delete;
+
+    // bytes a file keeps in memory before spilling, SYNCLET_STAGING_MEMORY
+    static size_t staging_memory();
+
+    // where spill files go, SYNCLET_STAGING_DIR
+    static const std::string &staging_dir();
+
+    // safe to call from many threads at once
+    void save_chunk(const ChunkMetadata&,const std::string& chunk_data);
+    // with a journal a change which keeps every byte in place is written over the file,
+    // anything else rebuilds the file next to it. either way the file's data is on disk once
+    // it returns, only its entry in the dir is left to sync
+    void finalize_file(const std::string& original_filepath, const PatchJournal* journal = nullptr);
+
+    // drop staged chunks of a file whose sending was cut off
+    void discard();
+
+    // every chunk written is the chunk the snap has at its offset in the new file, call after finalize_file
+    bool wrote_only_chunks_of(const FileSnapshot& file_snap) const;
 
     private:
-    std::string dir_name;
+    struct StagedChunk
+    {
+        ChunkMetadata chunk_md;
+
+        // taken as the chunk comes, empty when it has no data
+        std::string hash;
+
+        // data of the chunk, or where it is in the spill file once spilled
+        std::string data;
+        uint64_t spill_offset = 0;
+        bool is_spilled = false;
+    };
+
     std::string filename;
-    std::pair<ChunkMetadata, std::string> read_chunk_file(uint64_t offset);
+    std::string spill_path;
+    const size_t memory_limit;
+
+    std::mutex mutex;
+
+    // chunks at the same offset keep the order they came in
+    std::multimap<uint64_t, StagedChunk> index;
+    size_t memory_bytes = 0;
+
+    // where the chunks written ended up in the new file and their hashes
+    std::vector<std::pair<uint64_t, std::string>> written_chunks;
+
+    std::unique_ptr<FileIO> spill_file;
+    uint64_t spill_size = 0;
+
+    // moves the data of every chunk in memory to the spill file
+    void spill();
+
+    // every chunk is a modify of the same size inside the file
+    bool is_in_place(const std::string& original_filepath) const;
+    std::string read_data(const StagedChunk& chunk);
 };
 
 // example : ChunkMetadata chunk_md;
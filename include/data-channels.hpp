@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include "tcp-socket.hpp"
+#include "messenger.hpp"
+
+// extra connections opened next to the main connection so that chunks of big files
+// can be striped over them, a single tcp flow can't fill a high latency link
+class DataChannels
+{
+public:
+    DataChannels() = default;
+
+    // client side: announce the channels on the main connection and open them
+    void open_channels(const Messenger &messenger,
+                       const std::string &host,
+                       const std::string &port,
+                       const std::string &session_id,
+                       const size_t no_of_channels,
+                       const LinkShaping &link_shaping = {});
+
+    // server side: the channels come in as connections of their own, wait for the announced ones
+    void expect_channels(const DataChannelsPayload &payload);
+
+    // server side: place a data connection by the channel no it introduced itself with
+    void add_channel(const DataChannelPayload &hello, std::unique_ptr<TcpConnection> connection);
+
+    // runs the task for each channel on its own thread and rethrows the first failure
+    // waits till every announced channel is connected
+    void for_each_channel(const std::function<void(const size_t, Messenger &)> &task);
+
+    // how many chunks out of total will go through the given channel
+    size_t chunks_on_channel(const size_t channel_no, const size_t no_of_chunks) const;
+
+    // channels compress with the same negotiated compressor as the main connection
+    void set_compressor(ChunkCompressor *compressor);
+
+    // channels share the limits of the main connection
+    void set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter);
+
+    size_t size() const;
+    bool empty() const;
+
+private:
+    ChunkCompressor *compressor = nullptr;
+    BandwidthLimiter *bandwidth_limiter = nullptr;
+    std::vector<std::unique_ptr<TcpConnection>> connections;
+    std::vector<std::unique_ptr<Messenger>> messengers;
+
+    // guards the channels while they are being added from other threads
+    std::mutex mutex;
+    std::condition_variable channel_added;
+    std::string session_id;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <set>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+// flushes applied files to disk in groups instead of one fsync per file. files and the dirs
+// whose entries changed are collected and synced together every commit interval, a commit
+// can also be asked for and waited on before telling the peer that changes are applied
+class DurabilityManager
+{
+public:
+    explicit DurabilityManager(const std::chrono::milliseconds commit_interval);
+    ~DurabilityManager();
+
+    DurabilityManager(const DurabilityManager &) = delete;
+    DurabilityManager &operator=(const DurabilityManager &) = delete;
+
+    // reads SYNCLET_COMMIT_INTERVAL_MS
+    static DurabilityManager from_env();
+
+    // data of the file goes to disk with the next commit, so does its entry in the parent dir
+    void add_file(const std::string &path);
+
+    // entries of the dir were added, removed or renamed
+    void add_dir(const std::string &path);
+
+    // durable once it returns: everything added before the call is synced
+    void commit();
+
+private:
+    const std::chrono::milliseconds commit_interval;
+
+    std::mutex mutex;
+    std::condition_variable has_commit_request;
+    std::condition_variable has_committed;
+
+    std::set<std::string> pending_files;
+    std::set<std::string> pending_dirs;
+
+    // every add is a new generation, a commit covers all generations taken before it
+    uint64_t added_generation = 0;
+    uint64_t committed_generation = 0;
+    bool is_commit_requested = false;
+    bool is_stopping = false;
+
+    std::thread committer;
+
+    void commit_loop();
+};
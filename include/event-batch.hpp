@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+#include "file-event.hpp"
+
+using PathId = uint32_t;
+
+// paths of one batch of events, each stored once back to back in one buffer and referred to
+// by id. clearing keeps every buffer, so once they are big enough for a batch interning a
+// path allocates nothing
+class PathTable
+{
+public:
+    static constexpr PathId NO_PATH = UINT32_MAX;
+
+    PathId intern(std::string_view path);
+    std::string_view view(const PathId id) const;
+
+    size_t size() const;
+    void clear();
+
+private:
+    struct Span
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    std::string arena;
+    std::vector<Span> spans;
+
+    // open addressing by hash of the path, NO_PATH marks a free slot
+    std::vector<PathId> slots;
+
+    void grow();
+};
+
+// an event as the watcher decoded it, paths are ids in the batch's table
+struct PathEvent
+{
+    EventType event_type;
+    bool is_directory;
+
+    // destination of a move
+    PathId path;
+
+    // source of a move, NO_PATH otherwise
+    PathId old_path = PathTable::NO_PATH;
+};
+
+// what one poll of a watcher read, valid till its next poll
+class EventBatch
+{
+public:
+    PathTable paths;
+    std::vector<PathEvent> events;
+
+    void add(std::string_view path, const bool is_dir, EventType event_type);
+    void add_move(std::string_view old_path, std::string_view new_path, const bool is_dir);
+
+    FileEvent to_file_event(const PathEvent &event) const;
+
+    void clear();
+};
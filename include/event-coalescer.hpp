@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+#include "file-event.hpp"
+#include "event-batch.hpp"
+
+// sits between the watcher and the sender so that a burst of events on a file goes out as
+// the one change it adds up to: create+delete is nothing, many modifies are one. a file's
+// events are held till it is quiet for a while or has waited for the max delay. moves of
+// files peer knows and every dir event go out in order with what came before them
+class EventCoalescer
+{
+public:
+    EventCoalescer(const std::chrono::milliseconds quiet_period, const std::chrono::milliseconds max_delay);
+
+    // reads SYNCLET_QUIET_MS and SYNCLET_MAX_DELAY_MS
+    static EventCoalescer from_env();
+
+    // files peer already has, a create or a move over one of them is a modification. without
+    // it a file is taken as new when its first held event creates it
+    void set_known_paths(std::function<bool(std::string_view)> is_known);
+
+    void add(const std::vector<FileEvent> &events);
+
+    // paths are copied only for files seen for the first time and for what goes out as is
+    void add(const EventBatch &batch);
+
+    // events of files which are quiet or waited long enough, in the order their files changed
+    std::vector<FileEvent> take_ready();
+
+    // ms till take_ready has something, -1 when nothing is held, to use as a poll timeout
+    int next_timeout_ms() const;
+
+    // held events are dropped, the caller scans the dir instead
+    void clear();
+
+    void print_stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // where a file stands since its first held event
+    struct PathState
+    {
+        // peer knows the file from before the first event
+        bool existed;
+
+        // the file is there after the last event
+        bool exists;
+        bool is_modified;
+
+        Clock::time_point first_event;
+        Clock::time_point last_event;
+    };
+
+    const std::chrono::milliseconds quiet_period;
+    const std::chrono::milliseconds max_delay;
+
+    // looked up by the views of a batch without copying them
+    struct PathHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view path) const { return std::hash<std::string_view>{}(path); }
+    };
+
+    std::function<bool(std::string_view)> is_known;
+
+    std::unordered_map<std::string, PathState, PathHash, std::equal_to<>> pending;
+    std::vector<FileEvent> ready;
+
+    size_t events_received = 0;
+    size_t events_sent = 0;
+
+    // path is the destination and old_path the source of a move, make_event builds the
+    // event when it goes out as it came
+    void add(EventType event_type, const bool is_dir, std::string_view path, std::string_view old_path,
+             Clock::time_point now, const std::function<FileEvent()> &make_event);
+    PathState &state_of(std::string_view path, const bool existed, Clock::time_point now);
+
+    // peer has the file unless it is new to us
+    bool is_known_path(std::string_view path) const;
+
+    // what the held events of the file add up to goes to ready
+    void flush(std::string_view path);
+    void flush_all();
+};
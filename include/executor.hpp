@@ -0,0 +1,204 @@
+#pragma once
+
+#include "task.hpp"
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <sys/epoll.h>
+
+// runs coroutines on a few threads. a coroutine waiting for a socket is parked in epoll
+// and takes no thread, so many transfers can be in flight with only a couple of threads
+class Executor
+{
+public:
+    explicit Executor(const size_t no_of_threads);
+    ~Executor();
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    // reads SYNCLET_EXECUTOR_THREADS
+    static size_t threads_from_env();
+
+    // resume the coroutine on one of the threads
+    void schedule(std::coroutine_handle<> handle);
+
+    // co_await to continue on one of the threads
+    auto resume_here()
+    {
+        struct Awaiter
+        {
+            Executor &executor;
+
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { executor.schedule(handle); }
+            void await_resume() noexcept {}
+        };
+
+        return Awaiter{*this};
+    }
+
+    // co_await till the fd can be read (EPOLLIN) or written (EPOLLOUT), one reader and
+    // one writer can wait on the same fd at once
+    auto wait_fd(const int fd, const uint32_t events)
+    {
+        struct Awaiter
+        {
+            Executor &executor;
+            int fd;
+            uint32_t events;
+
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { executor.park(fd, events, handle); }
+            void await_resume() noexcept {}
+        };
+
+        return Awaiter{*this, fd, events};
+    }
+
+    // co_await to continue after the given time without holding a thread meanwhile
+    Task<void> sleep_for(const std::chrono::nanoseconds duration);
+
+    // runs the task on the executor, on_done gets what it threw or nullptr
+    void spawn(Task<void> task, std::function<void(std::exception_ptr)> on_done);
+
+    // runs the task on the executor and waits for it, for callers outside the executor
+    void block_on(Task<void> task);
+
+private:
+    struct FdWaiters
+    {
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+    };
+
+    int epollfd = -1;
+
+    // wakes the poller up to stop
+    int stopfd = -1;
+
+    std::atomic<bool> is_stopping = false;
+
+    std::mutex ready_mutex;
+    std::condition_variable has_ready;
+    std::deque<std::coroutine_handle<>> ready;
+
+    std::mutex fds_mutex;
+    std::unordered_map<int, FdWaiters> waiting_fds;
+
+    std::vector<std::thread> threads;
+    std::thread poller;
+
+    void park(const int fd, const uint32_t events, std::coroutine_handle<> handle);
+
+    // registers what the waiters of the fd want, called with fds_mutex held
+    void arm(const int fd, const FdWaiters &waiters);
+
+    void worker_loop();
+    void poll_loop();
+};
+
+// waits for coroutines spawned together, the first exception is thrown from wait()
+class TaskGroup
+{
+public:
+    explicit TaskGroup(Executor &executor);
+
+    void spawn(Task<void> task);
+
+    // co_await till every spawned task is done
+    auto wait()
+    {
+        struct Awaiter
+        {
+            TaskGroup &group;
+
+            bool await_ready()
+            {
+                std::lock_guard<std::mutex> lock(group.mutex);
+                return group.pending == 0;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                std::lock_guard<std::mutex> lock(group.mutex);
+                if (group.pending == 0)
+                    return false;
+
+                group.waiter = handle;
+                return true;
+            }
+
+            void await_resume()
+            {
+                if (group.exception)
+                    std::rethrow_exception(group.exception);
+            }
+        };
+
+        return Awaiter{*this};
+    }
+
+private:
+    Executor &executor;
+
+    std::mutex mutex;
+    size_t pending = 0;
+    std::exception_ptr exception;
+    std::coroutine_handle<> waiter;
+};
+
+// lets coroutines through one at a time in the order of their tickets, like requests
+// going out in order and their replies being read in that same order
+class Sequencer
+{
+public:
+    explicit Sequencer(Executor &executor);
+
+    // co_await till every ticket before this one has advanced
+    auto wait_turn(const uint64_t ticket)
+    {
+        struct Awaiter
+        {
+            Sequencer &sequencer;
+            uint64_t ticket;
+
+            bool await_ready()
+            {
+                std::lock_guard<std::mutex> lock(sequencer.mutex);
+                return sequencer.next == ticket;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                std::lock_guard<std::mutex> lock(sequencer.mutex);
+                if (sequencer.next == ticket)
+                    return false;
+
+                sequencer.waiting[ticket] = handle;
+                return true;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        return Awaiter{*this, ticket};
+    }
+
+    // the current ticket is done, let the next one through
+    void advance();
+
+private:
+    Executor &executor;
+
+    std::mutex mutex;
+    uint64_t next = 0;
+    std::map<uint64_t, std::coroutine_handle<>> waiting;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <functional>
+#include <filesystem>
+#include <unordered_map>
+#include <sys/fanotify.h>
+#include "watcher.hpp"
+
+// one fanotify mark on the whole filesystem instead of a watch per directory, so a huge tree
+// costs nothing to watch and new dirs need no setup. events name the parent dir by its file
+// handle, it is resolved to a path and everything outside the watched dir is dropped.
+// needs CAP_SYS_ADMIN and a kernel with FAN_RENAME (5.17)
+class FanotifyWatcher : public Watcher
+{
+public:
+    explicit FanotifyWatcher(const std::string &dir);
+    ~FanotifyWatcher() override;
+
+    FanotifyWatcher(const FanotifyWatcher &) = delete;
+    FanotifyWatcher &operator=(const FanotifyWatcher &) = delete;
+
+    const EventBatch &poll_events() override;
+    int get_fd() const override;
+    std::vector<std::string> take_dirty_dirs() override;
+
+private:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    int fanfd = -1;
+
+    // any fd on the filesystem, to open dir handles through
+    int mount_fd = -1;
+
+    std::filesystem::path root;
+
+    // looked up by the bytes of a handle without copying them
+    struct HandleHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view handle) const { return std::hash<std::string_view>{}(handle); }
+    };
+
+    // paths relative to the root of dir handles seen, nullopt for dirs outside it. dropped
+    // whenever a dir moves or goes
+    std::unordered_map<std::string, std::optional<std::string>, HandleHash, std::equal_to<>> dir_paths;
+
+    std::vector<std::string> dirty_dirs;
+
+    EventBatch batch;
+
+    // paths the records of an event name, reused for every event
+    std::string filepath;
+    std::string old_filepath;
+    std::string new_filepath;
+
+    void fill_events(const struct fanotify_event_metadata *metadata);
+
+    // puts the path relative to the watched dir of the entry the record names in path,
+    // false when it is outside
+    bool resolve(const struct fanotify_event_info_fid *fid, std::string &path);
+};
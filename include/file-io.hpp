@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
@@ -9,6 +10,10 @@ class FileIO
 {
     std::fstream fstream;
     std::string filepath;
+    std::ios::openmode mode;
+
+    // descriptor of the same file for batched io, opened on first use
+    int fd = -1;
 
 public:
     FileIO(const std::string &filepath,const std::ios::openmode mode = std::ios::in);
@@ -20,5 +25,18 @@ public:
     void append_chunk(const std::string &data);
     std::string get_filepath();
     uintmax_t get_file_size();
+
+    // reads every (offset, size) range in one batch, a range past the end comes back short
+    std::vector<std::string> read_ranges(const std::vector<std::pair<size_t, size_t>> &ranges);
+
+    // reserves the blocks for size bytes upfront, keep_size leaves the length of the file as it is
+    void preallocate(const uint64_t size, const bool keep_size);
+
+    // descriptor for io outside the stream, flush the stream first when both write
+    int get_fd();
+    void flush();
+
+    // data written so far is on disk once it returns, call before renaming the file over another
+    void sync_data();
     ~FileIO();
 };
\ No newline at end of file
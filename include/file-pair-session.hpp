@@ -5,7 +5,6 @@
 
 class FilePairSession
 {
-    const size_t MAX_READ_SIZE = 1024 * 1024;
     std::unique_ptr<FileIO> original_file;
     std::unique_ptr<FileIO> temp_file;
     std::string original_filepath;
@@ -15,6 +14,11 @@ class FilePairSession
     // tells till where we reached reading the original file
     size_t cursor = 0;
 
+    // copies what it can without the data passing through user space: aligned blocks are
+    // shared through a reflink, the rest goes through copy_file_range. returns the bytes done,
+    // short when the filesystem can't or the source ends
+    static size_t copy_in_kernel(const int in_fd, uint64_t in_offset, const int out_fd, uint64_t out_offset, size_t size);
+
 public:
     FilePairSession(const std::string &filepath, const bool append_to_original = false);
     void ensure_files_open();
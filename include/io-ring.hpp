@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+// one read or write of a batch, result is the bytes done or -errno
+struct IoRequest
+{
+    int fd;
+    uint64_t offset;
+    char *data;
+    size_t size;
+    bool is_write;
+    ssize_t result = 0;
+};
+
+// io_uring through the raw syscalls. a batch of reads and writes is submitted with a
+// single io_uring_enter and waited for together, and copies go through buffers and file
+// slots registered once per ring. whether the kernel allows a ring is found out at runtime,
+// without one every request is a plain pread/pwrite. rings aren't shared between threads,
+// each thread gets its own on first use
+class IoRing
+{
+public:
+    // ring of the calling thread, SYNCLET_IO_URING=0 keeps every thread on the fallback
+    static IoRing &local();
+
+    IoRing(const IoRing &) = delete;
+    IoRing &operator=(const IoRing &) = delete;
+    ~IoRing();
+
+    bool is_available() const;
+
+    // runs every request and returns once all of them are done
+    void submit_and_wait(std::vector<IoRequest> &requests);
+
+    // copies size bytes between two files through the registered buffers, read and write
+    // of a piece are linked so the data never comes back to user space in between
+    void copy_range(const int in_fd, uint64_t in_offset, const int out_fd, uint64_t out_offset, size_t size);
+
+private:
+    IoRing();
+
+    int ring_fd = -1;
+    unsigned entries = 0;
+
+    // shared with the kernel
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    struct io_uring_cqe *cqes = nullptr;
+
+    // fixed buffers for copies, empty when the kernel wouldn't pin them
+    std::vector<std::string> buffers;
+
+    // two fixed file slots, the source and destination of a copy
+    bool has_file_slots = false;
+
+    bool setup();
+    void register_buffers();
+    void register_file_slots();
+    void teardown();
+
+    struct io_uring_sqe *next_sqe();
+
+    // submits what is queued and reaps count completions into results by user_data
+    void submit(const unsigned to_submit, std::vector<ssize_t> &results);
+
+    static void run_blocking(IoRequest &request);
+    static void copy_blocking(const int in_fd, uint64_t in_offset, const int out_fd, uint64_t out_offset, size_t size);
+};
@@ -32,6 +32,17 @@ enum class MessageType
     SEND_FILE,
     REQ_CHUNK,
     SEND_CHUNK, // for sending entire files by chunk
+    OPEN_DATA_CHANNELS, // announces extra connections for striping bulk data
+    DATA_CHANNEL,       // first message on every data connection
+    HANDSHAKE,          // agreeing on optional features right after connecting
+    ZSTD_DICT,          // dictionary for small chunks, raw dictionary follows
+    RESUME_QUERY,       // sender asks how much of a big file peer already has
+    RESUME_FROM,        // receiver replies where to continue from
+    SESSION_RESUME,     // client tells who it is and the last server seq it knows
+    SESSION_STATE,      // server replies whether the missed changes can be replayed
+    CHANGE_SEQ,         // client's changes till this seq are sent
+    SUBSCRIBE,          // first message on the connection server pushes other clients' changes on
+    FILE_UPDATE,        // server pushes a changed file, its modified chunks follow
 };
 
 enum class ChunkType : uint8_t
@@ -41,6 +52,14 @@ enum class ChunkType : uint8_t
     MODIFY
 };
 
+// how the chunk data is encoded on the wire
+enum class Compression : uint8_t
+{
+    NONE = 0x00,
+    LZ4,
+    ZSTD
+};
+
 // info of chunk
 struct ChunkInfo
 {
@@ -143,10 +162,25 @@ struct ModifiedChunkPayload
     size_t chunk_size;
     size_t old_chunk_size;
     bool is_last_chunk;
+
+    // chunk_size is the raw size, wire_size is what follows the message
+    Compression compression = Compression::NONE;
+    size_t wire_size = 0;
+
+    // zstd dictionary the chunk was compressed with, 0 when none
+    uint32_t dict_version = 0;
+
+    // set on the last chunk: the file as the sender has it after the change, so that
+    // the receiver doesn't read the whole file again to snapshot it, and the digest of the
+    // file the change was made against which the receiver must have for that
+    size_t file_size = 0;
+    std::vector<ChunkInfo> file_chunks;
+    std::string base_digest;
+
     ModifiedChunkPayload();
     ModifiedChunkPayload(const ChunkType chunk_type, const std::string &filename, const size_t offset, const size_t chunk_size, const size_t old_chunk_size, const bool is_last_chunk);
 
-    NLOHMANN_DEFINE_TYPE_INTRUSIVE(ModifiedChunkPayload, chunk_type, filename, offset, chunk_size, old_chunk_size, is_last_chunk);
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(ModifiedChunkPayload, chunk_type, filename, offset, chunk_size, old_chunk_size, is_last_chunk, compression, wire_size, dict_version, file_size, file_chunks, base_digest);
 };
 
 // sends snapshot of all the files
@@ -169,7 +203,18 @@ struct SendFilePayload
     size_t file_size;
     int no_of_chunks;
 
-    NLOHMANN_DEFINE_TYPE_INTRUSIVE(SendFilePayload, filename, file_size, no_of_chunks);
+    // chunks will come round robin over the data channels instead of this connection
+    bool is_striped;
+
+    // big files go in parts so that smaller transfers can go in between,
+    // no_of_chunks is then the count of this part only
+    bool is_continuation = false;
+    bool is_last_part = true;
+
+    // receiver keeps it in the checkpoint of a partially received file
+    std::string file_digest;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(SendFilePayload, filename, file_size, no_of_chunks, is_striped, is_continuation, is_last_part, file_digest);
 };
 
 struct RequestChunkPayload
@@ -178,7 +223,11 @@ struct RequestChunkPayload
     size_t offset;
     size_t chunk_size;
 
-    NLOHMANN_DEFINE_TYPE_INTRUSIVE(RequestChunkPayload, filename, offset, chunk_size);
+    // the last of the chunks asked for together, the reply carries it so that the file is
+    // snapshotted once after the whole batch
+    bool is_last_chunk = true;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(RequestChunkPayload, filename, offset, chunk_size, is_last_chunk);
 };
 
 // will only required for sending whole files
@@ -189,5 +238,125 @@ struct SendChunkPayload
     int chunk_no;
     bool is_last_chunk;
 
-    NLOHMANN_DEFINE_TYPE_INTRUSIVE(SendChunkPayload, filename, chunk_size, chunk_no, is_last_chunk);
-};
\ No newline at end of file
+    // where the chunk belongs in the file, required for reassembling striped chunks
+    size_t offset;
+
+    // chunk_size is the raw size, wire_size is what follows the message
+    Compression compression = Compression::NONE;
+    size_t wire_size = 0;
+
+    // zstd dictionary the chunk was compressed with, 0 when none
+    uint32_t dict_version = 0;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(SendChunkPayload, filename, chunk_size, chunk_no, is_last_chunk, offset, compression, wire_size, dict_version);
+};
+
+// sent on the main connection before opening the data connections
+struct DataChannelsPayload
+{
+    std::string session_id;
+    size_t no_of_channels;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(DataChannelsPayload, session_id, no_of_channels);
+};
+
+// client offers what it supports, server replies with what will be used
+struct HandshakePayload
+{
+    std::vector<Compression> compressions;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(HandshakePayload, compressions);
+};
+
+// a trained dictionary sent once before the first chunk compressed with it
+struct DictionaryPayload
+{
+    uint32_t dict_version;
+    size_t dict_size;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(DictionaryPayload, dict_version, dict_size);
+};
+
+struct ResumeQueryPayload
+{
+    std::string filename;
+    size_t file_size;
+    std::string file_digest;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(ResumeQueryPayload, filename, file_size, file_digest);
+};
+
+// offset 0 means start over, else chunk_hash is of the chunk ending at offset
+struct ResumeFromPayload
+{
+    std::string filename;
+    size_t offset;
+    std::string chunk_hash;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(ResumeFromPayload, filename, offset, chunk_hash);
+};
+
+// tells which data channel this connection is
+struct DataChannelPayload
+{
+    std::string session_id;
+    size_t channel_no;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(DataChannelPayload, session_id, channel_no);
+};
+
+// sent right after connecting, the session lives across reconnects of one client process
+struct SessionResumePayload
+{
+    std::string session_id;
+
+    // server seq at the end of the last sync of this session
+    uint64_t peer_seq;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(SessionResumePayload, session_id, peer_seq);
+};
+
+struct SessionStatePayload
+{
+    // false when server doesn't know the session, then a full sync is needed
+    bool is_known;
+
+    // last client seq the server applied for this session
+    uint64_t applied_seq;
+
+    // server's own seq right now
+    uint64_t seq;
+
+    // server got changes from elsewhere since peer_seq or forgot them
+    bool has_peer_changes;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(SessionStatePayload, is_known, applied_seq, seq, has_peer_changes);
+};
+
+struct ChangeSeqPayload
+{
+    std::string session_id;
+    uint64_t seq;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(ChangeSeqPayload, session_id, seq);
+};
+
+// the session is the same one the client resumes on its main connection
+struct SubscribePayload
+{
+    std::string session_id;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(SubscribePayload, session_id);
+};
+
+// no_of_chunks modified chunks follow which turn the file with base_digest into the one
+// with file_digest, base_digest is empty when the file is new
+struct FileUpdatePayload
+{
+    std::string filename;
+    std::string base_digest;
+    std::string file_digest;
+    size_t no_of_chunks;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(FileUpdatePayload, filename, base_digest, file_digest, no_of_chunks);
+};
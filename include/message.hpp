@@ -1,6 +1,7 @@
 #pragma once
 
 #include "message-types.hpp"
+#include "bandwidth-limiter.hpp"
 
 // payload object will be of these types
 using PayloadVariant = std::variant<
@@ -19,7 +20,18 @@ using PayloadVariant = std::variant<
     RequestDownloadFilesPayload,
     SendFilePayload,
     RequestChunkPayload,
-    SendChunkPayload>;
+    SendChunkPayload,
+    DataChannelsPayload,
+    DataChannelPayload,
+    HandshakePayload,
+    DictionaryPayload,
+    ResumeQueryPayload,
+    ResumeFromPayload,
+    SessionResumePayload,
+    SessionStatePayload,
+    ChangeSeqPayload,
+    SubscribePayload,
+    FileUpdatePayload>;
 
 struct Message
 {
@@ -34,3 +46,9 @@ void from_json(const json &j, Message &msg);
 std::string message_type_to_string(MessageType type);
 
 MessageType message_type_from_string(const std::string &type);
+
+// which limiter class the message and the data following it belong to
+TrafficClass traffic_class_of(MessageType type);
+
+// paths a message changes once it is applied, with whether each is a directory
+std::vector<std::pair<std::string, bool>> changed_paths(const Message &msg);
@@ -3,19 +3,65 @@
 #include "tcp-socket.hpp"
 #include "message.hpp"
 #include "file-io.hpp"
+#include "chunk-compressor.hpp"
+#include "bandwidth-limiter.hpp"
 
 class Messenger
 {
 public:
     explicit Messenger(TcpConnection &conn);
+    void set_compressor(ChunkCompressor *compressor);
+    void set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter);
 
     void send_json_message(const Message &msg) const;
-    void send_file_data(FileIO &fileio, const size_t offset, const size_t chunk_size) const;
-    void send_file_data(const std::string &data) const;
+
+    // the length prefixed json as it goes on the wire
+    static std::string encode_json_message(const Message &msg);
+    void send_file_data(const std::string &data, const TrafficClass traffic_class = TrafficClass::BULK) const;
     Message receive_json_message() const;
+
+    // for a message whose length and json were read elsewhere, like by the reactor
+    Message decode_json_message(const std::string &message) const;
     std::string receive_full_data();
     std::string receive_max_given_bytes(size_t max_bytes) const;
 
+    // sends the chunk payload followed by its data, compressed when agreed with peer
+    template <typename ChunkPayload>
+    void send_chunk_message(const MessageType type, ChunkPayload payload, const std::string &chunk_data) const
+    {
+        CompressedChunk compressed = compressor
+                                         ? compressor->compress(chunk_data, share_dictionary())
+                                         : CompressedChunk{Compression::NONE, chunk_data};
+
+        payload.compression = compressed.compression;
+        payload.wire_size = compressed.data.size();
+        payload.dict_version = compressed.dict_version;
+
+        send_json_message(Message{.type = type, .payload = std::move(payload)});
+        send_file_data(compressed.data, traffic_class_of(type));
+    }
+
+    // receives the data following a chunk payload and returns it raw
+    template <typename ChunkPayload>
+    std::string receive_chunk_data(const ChunkPayload &payload) const
+    {
+        return receive_chunk_data(payload.chunk_size, payload.compression, payload.wire_size, payload.dict_version);
+    }
+
 private:
     TcpConnection &client;
+    ChunkCompressor *compressor = nullptr;
+    BandwidthLimiter *bandwidth_limiter = nullptr;
+
+    // sends in pieces which the limiter lets through for the class
+    void send_limited(const std::string &data, const TrafficClass traffic_class) const;
+
+    // last dictionary peer got over this connection
+    mutable uint32_t sent_dict_version = 0;
+
+    std::string receive_chunk_data(const size_t chunk_size, const Compression compression, const size_t wire_size, const uint32_t dict_version) const;
+
+    // sends the current dictionary first if peer hasn't got it yet
+    std::shared_ptr<const ZstdDictionary> share_dictionary() const;
+    void receive_dictionary(const DictionaryPayload &payload) const;
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// bytes written over a file at an offset, the file's length stays the same
+struct Patch
+{
+    uint64_t offset;
+    std::string data;
+};
+
+// writes patches over a file where it is instead of rebuilding it. the patches are made
+// durable in a journal before the file is touched, so a crash half way through is
+// finished by replaying the journal on the next start.
+// readers of the file see it half patched meanwhile, so patches are applied on the apply pool
+// and whoever reads chunks of a file for a peer reads it through the pool's order of that file
+class PatchJournal
+{
+public:
+    explicit PatchJournal(const std::string &journal_dir);
+
+    // durable once it returns, the journal goes away after the file is synced
+    void apply(const std::string &filepath, const std::vector<Patch> &patches) const;
+
+    // replays the journals a crash left behind, call before scanning the files
+    void recover() const;
+
+private:
+    fs::path journal_dir;
+
+    fs::path journal_path(const std::string &filepath) const;
+
+    static void write_patches(const std::string &filepath, const std::vector<Patch> &patches);
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+#include <sys/epoll.h>
+#include "tcp-socket.hpp"
+#include "bandwidth-limiter.hpp"
+
+// bytes queued for a connection as they go on the wire
+using Frame = std::shared_ptr<const std::string>;
+
+// a client connection, the reactor watches it whenever none of its messages is being handled
+class ReactorConnection
+{
+public:
+    ReactorConnection(const uint64_t id, std::unique_ptr<TcpConnection> connection);
+
+    uint64_t get_id() const;
+    TcpConnection &get_connection();
+
+    // takes the connection out of the reactor, it is neither watched nor closed by it anymore
+    std::unique_ptr<TcpConnection> detach();
+
+private:
+    friend class Reactor;
+
+    const uint64_t id;
+    std::unique_ptr<TcpConnection> connection;
+
+    // read state: the length prefix first and then that many bytes of json
+    bool is_reading_length = true;
+    std::string read_buffer;
+    size_t read_size = 0;
+
+    // a worker is handling a message of it, the reactor leaves it alone till then
+    std::atomic<bool> is_busy = false;
+
+    // posted from other threads and sent whenever the socket takes it, a frame posted to
+    // many connections is shared by their queues. write_offset is into the front frame
+    std::mutex write_mutex;
+    std::deque<Frame> write_queue;
+    size_t write_offset = 0;
+    size_t queued_bytes = 0;
+
+    // the limiter holds back its frames till then
+    std::chrono::steady_clock::time_point throttled_until;
+
+    // fell too far behind, it is cut off and its client syncs again on reconnecting
+    bool is_overflowed = false;
+};
+
+// edge triggered epoll over the listening socket and every client socket. the reactor thread
+// reads length prefixed json messages without ever blocking, once a whole message is in the
+// connection goes to a worker which handles it with the usual message handlers (its socket
+// waits with poll there) and gives it back. one shot registration keeps a connection with one
+// worker at a time so its messages are handled in order, and idle clients cost no thread
+class Reactor
+{
+public:
+    using ConnectionHandler = std::function<void(ReactorConnection &)>;
+    using MessageHandler = std::function<void(ReactorConnection &, const std::string &)>;
+
+    Reactor(TcpServer &server, const size_t no_of_workers, const size_t max_queued_bytes);
+    ~Reactor();
+
+    // reads SYNCLET_SERVER_WORKERS
+    static size_t workers_from_env();
+
+    // reads SYNCLET_PUSH_QUEUE_KB
+    static size_t queue_limit_from_env();
+
+    // posted frames go out in the interactive class
+    void set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter);
+
+    // on_close is called once the reactor lets go of a connection, closed or detached
+    void set_handlers(ConnectionHandler on_accept, MessageHandler on_message, ConnectionHandler on_close);
+
+    // runs the event loop on the calling thread, returns only by throwing
+    void run();
+
+    // queue data for a connection from any thread without waiting for its socket,
+    // the frames go out together with nothing else in between. a connection with more
+    // than max_queued_bytes waiting is shut down instead
+    void post(const uint64_t connection_id, const std::vector<Frame> &frames);
+
+private:
+    TcpServer &server;
+    int epollfd = -1;
+
+    const size_t max_queued_bytes;
+    BandwidthLimiter *bandwidth_limiter = nullptr;
+
+    // connections whose frames the limiter holds back, only touched by the reactor thread
+    std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> throttled;
+
+    ConnectionHandler on_accept;
+    MessageHandler on_message;
+    ConnectionHandler on_close;
+
+    std::mutex connections_mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<ReactorConnection>> connections;
+    uint64_t next_id = 1;
+
+    // connections with a whole message read, waiting for a worker
+    std::mutex jobs_mutex;
+    std::condition_variable job_added;
+    std::deque<std::pair<std::shared_ptr<ReactorConnection>, std::string>> jobs;
+    std::vector<std::thread> workers;
+    bool is_stopping = false;
+
+    void accept_clients();
+    void handle_event(const std::shared_ptr<ReactorConnection> &conn, const uint32_t events);
+
+    // true once a whole message is read into message, false when the socket has no more for now
+    bool read_message(ReactorConnection &conn, std::string &message);
+
+    // sends what the socket and the limiter take without blocking
+    void flush_writes(ReactorConnection &conn);
+
+    // sends everything queued, waiting for the socket and the limiter, from a worker
+    void drain_writes(ReactorConnection &conn);
+
+    // flushes the connections whose limiter wait is over, returns ms till the next one or -1
+    int wake_throttled();
+
+    // watch the connection again for its next event
+    void arm(ReactorConnection &conn);
+
+    void close_connection(const std::shared_ptr<ReactorConnection> &conn);
+    void worker_loop();
+};
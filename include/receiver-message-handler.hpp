@@ -2,15 +2,45 @@
 #include "message-types.hpp"
 #include "tcp-socket.hpp"
 #include "messenger.hpp"
+#include "data-channels.hpp"
 #include "chunk-handler.hpp"
 #include "snapshot-manager.hpp"
+#include "resume-store.hpp"
+#include "async-messenger.hpp"
+#include "apply-pool.hpp"
+#include "durability-manager.hpp"
+#include <future>
+#include <functional>
 #include <ranges>
 #include <unordered_map>
+#include <unordered_set>
+#include <mutex>
 
 class ReceiverMessageHandler
 {
 public:
     ReceiverMessageHandler(const std::string &working_dir, Messenger &messenger);
+    void set_data_channels(DataChannels *data_channels);
+    void set_resume_store(ResumeStore *resume_store);
+    void set_async_messenger(AsyncMessenger *async_messenger);
+
+    // files are put together and snapshotted on the pool while the next ones are received,
+    // their snaps land through finish_applies
+    void set_apply_pool(ApplyPool *apply_pool);
+
+    // snaps of files applied on the pool go here as soon as each one is done instead of
+    // through finish_applies, it runs on the pool before the file's next apply
+    void set_on_applied(std::function<void(const FileSnapshot &)> on_applied);
+
+    // our snap of a file when the snaps given to a call don't have it, a change's snap is
+    // only taken over when we had the version it was made against
+    void set_snap_lookup(std::function<std::optional<FileSnapshot>(const std::string &)> snap_lookup);
+
+    // changes keeping every byte of a file in place are written over it through the journal
+    void set_patch_journal(PatchJournal *patch_journal);
+
+    // applied files and dir entries are synced to disk in groups, make_durable waits for it
+    void set_durability_manager(DurabilityManager *durability_manager);
     void process_modified_chunk(const ModifiedChunkPayload &payload, DirSnapshot &snaps);
     void process_create_file(const FileCreateRemovePayload &payload, DirSnapshot &snaps);
     void process_create_file(const FilesCreatedPayload &payload, DirSnapshot &snaps);
@@ -26,12 +56,96 @@ public:
     void process_file_chunk(const SendChunkPayload &payload, DirSnapshot &snaps);
     void process_fetch_files(const std::vector<std::string> &files, DirSnapshot &snaps);
     void process_fetch_modified_chunks(const std::vector<FileModification> &modified_files, DirSnapshot &snaps);
+    void process_handshake(ChunkCompressor &compressor, const bool use_compression);
     std::string process_request_snap_version();
     void process_request_peer_snap(DirSnapshot &peer_snaps);
     void process_request_peer_dir_list(std::vector<std::string> &dir_list);
+    void process_resume_query(const ResumeQueryPayload &payload);
+    SessionStatePayload process_session_resume(const std::string &session_id, const uint64_t peer_seq);
+
+    // coroutine versions over the async messenger, their requests are pipelined so
+    // many files are fetched at once without a thread for each
+    Task<void> process_request_peer_snap_async(DirSnapshot &peer_snaps);
+    Task<void> process_request_peer_dir_list_async(std::vector<std::string> &dir_list);
+    Task<void> process_fetch_modified_chunks_async(std::vector<FileModification> modified_files, DirSnapshot &snaps);
+
+    // chunks of files which never got their last chunk, call after the connection breaks
+    void discard_staged_chunks();
+
+    // waits for the files still being applied in background and adds their snaps,
+    // call before anything else touches those files
+    void finish_applies(DirSnapshot &snaps);
+
+    // everything applied so far is on disk once it returns, call before telling anyone it is
+    void make_durable();
 
 private:
     std::string working_dir;
     Messenger &messenger;
+    DataChannels *data_channels = nullptr;
+    ResumeStore *resume_store = nullptr;
+    AsyncMessenger *async_messenger = nullptr;
+    ApplyPool *apply_pool = nullptr;
+    PatchJournal *patch_journal = nullptr;
+    DurabilityManager *durability_manager = nullptr;
+    std::function<void(const FileSnapshot &)> on_applied;
+    std::function<std::optional<FileSnapshot>(const std::string &)> snap_lookup;
+
+    // snaps of files given to the apply pool which nobody waited for yet
+    std::unordered_map<std::string, std::future<FileSnapshot>> pending_applies;
+
+    // files getting chunks one message at a time, open till their last chunk
+    std::unordered_map<std::string, std::unique_ptr<FileIO>> receiving_files;
+
+    // files with modified chunks staged but not yet finalized
+    std::unordered_map<std::string, std::shared_ptr<ChunkHandler>> staged_files;
+    ChunkInfo process_striped_file(const SendFilePayload &payload,
+                                   const std::string &incoming_path,
+                                   FileSnapshot &received_snap,
+                                   uint64_t &bytes_received);
+    void publish_incoming_file(const SendFilePayload &payload,
+                               const std::string &filepath,
+                               FileIO &incoming,
+                               FileSnapshot received_snap,
+                               uint64_t bytes_received,
+                               DirSnapshot &snaps);
+
+    // a small file coming whole is held in memory and written out on the apply pool
+    void stage_whole_file(const SendFilePayload &payload, const std::string &filepath);
+    void receive_file_chunks(const SendFilePayload &payload,
+                             const std::function<void(const SendChunkPayload &, std::string)> &on_chunk);
+    void save_checkpoint(const SendFilePayload &payload,
+                         const std::string &incoming_path,
+                         const ChunkInfo &last_chunk,
+                         const FileSnapshot &part_snap);
     void process_get_files(const std::vector<std::string> &files, DirSnapshot &snaps);
+
+    // goes to disk with the next group commit, a dir_path is only synced for its entries
+    void mark_written(const std::string &path) const;
+    void mark_dir_changed(const std::string &dir_path) const;
+
+    // puts the staged chunks together into the file and snapshots it, on the pool if there is one.
+    // peer_snap is the file as the peer has it, taken over when what was written matches it
+    void apply_staged_file(std::shared_ptr<ChunkHandler> chunk_handler, const std::string &filename, DirSnapshot &snaps, std::optional<FileSnapshot> peer_snap);
+
+    // we have the version of the file whose digest is base_digest
+    bool has_base(const std::string &filename, const std::string &base_digest, const DirSnapshot &snaps) const;
+
+    // changes of a file land one after another, its next change waits for the previous apply
+    void wait_for_apply(const std::string &filename, DirSnapshot &snaps);
+
+    // end of an apply on the pool, the snap goes to on_applied if there is one
+    void complete_apply(std::promise<FileSnapshot> &result, FileSnapshot file_snap) const;
+
+    // what the async fetch of modified files shares between its coroutines
+    struct FetchProgress
+    {
+        std::mutex mutex;
+        size_t chunks_done = 0;
+        size_t total_chunks = 0;
+    };
+
+    AsyncMessenger &get_async_messenger() const;
+    Task<void> fetch_file_changes_async(FileModification file_modification, DirSnapshot &snaps, FetchProgress &progress);
+    Task<void> fetch_chunk_async(ChunkHandler &chunk_handler, ModifiedChunkPayload modified_chunk, FetchProgress &progress);
 };
\ No newline at end of file
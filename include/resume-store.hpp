@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <nlohmann/json.hpp>
+#include "message-types.hpp"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+// how far a file sent in parts got, everything before committed_bytes is on disk
+struct ResumeCheckpoint
+{
+    std::string filename;
+    uint64_t file_size;
+
+    // identifies the version of the file being received
+    std::string file_digest;
+
+    uint64_t committed_bytes;
+
+    // last committed chunk, verified again before resuming
+    uint64_t last_chunk_offset;
+    uint64_t last_chunk_size;
+    std::string last_chunk_hash;
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(ResumeCheckpoint, filename, file_size, file_digest, committed_bytes, last_chunk_offset, last_chunk_size, last_chunk_hash);
+};
+
+// keeps one checkpoint file per partially received file, outside the synced dir
+class ResumeStore
+{
+public:
+    explicit ResumeStore(const std::string &store_dir);
+
+    // durable once it returns: written to a temp file, synced and renamed over the old one
+    void save(const ResumeCheckpoint &checkpoint) const;
+
+    std::optional<ResumeCheckpoint> load(const std::string &filename) const;
+
+    // removes the chunks logged of the file too
+    void remove(const std::string &filename) const;
+
+    // chunks of the committed parts, the finished file's snap is made of them without reading it
+    void append_chunks(const std::string &filename, const std::vector<ChunkInfo> &chunks) const;
+
+    // logged chunks which end within committed_bytes, the rest were cut off with their part
+    std::vector<ChunkInfo> load_chunks(const std::string &filename, const uint64_t committed_bytes) const;
+
+    // files which are only partially received
+    std::vector<std::string> pending_files() const;
+
+    // flush the file data to disk before its checkpoint is saved
+    static void sync_file(const std::string &filepath);
+
+private:
+    fs::path store_dir;
+
+    fs::path checkpoint_path(const std::string &filename) const;
+    fs::path chunks_path(const std::string &filename) const;
+};
@@ -1,19 +1,53 @@
 #pragma once
 #include "messenger.hpp"
+#include "data-channels.hpp"
 #include "file-event.hpp"
 #include "snapshot-manager.hpp"
+#include "transfer-queue.hpp"
+#include "change-log.hpp"
+#include "apply-pool.hpp"
+#include <set>
+#include <unordered_map>
 
 class SenderMessageHandler
 {
 
 public:
     SenderMessageHandler(const Messenger &messenger, const std::string &working_dir);
+    void set_data_channels(DataChannels *data_channels);
+
+    // requested chunks are read in the order of the file's applies, never from a half patched file
+    void set_apply_pool(ApplyPool *apply_pool);
     void handle_event(const FileEvent &event, DirSnapshot &curr_snap) const;
     void handle_changes(const FileChanges &dir_changes) const;
 
+    // sends new and modified files smallest first, big ones in slices
+    void handle_transfers(const std::vector<FileSnapshot> &created_files, const std::vector<FileModification> &modified_files) const;
+
+    // changes of modified files are queued, call this between reading events till it returns false
+    // so that a small change goes ahead of a big one already being sent
+    bool send_transfer_slice() const;
+    bool has_pending_transfers() const;
+
     // private:
     const Messenger &messenger;
     const std::string working_dir;
+
+    // files at least this big are striped over the data channels
+    const size_t stripe_min_file_size;
+    DataChannels *data_channels = nullptr;
+    ApplyPool *apply_pool = nullptr;
+
+    // transfers of this connection, a change of a file waiting here keeps the snap peer has of it
+    mutable TransferQueue transfer_queue;
+    mutable std::unordered_map<std::string, FileSnapshot> unsent_bases;
+
+    // a file which changed before it was sent goes again whole, peer ends up with this snap of it
+    mutable std::unordered_map<std::string, FileSnapshot> resent_snaps;
+    bool should_stripe(const FileSnapshot &file_snap) const;
+    void send_striped_chunks(const FileSnapshot &file_snap,
+                             const std::vector<std::pair<std::string, ChunkInfo>> &chunks,
+                             const std::vector<std::string> &chunks_data) const;
     void handle_create_file(const FileEvent &event, DirSnapshot &curr_snap) const;
     void handle_create_file(const std::vector<FileSnapshot> &files) const;
     void handle_delete_file(const FileEvent &event, DirSnapshot &curr_snap) const;
@@ -28,9 +62,33 @@ public:
     void handle_moved_dir(const FileEvent& event,DirSnapshot& curr_snap)const;
     void handle_file_sync(const FileSnapshot &file_snap) const;
     void handle_file_modification_sync(const FileModification &file_modification) const;
+    void announce_created_files(const std::vector<FileSnapshot> &files) const;
+    std::vector<std::pair<std::string, ChunkInfo>> sorted_chunks(const FileSnapshot &file_snap) const;
+    void queue_file_sync(const FileSnapshot &file_snap) const;
+    void queue_file_modification_sync(const FileModification &file_modification) const;
+    bool send_file_part(const FileSnapshot &file_snap,
+                        const std::vector<std::pair<std::string, ChunkInfo>> &chunks,
+                        const bool is_striped,
+                        const bool is_continuation,
+                        const bool is_last_part,
+                        const std::string &file_digest = "") const;
+    bool is_unchanged(const FileSnapshot &file_snap) const;
+    void resend_changed_file(const std::string &filename) const;
+    size_t query_resume_offset(const FileSnapshot &file_snap,
+                               const std::vector<std::pair<std::string, ChunkInfo>> &chunks,
+                               const std::string &file_digest) const;
+    bool send_modified_chunks(const FileModification &file_modification, const size_t begin, const size_t end) const;
+    void handle_handshake(const HandshakePayload &payload, ChunkCompressor &compressor);
     void handle_request_snap_version(const std::string &snap_version);
     void handle_request_snap(DirSnapshot &snapshot);
     void handle_request_chunk(const RequestChunkPayload &payload);
     void handle_request_download_files(const RequestDownloadFilesPayload &payload, DirSnapshot &curr_snap);
     void handle_request_dir_list();
+    void handle_session_resume(const SessionResumePayload &payload,
+                               const std::unordered_map<std::string, uint64_t> &applied_seqs,
+                               const ChangeLog &change_log);
+    void handle_change_seq(const std::string &session_id, const uint64_t seq) const;
+
+    // sends the current state of the paths peer missed because the connection broke
+    void handle_missed_changes(const std::vector<ChangeRecord> &changes, DirSnapshot &curr_snap) const;
 };
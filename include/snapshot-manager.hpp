@@ -15,6 +15,7 @@
 #include <deque>
 #include "../include/utils.hpp"
 #include "../include/message-types.hpp"
+#include "../include/file-event.hpp"
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
@@ -24,6 +25,10 @@ struct FileModification
 {
     std::string filename;
     std::vector<ModifiedChunkPayload> modified_chunks;
+
+    // the file after and before the change, whoever applies it takes the one it ends up with
+    FileSnapshot curr_snap;
+    FileSnapshot prev_snap;
 };
 
 struct FileChanges
@@ -56,8 +61,25 @@ public:
 
     DirChanges compare_directories( std::vector<std::string> &prev_dirs);
 
+    // events turning snap into what is under dir_path on disk now, for when the watcher lost
+    // some. files are compared by size and mtime only, subdirs are listed on
+    // SYNCLET_RESCAN_THREADS threads
+    std::vector<FileEvent> rescan(const std::string &dir_path, const DirSnapshot &snap) const;
+
     static FileModification get_file_modification(const FileSnapshot &file_curr_snap, const FileSnapshot &file_prev_snap);
 
+    // same for the same content of the file, built from its chunk hashes
+    static std::string file_digest(const FileSnapshot &file_snap);
+
+    // the hash chunks are identified with
+    static std::string chunk_hash(const std::string &data);
+
+    // the last chunk of a change carries the snap of the file after it and the digest of the one before
+    static void attach_file_snap(ModifiedChunkPayload &last_chunk, const FileModification &file_modification);
+
+    // snap of a file put together from the chunk list a peer sent
+    static FileSnapshot from_chunks(const std::string &filename, const uint64_t file_size, const std::vector<ChunkInfo> &chunks);
+
     // Serialize snapshot to file
     void save_snapshot(const DirSnapshot &snaps);
 
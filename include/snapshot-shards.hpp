@@ -0,0 +1,101 @@
+#pragma once
+
+#include "snapshot-manager.hpp"
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <shared_mutex>
+#include <functional>
+
+// the server's snapshot split by path hash into shards, each behind a lock of its own. work on
+// a path runs on the caller's thread holding its shard's lock, so the reactor workers change
+// different paths at the same time and the same path one after the other.
+// changes spanning shards, like a directory move, take the entries out of their shards, change
+// them and put each one in its new shard. they hold the epoch exclusively while doing so and
+// everything else holds it shared, so nobody sees the entries missing or puts an entry which
+// the change then overwrites.
+// only the snapshot bookkeeping is guarded here, files are still written and hashed by the
+// reactor workers and the apply pool
+class SnapshotShards
+{
+public:
+    explicit SnapshotShards(const size_t no_of_shards);
+
+    SnapshotShards(const SnapshotShards &) = delete;
+    SnapshotShards &operator=(const SnapshotShards &) = delete;
+
+    // reads SYNCLET_SERVER_SHARDS, one per core by default
+    static size_t shards_from_env();
+
+    size_t shard_of(const std::string &path) const;
+
+    // runs fn with the shard of the path locked and returns what fn returns. fn must not
+    // call back into the shards
+    template <typename Fn>
+    auto run(const std::string &path, Fn fn) -> decltype(fn(std::declval<DirSnapshot &>()))
+    {
+        std::shared_lock<std::shared_mutex> lock(epoch);
+
+        Shard &shard = *shards[shard_of(path)];
+        std::lock_guard<std::mutex> shard_lock(shard.mutex);
+
+        return fn(shard.snaps);
+    }
+
+    // runs fn for every path with its shard locked, a shard at a time
+    void run_each(const std::vector<std::string> &paths, std::function<void(const std::string &, DirSnapshot &)> fn);
+
+    std::optional<FileSnapshot> get(const std::string &filename);
+
+    // stores the snap and returns the one it replaced
+    std::optional<FileSnapshot> put(const std::string &filename, FileSnapshot file_snap);
+
+    // removes the snap from its shard and returns it
+    std::optional<FileSnapshot> take(const std::string &filename);
+
+    // the entries matching pred are taken out of every shard, changed by fn and each one is put
+    // back in the shard of its path, all at once for everyone else. when fn throws they go
+    // back as they were
+    template <typename Fn>
+    void run_across(std::function<bool(const std::string &)> pred, Fn fn)
+    {
+        std::unique_lock<std::shared_mutex> lock(epoch);
+
+        DirSnapshot taken = extract_entries(pred);
+
+        try
+        {
+            fn(taken);
+        }
+        catch (...)
+        {
+            insert_entries(std::move(taken));
+            throw;
+        }
+
+        insert_entries(std::move(taken));
+    }
+
+    // each entry goes to its shard
+    void insert(DirSnapshot snaps);
+
+    // a copy of the whole snapshot gathered from every shard
+    DirSnapshot collect();
+
+private:
+    struct Shard
+    {
+        std::mutex mutex;
+        DirSnapshot snaps;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    // exclusive for changes spanning shards, shared for everything else
+    std::shared_mutex epoch;
+
+    // every shard hands over the entries matching pred, they are gone from the shards after
+    DirSnapshot extract_entries(std::function<bool(const std::string &)> pred);
+    void insert_entries(DirSnapshot snaps);
+};
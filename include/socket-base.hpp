@@ -6,12 +6,39 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <iostream>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+
+// stand-in for a high latency link on loopback: every connection can have at most
+// window_bytes in flight per rtt, just like a tcp flow limited by its window
+struct LinkShaping
+{
+    std::chrono::milliseconds rtt{0};
+    size_t window_bytes = 0;
+
+    bool is_enabled() const;
+
+    // reads SYNCLET_LINK_RTT_MS and SYNCLET_LINK_WINDOW_KB
+    static LinkShaping from_env();
+};
 
 class SocketBase
 {
 protected:
     int sockfd = -1;
 
+    LinkShaping link_shaping;
+    std::chrono::steady_clock::time_point window_start;
+    size_t window_sent = 0;
+
+    // waits for the next rtt when the window is used up, returns how much can be sent now
+    size_t waitForWindow(const size_t wanted);
+
+    // a non blocking socket waits here till it can be read or written
+    void waitUntilReady(const short events);
+
 public:
     SocketBase();
     explicit SocketBase(int fd);
@@ -22,6 +49,7 @@ public:
     }
 
     void sendAll(const std::string &data);
+    void sendAll(const char *data, const size_t size);
 
     std::string receiveAll();
 
@@ -32,4 +60,9 @@ public:
     void shutdownWrite();
 
     int getFD() const;
+
+    void setLinkShaping(const LinkShaping &shaping);
+
+    // sends and receives still complete, they wait for the socket when it would block
+    void setNonBlocking();
 };
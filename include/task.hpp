@@ -0,0 +1,137 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template <typename T = void>
+class Task;
+
+namespace task_detail
+{
+    // a task starts only when awaited and hands control back to its awaiter when done
+    struct PromiseBase
+    {
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+        std::exception_ptr exception;
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                return handle.promise().continuation;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    template <typename T>
+    struct Promise : PromiseBase
+    {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+
+        template <typename U>
+        void return_value(U &&result) { value.emplace(std::forward<U>(result)); }
+
+        T take()
+        {
+            if (exception)
+                std::rethrow_exception(exception);
+            return std::move(*value);
+        }
+    };
+
+    template <>
+    struct Promise<void> : PromiseBase
+    {
+        Task<void> get_return_object();
+
+        void return_void() {}
+
+        void take()
+        {
+            if (exception)
+                std::rethrow_exception(exception);
+        }
+    };
+}
+
+// a lazily started coroutine, co_await it to run it and get its result. the awaiter
+// is resumed right where the task finishes, on whichever thread that happens
+template <typename T>
+class Task
+{
+public:
+    using promise_type = task_detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+            {
+                handle.promise().continuation = awaiter;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().take(); }
+        };
+
+        return Awaiter{handle};
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+Task<T> task_detail::Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> task_detail::Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "./socket-base.hpp"
 #include <iostream>
+#include <memory>
 
 class TcpConnection : public SocketBase
 {
@@ -31,5 +32,11 @@ public:
     TcpServer(const std::string &ip, const std::string &port);
     TcpConnection acceptClient();
 
+    // for a non blocking listening socket, nullptr when no client is waiting
+    std::unique_ptr<TcpConnection> tryAcceptClient();
+
+    void setNonBlocking();
+    int getFD() const;
+
     ~TcpServer();
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+struct SliceResult
+{
+    size_t bytes_sent;
+    bool is_done;
+};
+
+// a pending file transfer which is sent a slice at a time
+struct TransferJob
+{
+    uint64_t id;
+    std::string filename;
+    size_t remaining_bytes;
+    std::chrono::steady_clock::time_point enqueued_at;
+    bool is_started = false;
+
+    // sends whole chunks till about the given bytes are sent
+    std::function<SliceResult(const size_t slice_bytes)> send_slice;
+};
+
+// shortest job first: the transfer with the least bytes left goes next, so small edits
+// don't wait behind a huge file. a job's size is discounted by how long it has waited
+// so big transfers still make progress, and after every slice the order is checked again.
+// jobs of the same file go in the order they were pushed
+class TransferQueue
+{
+public:
+    TransferQueue(const size_t slice_bytes, const std::chrono::milliseconds aging);
+
+    // reads SYNCLET_SLICE_SIZE and SYNCLET_AGING_MS
+    static TransferQueue from_env();
+
+    void push(const std::string &filename, const size_t estimated_bytes, std::function<SliceResult(const size_t)> send_slice);
+
+    // sends one slice of the job due next, false when there was nothing to send. the job
+    // may push and remove jobs of the queue while it sends
+    bool run_slice();
+
+    // sends slices till every job is done
+    void run();
+
+    // drops the jobs of the file which haven't sent anything yet, true when there were any
+    bool remove(const std::string &filename);
+
+    bool empty() const;
+
+private:
+    const size_t slice_bytes;
+    const std::chrono::milliseconds aging;
+
+    std::vector<TransferJob> jobs;
+    uint64_t next_id = 0;
+
+    // index of the job to send a slice of next, a job waits for earlier ones of its file
+    size_t pick_next(const std::chrono::steady_clock::time_point now) const;
+};
@@ -18,4 +18,13 @@ std::string convert_to_binary_string(size_t n);
 
 std::time_t to_unix_timestamp(const std::filesystem::file_time_type &mtime);
 
-void print_progress_bar(const std::string &message, double progress, size_t bar_width = 30);
\ No newline at end of file
+void print_progress_bar(const std::string &message, double progress, size_t bar_width = 30);
+
+// returns the numeric value of the env variable or the default when not set
+size_t get_env_number(const std::string &name, const size_t default_value);
+
+// returns the value of the env variable or the default when not set
+std::string get_env_string(const std::string &name, const std::string &default_value);
+
+// random hex id for telling connections of the same peer apart
+std::string generate_session_id();
\ No newline at end of file
@@ -1,4 +1,8 @@
 #pragma once
+#include <memory>
+#include <climits>
+#include <utility>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <cstring>
@@ -7,23 +11,57 @@
 #include <stdexcept>
 #include <filesystem>
 #include <unordered_map>
+#include <unordered_set>
 #include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <sys/timerfd.h>
 #include "file-event.hpp"
+#include "event-batch.hpp"
 #include "utils.hpp"
 
 namespace fd = std::filesystem;
 
+// reports changes under a dir as events, paths relative to the dir
 class Watcher
 {
 public:
-    explicit Watcher(const std::string &dir);
-    std::vector<FileEvent> poll_events();
-    ~Watcher();
+    virtual ~Watcher() = default;
+
+    // the batch is the watcher's own and is reused by the next poll
+    virtual const EventBatch &poll_events() = 0;
+
+    // readable when poll_events has something, to wait on it along with other fds
+    virtual int get_fd() const = 0;
+
+    // dirs, relative to the watched one and "" for itself, whose changes may not all have
+    // come as events: the kernel queue overflowed or a dir got contents before it was watched.
+    // they are to be rescanned against the snap, each is returned once
+    virtual std::vector<std::string> take_dirty_dirs() = 0;
+
+    // fanotify when SYNCLET_FANOTIFY is set and the kernel lets us, inotify otherwise
+    static std::unique_ptr<Watcher> create(const std::string &dir);
+
+protected:
+    // every event is printed as it is read when SYNCLET_LOG_EVENTS is set, off by default
+    // as printing costs more than the rest of reading an event
+    const bool log_events = get_env_number("SYNCLET_LOG_EVENTS", 0) != 0;
+};
+
+// one inotify watch per directory, added recursively. watched dirs form a tree of nodes by
+// name so that a path is built by walking up and moving a dir moves its whole subtree
+class InotifyWatcher : public Watcher
+{
+public:
+    explicit InotifyWatcher(const std::string &dir);
+    const EventBatch &poll_events() override;
+    int get_fd() const override;
+    std::vector<std::string> take_dirty_dirs() override;
+    ~InotifyWatcher() override;
 
 private:
-    const int BUFFER_SIZE = 4096;
+    // the read buffer grows while reads fill it and shrinks back once they don't
+    static constexpr size_t MIN_BUFFER_SIZE = 64 * 1024;
+    static constexpr size_t MAX_BUFFER_SIZE = 1024 * 1024;
     const int RENAME_DELAY = 200;
     const int MAX_EVENTS = 10;
     const size_t EVENT_SIZE = sizeof(struct inotify_event);
@@ -32,11 +70,53 @@ private:
     int epollfd;
     int timerfd;
     std::string watch_dir;
-    void apply_watchers(const std::string &dir);
+
+    struct DirNode
+    {
+        std::string name;
+        DirNode *parent = nullptr;
+        std::unordered_map<std::string, std::unique_ptr<DirNode>> children;
+        int wd = -1;
+    };
+
+    DirNode root;
+    std::unordered_map<int, DirNode *> wd_to_node;
+
+    std::vector<char> buffer = std::vector<char>(MIN_BUFFER_SIZE);
+    std::vector<std::string> dirty_dirs;
+
+    EventBatch batch;
+
+    // paths of events are built here, and the dirs on the way up to the root found here
+    std::string path_buffer;
+    std::vector<const DirNode *> path_nodes;
+
+    // reads every inotify event queued
+    void read_events();
+
+    // watches dirs under the node which appeared without an event and drops the ones gone
+    void watch_untracked(DirNode *node);
+
+    // watches the dir of the node and every dir under it, a dir watched under another node
+    // takes that node's place instead
+    void apply_watchers(DirNode *node);
+
+    // full path of the dir, watch_dir for the root
+    std::string path_of(const DirNode *node) const;
+
+    // path relative to watch_dir of an entry in the dir, valid till the next call
+    std::string_view relative_path(const DirNode *parent, std::string_view name);
+
+    // node of a dir relative to watch_dir, nullptr when it isn't watched
+    DirNode *find_node(const std::string &dir_path);
+    DirNode *add_child(DirNode *parent, const std::string &name);
+
+    // detaches the node from the tree, watches of the subtree are removed when rm_watches
+    std::unique_ptr<DirNode> detach(DirNode *node, const bool rm_watches);
     void apply_epoll_timer();
     void register_timer();
     void unregister_timer();
-    void fill_events(std::vector<FileEvent> &file_events, struct inotify_event *event);
+    void fill_events(struct inotify_event *event);
 
     struct FileMovePair
     {
@@ -50,8 +130,6 @@ private:
               time_stamp(std::chrono::steady_clock::now()) {}
     };
 
-    std::unordered_map<int, std::string> wd_to_dir;
-
     std::unordered_map<uint32_t, FileMovePair>
         file_moved_tracker;
 };
\ No newline at end of file
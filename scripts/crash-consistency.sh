@@ -0,0 +1,208 @@
+#!/usr/bin/env bash
+# kills the server while it is applying and committing what a client sends, then checks that
+# every file it has is one of the versions the client had, never a torn or empty one. after the
+# last round the client is left to catch up and both data dirs must end up the same.
+#
+# a plain kill keeps what the kernel cached, so it only catches files renamed or patched before
+# they were complete. with --power-cut (needs root, losetup and dmsetup) the server's dir is on a
+# dm-flakey device which drops every write from the kill on, so whatever was not synced is lost
+# like on a power cut and a file renamed before its data was synced shows up empty or stale.
+#
+# usage: scripts/crash-consistency.sh [--power-cut] [rounds]
+# SERVER_BIN, CLIENT_BIN and FILES override the binaries and how many files are written each round
+
+set -euo pipefail
+
+power_cut=0
+if [[ "${1:-}" == "--power-cut" ]]; then
+    power_cut=1
+    shift
+fi
+
+rounds=${1:-10}
+root=$(cd "$(dirname "$0")/.." && pwd)
+server_bin=${SERVER_BIN:-$root/server/output}
+client_bin=${CLIENT_BIN:-$root/client/output}
+files=${FILES:-20}
+
+work=$(mktemp -d /tmp/synclet-crash.XXXXXX)
+server_dir=$work/server
+client_dir=$work/client
+versions=$work/versions
+staging=$work/staging
+
+server_pid=
+client_pid=
+loop_dev=
+flakey=synclet-flakey-$$
+
+cleanup() {
+    [[ -n "$client_pid" ]] && kill "$client_pid" 2>/dev/null || true
+    [[ -n "$server_pid" ]] && kill -KILL "$server_pid" 2>/dev/null || true
+    wait 2>/dev/null || true
+
+    if ((power_cut)); then
+        umount "$server_dir" 2>/dev/null || true
+        dmsetup remove "$flakey" 2>/dev/null || true
+        [[ -n "$loop_dev" ]] && losetup -d "$loop_dev" 2>/dev/null || true
+    fi
+
+    echo "logs and data left in $work"
+}
+trap cleanup EXIT
+
+mkdir -p "$server_dir" "$client_dir/data" "$staging"
+touch "$versions"
+
+# the server's dir on a device whose writes can be cut off
+if ((power_cut)); then
+    truncate -s 512M "$work/server.img"
+    loop_dev=$(losetup -f --show "$work/server.img")
+    sectors=$(blockdev --getsz "$loop_dev")
+
+    dmsetup create "$flakey" --table "0 $sectors linear $loop_dev 0"
+    mkfs.ext4 -q "/dev/mapper/$flakey"
+    mount "/dev/mapper/$flakey" "$server_dir"
+fi
+
+mkdir -p "$server_dir/data"
+
+start_server() {
+    (cd "$server_dir" && exec "$server_bin" >>"$work/server.log" 2>&1) &
+    server_pid=$!
+    sleep 0.5
+}
+
+start_client() {
+    (cd "$client_dir" && exec "$client_bin" >>"$work/client.log" 2>&1) &
+    client_pid=$!
+    sleep 1
+}
+
+stop_client() {
+    kill "$client_pid" 2>/dev/null || true
+    wait "$client_pid" 2>/dev/null || true
+    client_pid=
+}
+
+# writes from here on never reach the disk, what was synced before stays
+cut_power() {
+    dmsetup suspend --nolockfs "$flakey"
+    dmsetup load "$flakey" --table "0 $sectors flakey $loop_dev 0 0 180 1 drop_writes"
+    dmsetup resume "$flakey"
+}
+
+# the device comes back with what was on it at the cut
+restore_power() {
+    umount "$server_dir"
+    dmsetup load "$flakey" --table "0 $sectors linear $loop_dev 0"
+    dmsetup resume "$flakey"
+    mount "/dev/mapper/$flakey" "$server_dir"
+}
+
+crash_server() {
+    ((power_cut)) && cut_power
+
+    kill -KILL "$server_pid"
+    wait "$server_pid" 2>/dev/null || true
+    server_pid=
+
+    ((power_cut)) && restore_power
+    return 0
+}
+
+# a new version of the file put in the client's dir with a rename, so the client never reads
+# one half written. a block changed in place goes through the patch journal, a few bytes
+# appended rebuild the file next to it and a new file comes whole, or in parts when it is over
+# a slice
+write_version() {
+    local name=$1
+    local target=$client_dir/data/$name
+    local next=$staging/$name
+
+    local mode=$((RANDOM % 3))
+    [[ -f "$target" ]] || mode=2
+
+    if ((mode == 0)); then
+        cp "$target" "$next"
+        local size
+        size=$(stat -c %s "$next")
+        dd if=/dev/urandom of="$next" bs=4096 count=1 seek=$((RANDOM % (size / 4096 + 1))) conv=notrunc status=none
+        truncate -s "$size" "$next"
+    elif ((mode == 1)); then
+        cp "$target" "$next"
+        head -c $((RANDOM % 8192 + 1)) /dev/urandom >>"$next"
+    else
+        local size=$(((RANDOM % 4 == 0) ? 6 * 1024 * 1024 + RANDOM : RANDOM * 8 + 1))
+        head -c "$size" /dev/urandom >"$next"
+    fi
+
+    echo "$name $(sha256sum "$next" | cut -d' ' -f1)" >>"$versions"
+    mv "$next" "$target"
+}
+
+# every file the server has must be a whole version the client had of it. checked after the
+# server started again, as patches a crash cut off are finished from the journal on start
+check_server() {
+    local round=$1
+    local failed=0
+
+    while IFS= read -r -d '' path; do
+        local name=${path#"$server_dir/data/"}
+
+        # temp files of unfinished applies are not published
+        [[ "$name" == *.incoming || "$name" == *.staged ]] && continue
+
+        local sum
+        sum=$(sha256sum "$path" | cut -d' ' -f1)
+
+        if ! grep -qxF "$name $sum" "$versions"; then
+            echo "round $round: $name ($(stat -c %s "$path") bytes) is not a version the client had"
+            failed=1
+        fi
+    done < <(find "$server_dir/data" -type f -print0)
+
+    return $failed
+}
+
+start_server
+start_client
+
+status=0
+
+for round in $(seq 1 "$rounds"); do
+    for i in $(seq 1 "$files"); do
+        write_version "file-$i.bin"
+    done
+
+    # somewhere in the middle of receiving and committing them
+    sleep "0.$((RANDOM % 9 + 1))"
+    crash_server
+
+    # nothing is sent to the server while it is checked
+    stop_client
+    start_server
+    check_server "$round" || status=1
+    start_client
+done
+
+# no more crashes, the client reconnects and the server catches up
+for _ in $(seq 1 60); do
+    if diff -rq --exclude='*.incoming' --exclude='*.staged' "$client_dir/data" "$server_dir/data" >/dev/null 2>&1; then
+        break
+    fi
+    sleep 1
+done
+
+if ! diff -rq --exclude='*.incoming' --exclude='*.staged' "$client_dir/data" "$server_dir/data"; then
+    echo "server never caught up with the client"
+    status=1
+fi
+
+if ((status)); then
+    echo "crash consistency check failed"
+else
+    echo "crash consistency check passed: $rounds rounds"
+fi
+
+exit $status
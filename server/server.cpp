@@ -12,10 +12,23 @@
 #include "../include/message.hpp"
 #include "../include/sender-message-handler.hpp"
 #include "../include/receiver-message-handler.hpp"
+#include "../include/data-channels.hpp"
+#include "../include/reactor.hpp"
+#include "../include/change-broadcaster.hpp"
+#include "../include/change-log.hpp"
+#include "../include/resume-store.hpp"
+#include "../include/snapshot-shards.hpp"
+#include "../include/apply-pool.hpp"
+#include "../include/patch-journal.hpp"
+#include "../include/durability-manager.hpp"
+#include <mutex>
+#include <unordered_map>
 
 #define PORT 9000
 #define DATA_DIR "./data"
 #define SNAP_FILE "./snap-file.json"
+#define RESUME_DIR "./.synclet-resume"
+#define JOURNAL_DIR "./.synclet-journal"
 
 std::function<void(int)> signal_handler = nullptr;
 void signal_handler_wrap(int sig)
@@ -24,227 +37,655 @@ void signal_handler_wrap(int sig)
         signal_handler(sig);
 }
 
+// shared by every client, the snapshot lives in its shards and the rest is guarded by the mutex
+struct ServerState
+{
+    SnapshotShards shards{SnapshotShards::shards_from_env()};
+    std::string snap_version;
+
+    std::mutex mutex;
+
+    // recent changes under our own seq and the last seq applied per client session,
+    // both outlive a connection so that a client coming back quickly skips the full sync
+    ChangeLog change_log = ChangeLog::from_env();
+    std::unordered_map<std::string, uint64_t> applied_seqs;
+
+    // data connections by the id their client announced them with, and the ones
+    // which connected before their announcement got handled
+    std::unordered_map<std::string, DataChannels *> channel_owners;
+    std::unordered_map<std::string, std::vector<std::pair<DataChannelPayload, std::unique_ptr<TcpConnection>>>> early_channels;
+};
+
+// what one client connection needs, lives as long as the reactor has the connection
+struct ClientSession
+{
+    Messenger messenger;
+
+    // compression is agreed with each client on its own
+    ChunkCompressor compressor;
+    DataChannels data_channels;
+    ReceiverMessageHandler receiver_message_handler;
+    SenderMessageHandler sender_message_handler;
+
+    // sync session the client said it is and the id its data channels come with
+    std::string session_id;
+    std::string channels_id;
+
+    ClientSession(TcpConnection &connection, BandwidthLimiter &bandwidth_limiter, ResumeStore &resume_store, ApplyPool &apply_pool, PatchJournal &patch_journal, DurabilityManager &durability_manager)
+        : messenger(connection),
+          receiver_message_handler(DATA_DIR, messenger),
+          sender_message_handler(messenger, DATA_DIR)
+    {
+        messenger.set_bandwidth_limiter(&bandwidth_limiter);
+        messenger.set_compressor(&compressor);
+
+        // filled when the client announces its data channels
+        data_channels.set_bandwidth_limiter(&bandwidth_limiter);
+        data_channels.set_compressor(&compressor);
+
+        receiver_message_handler.set_data_channels(&data_channels);
+        sender_message_handler.set_data_channels(&data_channels);
+        receiver_message_handler.set_resume_store(&resume_store);
+        receiver_message_handler.set_apply_pool(&apply_pool);
+        sender_message_handler.set_apply_pool(&apply_pool);
+        receiver_message_handler.set_patch_journal(&patch_journal);
+        receiver_message_handler.set_durability_manager(&durability_manager);
+    }
+};
+
+// snap of the file before a message changes it, none when it is new
+std::optional<FileSnapshot> snap_before(const DirSnapshot &snaps, const std::string &filename)
+{
+    auto it = snaps.find(filename);
+    if (it == snaps.end())
+        return std::nullopt;
+
+    return it->second;
+}
+
+// files are received outside the shards, their snaps are put in afterwards
+void merge_snaps(ServerState &state, DirSnapshot &updates, std::vector<FileUpdate> &file_updates)
+{
+    for (auto &[filename, file_snap] : updates)
+        file_updates.push_back(FileUpdate{.prev_snap = state.shards.put(filename, file_snap), .curr_snap = file_snap});
+}
+
+// a file applied on the pool lands and goes to other clients as soon as it is done, runs on
+// the pool within the file's order so the file is not written meanwhile
+void land_applied(ServerState &state, ChangeBroadcaster &broadcaster, ClientSession &session, const FileSnapshot &file_snap)
+{
+    try
+    {
+        const FileUpdate file_update{.prev_snap = state.shards.put(file_snap.filename, file_snap), .curr_snap = file_snap};
+
+        std::string session_id;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            session_id = session.session_id;
+        }
+
+        if (!broadcaster.has_subscribers(session_id))
+            return;
+
+        std::vector<Frame> frames = broadcaster.encode_file_update(file_update);
+        if (frames.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        frames.push_back(ChangeBroadcaster::encode_seq(state.change_log.current_seq()));
+        broadcaster.broadcast(frames, session_id);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "failed to push applied file " << file_snap.filename << ": " << e.what() << std::endl;
+    }
+}
+
+// every path under the dir, some paths which only contain its name too which the handlers skip
+std::function<bool(const std::string &)> mentions_any(const std::vector<std::string> &dirs)
+{
+    return [dirs](const std::string &path)
+    {
+        return std::ranges::any_of(dirs, [&](const std::string &dir_path)
+                                   { return path.find(dir_path) != std::string::npos; });
+    };
+}
+
+// changes which carry no data go to other clients as they came
+bool is_forwarded(const MessageType type)
+{
+    switch (type)
+    {
+    case MessageType::FILE_REMOVE:
+    case MessageType::FILES_REMOVE:
+    case MessageType::FILE_MOVED:
+    case MessageType::DIR_CREATE:
+    case MessageType::DIR_REMOVE:
+    case MessageType::DIRS_CREATE:
+    case MessageType::DIRS_REMOVE:
+    case MessageType::DIR_MOVED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void handle_message(ServerState &state, ChangeBroadcaster &broadcaster, ApplyPool &apply_pool, ClientSession &session, const Message &msg)
+{
+    auto &receiver_message_handler = session.receiver_message_handler;
+    auto &sender_message_handler = session.sender_message_handler;
+
+    // files whose content this message changed, other clients get their modified chunks
+    std::vector<FileUpdate> file_updates;
+
+    std::clog << "message type is: " << message_type_to_string(msg.type) << std::endl;
+
+    // files still being applied in background are done before any other message can touch them,
+    // a file's own changes wait only for its earlier apply. they landed through land_applied
+    if (msg.type != MessageType::MODIFIED_CHUNK && msg.type != MessageType::SEND_FILE)
+    {
+        DirSnapshot applied;
+        receiver_message_handler.finish_applies(applied);
+    }
+
+    switch (msg.type)
+    {
+
+    // create file and receive data
+    case MessageType::FILE_CREATE:
+    {
+        auto payload = std::get_if<FileCreateRemovePayload>(&(msg.payload));
+        if (payload)
+        {
+            file_updates.push_back(state.shards.run(payload->filename, [&](DirSnapshot &snaps)
+                                                    {
+                                                        auto prev_snap = snap_before(snaps, payload->filename);
+                                                        receiver_message_handler.process_create_file(*payload, snaps);
+                                                        return FileUpdate{.prev_snap = std::move(prev_snap), .curr_snap = snaps[payload->filename]}; }));
+        }
+
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // remove the given file
+    case MessageType::FILE_REMOVE:
+    {
+        if (auto payload = std::get_if<FileCreateRemovePayload>(&(msg.payload)))
+        {
+            state.shards.run(payload->filename, [&](DirSnapshot &snaps)
+                             { receiver_message_handler.process_delete_file(*payload, snaps); });
+        }
+
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // create the given files and append provided data to them
+    case MessageType::FILES_CREATE:
+    {
+        if (auto payload = std::get_if<FilesCreatedPayload>(&(msg.payload)))
+        {
+            std::mutex updates_mutex;
+
+            // each file is created with its shard locked
+            state.shards.run_each(payload->files, [&](const std::string &filename, DirSnapshot &snaps)
+                                  {
+                                      auto prev_snap = snap_before(snaps, filename);
+                                      FilesCreatedPayload file_payload;
+                                      file_payload.files = {filename};
+                                      receiver_message_handler.process_create_file(file_payload, snaps);
+
+                                      // files kept for resuming are left out
+                                      auto it = snaps.find(filename);
+                                      if (it == snaps.end())
+                                          return;
+
+                                      std::lock_guard<std::mutex> lock(updates_mutex);
+                                      file_updates.push_back(FileUpdate{.prev_snap = std::move(prev_snap), .curr_snap = it->second}); });
+        }
+
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+
+        break;
+    }
+
+    // remove given files
+    case MessageType::FILES_REMOVE:
+    {
+        if (auto payload = std::get_if<FilesRemovedPayload>(&(msg.payload)))
+        {
+            state.shards.run_each(payload->files, [&](const std::string &filename, DirSnapshot &snaps)
+                                  { receiver_message_handler.process_delete_file(FileCreateRemovePayload{.filename = filename}, snaps); });
+        }
+
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // rename the given file
+    case MessageType::FILE_MOVED:
+    {
+        if (auto payload = std::get_if<FileMovedPayload>(&(msg.payload)))
+        {
+            // old and new name can belong to different shards
+            state.shards.run_across([&](const std::string &path)
+                                    { return path == payload->old_filename; },
+                                    [&](DirSnapshot &snaps)
+                                    { receiver_message_handler.process_file_moved(*payload, snaps); });
+        }
+
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    case MessageType::DIR_CREATE:
+    {
+        if (auto payload = std::get_if<DirCreateRemovePayload>(&(msg.payload)))
+        {
+            receiver_message_handler.process_create_dir(*payload);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
+        break;
+    }
+
+    case MessageType::DIR_REMOVE:
+    {
+        if (auto payload = std::get_if<DirCreateRemovePayload>(&(msg.payload)))
+        {
+            state.shards.run_across(mentions_any({payload->dir_path}), [&](DirSnapshot &snaps)
+                                    { receiver_message_handler.process_delete_dir(*payload, snaps); });
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
+        break;
+    }
+
+    case MessageType::DIRS_CREATE:
+    {
+        if (auto payload = std::get_if<DirsCreatedRemovedPayload>(&(msg.payload)))
+        {
+            receiver_message_handler.process_create_dir(*payload);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
+        break;
+    }
+
+    case MessageType::DIRS_REMOVE:
+    {
+        if (auto payload = std::get_if<DirsCreatedRemovedPayload>(&(msg.payload)))
+        {
+            state.shards.run_across(mentions_any(payload->dirs), [&](DirSnapshot &snaps)
+                                    { receiver_message_handler.process_delete_dir(*payload, snaps); });
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
+        break;
+    }
+
+    case MessageType::DIR_MOVED:
+    {
+        if (auto payload = std::get_if<DirMovedPayload>(&(msg.payload)))
+        {
+            // the moved entries go to the shards owning their new paths
+            state.shards.run_across(mentions_any({payload->old_dir_path}), [&](DirSnapshot &snaps)
+                                    { receiver_message_handler.process_dir_moved(*payload, snaps); });
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
+        break;
+    }
+
+    // save the modified chunk in corresponding file
+    case MessageType::MODIFIED_CHUNK:
+    {
+        if (auto payload = std::get_if<ModifiedChunkPayload>(&(msg.payload)))
+        {
+            DirSnapshot updates;
+            receiver_message_handler.process_modified_chunk(*payload, updates);
+            merge_snaps(state, updates, file_updates);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    case MessageType::SEND_FILE:
+    {
+        if (auto payload = std::get_if<SendFilePayload>(&(msg.payload)))
+        {
+            DirSnapshot updates;
+            receiver_message_handler.process_file(*payload, updates);
+            merge_snaps(state, updates, file_updates);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // append the given chunk in corresponding file
+    case MessageType::SEND_CHUNK:
+    {
+        if (auto payload = std::get_if<SendChunkPayload>(&(msg.payload)))
+        {
+            DirSnapshot updates;
+            receiver_message_handler.process_file_chunk(*payload, updates);
+            merge_snaps(state, updates, file_updates);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // send the snapshot version to peer as per request
+    case MessageType::REQ_SNAP_VERSION:
+    {
+        sender_message_handler.handle_request_snap_version(state.snap_version);
+        break;
+    }
+
+    // send the whole snapshot to peer as per request
+    case MessageType::REQ_SNAP:
+    {
+        DirSnapshot snaps = state.shards.collect();
+        sender_message_handler.handle_request_snap(snaps);
+        break;
+    }
+
+    case MessageType::REQ_DIR_LIST:
+    {
+        sender_message_handler.handle_request_dir_list();
+        break;
+    }
+    // send the requested chunk to peer
+    case MessageType::REQ_CHUNK:
+    {
+        if (auto payload = std::get_if<RequestChunkPayload>(&(msg.payload)))
+            sender_message_handler.handle_request_chunk(*payload);
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // send the requested files to peer
+    case MessageType::REQ_DOWNLOAD_FILES:
+    {
+        if (auto payload = std::get_if<RequestDownloadFilesPayload>(&(msg.payload)))
+        {
+            DirSnapshot snaps = state.shards.collect();
+            sender_message_handler.handle_request_download_files(*payload, snaps);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // agree on chunk compression with client
+    case MessageType::HANDSHAKE:
+    {
+        if (auto payload = std::get_if<HandshakePayload>(&(msg.payload)))
+            sender_message_handler.handle_handshake(*payload, session.compressor);
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // client tells who it is, reply whether it can skip the full sync
+    case MessageType::SESSION_RESUME:
+    {
+        if (auto payload = std::get_if<SessionResumePayload>(&(msg.payload)))
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            session.session_id = payload->session_id;
+            sender_message_handler.handle_session_resume(*payload, state.applied_seqs, state.change_log);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // everything client sent before this is applied
+    case MessageType::CHANGE_SEQ:
+    {
+        if (auto payload = std::get_if<ChangeSeqPayload>(&(msg.payload)))
+        {
+            // client won't send them again, so they must survive a crash from here
+            receiver_message_handler.make_durable();
+
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.applied_seqs[payload->session_id] = payload->seq;
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // tell client how much of a big file we already have
+    case MessageType::RESUME_QUERY:
+    {
+        if (auto payload = std::get_if<ResumeQueryPayload>(&(msg.payload)))
+            receiver_message_handler.process_resume_query(*payload);
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    // the extra connections client is about to open come through the reactor
+    case MessageType::OPEN_DATA_CHANNELS:
+    {
+        if (auto payload = std::get_if<DataChannelsPayload>(&(msg.payload)))
+        {
+            session.data_channels.expect_channels(*payload);
+
+            std::lock_guard<std::mutex> lock(state.mutex);
+            session.channels_id = payload->session_id;
+            state.channel_owners[payload->session_id] = &session.data_channels;
+
+            for (auto &[hello, connection] : state.early_channels[payload->session_id])
+                session.data_channels.add_channel(hello, std::move(connection));
+            state.early_channels.erase(payload->session_id);
+        }
+        else
+            std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
+        break;
+    }
+
+    default:
+        std::cerr << "unknown message type found" << std::endl;
+        break;
+    }
+
+    // built before taking the lock as file updates read their chunks from disk
+    std::vector<Frame> frames;
+    if (broadcaster.has_subscribers(session.session_id))
+    {
+        if (is_forwarded(msg.type))
+            frames = broadcaster.encode_change(msg);
+
+        // read after the file's applies on the pool, none of them writes it meanwhile
+        for (const auto &file_update : file_updates)
+            apply_pool.run(file_update.curr_snap.filename, [&]()
+                           {
+                               for (auto &frame : broadcaster.encode_file_update(file_update))
+                                   frames.push_back(std::move(frame)); });
+    }
+
+    // gathering the snaps from every shard is worth it only when training is due
+    if (session.compressor.is_retrain_due())
+        session.compressor.maybe_retrain(state.shards.collect(), DATA_DIR);
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    for (const auto &[path, is_directory] : changed_paths(msg))
+        state.change_log.record(path, is_directory, session.session_id);
+
+    // pushed under the lock so that the seq following them is never ahead of what was pushed
+    if (!frames.empty())
+    {
+        frames.push_back(ChangeBroadcaster::encode_seq(state.change_log.current_seq()));
+        broadcaster.broadcast(frames, session.session_id);
+    }
+}
+
+// a data connection belongs to the client which announced it, not to the reactor
+void route_data_channel(ServerState &state, ReactorConnection &conn, const DataChannelPayload &hello)
+{
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    auto owner = state.channel_owners.find(hello.session_id);
+
+    if (owner != state.channel_owners.end())
+        owner->second->add_channel(hello, conn.detach());
+    else
+        state.early_channels[hello.session_id].emplace_back(hello, conn.detach());
+}
+
 int main()
 {
     SnapshotManager snap_manager(DATA_DIR, SNAP_FILE);
 
     try
     {
+        ServerState state;
+
+        // same size changes are written over files in place, a crash in between is finished first
+        PatchJournal patch_journal(JOURNAL_DIR);
+        patch_journal.recover();
+
         // fetch the snaps from SNAP_FILE
         auto &&[snap_version, snaps] = snap_manager.scan_directory();
+        state.snap_version = snap_version;
+
+        // checkpoints of big files being uploaded, kept outside the data dir
+        ResumeStore resume_store(RESUME_DIR);
+
+        // a partially uploaded file is not ours yet, client will send it again. what came of it
+        // waits next to it to be continued
+        for (const auto &filename : resume_store.pending_files())
+        {
+            snaps.erase(filename);
+            snaps.erase(filename + ".incoming");
+        }
+
+        state.shards.insert(std::move(snaps));
 
         // create a server on localhost
         TcpServer server("127.0.0.1", std::to_string(PORT));
         std::clog<<"Server is Listening on Port: "<<PORT<<std::endl;
 
-        TcpConnection client = server.acceptClient();
-        Messenger messenger(client);
+        // loopback stand-in for a slow link, disabled unless configured
+        const LinkShaping link_shaping = LinkShaping::from_env();
 
-        signal_handler = [&client](int _)
+        // per traffic class limits so that syncing doesn't starve other traffic
+        BandwidthLimiter bandwidth_limiter = BandwidthLimiter::from_env();
+
+        signal_handler = [&bandwidth_limiter](int _)
         {
-            client.closeConnection();
+            bandwidth_limiter.print_stats();
             exit(EXIT_SUCCESS);
         };
 
         signal(SIGINT, signal_handler_wrap);
 
-        ReceiverMessageHandler receiver_message_handler(DATA_DIR, messenger);
-        SenderMessageHandler sender_message_handler(messenger, DATA_DIR);
+        // one entry per connection the reactor has
+        std::mutex sessions_mutex;
+        std::unordered_map<uint64_t, std::unique_ptr<ClientSession>> sessions;
 
-        while (true)
+        const auto find_session = [&](const uint64_t id) -> ClientSession *
         {
-            const Message &msg = messenger.receive_json_message();
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            auto it = sessions.find(id);
+            return it != sessions.end() ? it->second.get() : nullptr;
+        };
 
-            std::clog << "message type is: " << message_type_to_string(msg.type) << std::endl;
+        // shared by every client, files of one client are applied while it sends the next ones
+        ApplyPool apply_pool = ApplyPool::from_env();
 
-            switch (msg.type)
-            {
+        // applied files of every client are synced to disk together
+        DurabilityManager durability_manager = DurabilityManager::from_env();
 
-            // create file and receive data
-            case MessageType::FILE_CREATE:
-            {
-                auto payload = std::get_if<FileCreateRemovePayload>(&(msg.payload));
-                if (payload)
-                    receiver_message_handler.process_create_file(*payload, snaps);
-
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
+        Reactor reactor(server, Reactor::workers_from_env(), Reactor::queue_limit_from_env());
 
-            // remove the given file
-            case MessageType::FILE_REMOVE:
-            {
-                if (auto payload = std::get_if<FileCreateRemovePayload>(&(msg.payload)))
-                    receiver_message_handler.process_delete_file(*payload, snaps);
+        // pushes to other clients count as realtime traffic
+        reactor.set_bandwidth_limiter(&bandwidth_limiter);
 
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
+        // changes of a client are pushed to the others as soon as they are applied
+        ChangeBroadcaster broadcaster(reactor, DATA_DIR);
 
-            // create the given files and append provided data to them
-            case MessageType::FILES_CREATE:
+        reactor.set_handlers(
+            [&](ReactorConnection &conn)
             {
-                if (auto payload = std::get_if<FilesCreatedPayload>(&(msg.payload)))
-                    receiver_message_handler.process_create_file(*payload, snaps);
-
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-
-                break;
-            }
-
-            // remove given files
-            case MessageType::FILES_REMOVE:
+                conn.get_connection().setLinkShaping(link_shaping);
+
+                std::lock_guard<std::mutex> lock(sessions_mutex);
+                auto session = std::make_unique<ClientSession>(conn.get_connection(), bandwidth_limiter, resume_store, apply_pool, patch_journal, durability_manager);
+                session->receiver_message_handler.set_snap_lookup([&state](const std::string &filename)
+                                                                  { return state.shards.get(filename); });
+                session->receiver_message_handler.set_on_applied([&state, &broadcaster, session = session.get()](const FileSnapshot &file_snap)
+                                                                 { land_applied(state, broadcaster, *session, file_snap); });
+                sessions[conn.get_id()] = std::move(session);
+            },
+            [&](ReactorConnection &conn, const std::string &message)
             {
-                if (auto payload = std::get_if<FilesRemovedPayload>(&(msg.payload)))
-                    receiver_message_handler.process_delete_file(*payload, snaps);
+                ClientSession *session = find_session(conn.get_id());
+                if (!session)
+                    return;
 
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
+                const Message &msg = session->messenger.decode_json_message(message);
 
-            // rename the given file
-            case MessageType::FILE_MOVED:
-            {
-                if (auto payload = std::get_if<FileMovedPayload>(&(msg.payload)))
-                    receiver_message_handler.process_file_moved(*payload, snaps);
+                if (auto hello = std::get_if<DataChannelPayload>(&(msg.payload)))
+                    return route_data_channel(state, conn, *hello);
 
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
+                // this connection only gets pushes from now on
+                if (auto subscribe = std::get_if<SubscribePayload>(&(msg.payload)))
+                    return broadcaster.subscribe(conn.get_id(), subscribe->session_id);
 
-            case MessageType::DIR_CREATE:
+                handle_message(state, broadcaster, apply_pool, *session, msg);
+            },
+            [&](ReactorConnection &conn)
             {
-                if (auto payload = std::get_if<DirCreateRemovePayload>(&(msg.payload)))
-                {
-                    receiver_message_handler.process_create_dir(*payload);
-                }
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
-                break;
-            }
+                broadcaster.unsubscribe(conn.get_id());
 
-            case MessageType::DIR_REMOVE:
-            {
-                if (auto payload = std::get_if<DirCreateRemovePayload>(&(msg.payload)))
+                std::unique_ptr<ClientSession> session;
                 {
-                    receiver_message_handler.process_delete_dir(*payload, snaps);
+                    std::lock_guard<std::mutex> lock(sessions_mutex);
+                    auto it = sessions.find(conn.get_id());
+                    if (it == sessions.end())
+                        return;
+
+                    session = std::move(it->second);
+                    sessions.erase(it);
                 }
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
-                break;
-            }
 
-            case MessageType::DIRS_CREATE:
-            {
-                if (auto payload = std::get_if<DirsCreatedRemovedPayload>(&(msg.payload)))
                 {
-                    receiver_message_handler.process_create_dir(*payload);
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    if (!session->channels_id.empty())
+                        state.channel_owners.erase(session->channels_id);
                 }
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
-                break;
-            }
 
-            case MessageType::DIRS_REMOVE:
-            {
-                if (auto payload = std::get_if<DirsCreatedRemovedPayload>(&(msg.payload)))
+                // files whose last chunk came are kept, they land as their applies finish
+                try
                 {
-                    receiver_message_handler.process_delete_dir(*payload, snaps);
+                    DirSnapshot applied;
+                    session->receiver_message_handler.finish_applies(applied);
                 }
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
-                break;
-            }
-
-            case MessageType::DIR_MOVED:
-            {
-                if (auto payload = std::get_if<DirMovedPayload>(&(msg.payload)))
+                catch (const std::exception &e)
                 {
-                    receiver_message_handler.process_dir_moved(*payload, snaps);
+                    std::cerr << "failed to apply file of closed connection: " << e.what() << std::endl;
                 }
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type) << std::endl;
-                break;
-            }
-           
-            // save the modified chunk in corresponding file
-            case MessageType::MODIFIED_CHUNK:
-            {
-                if (auto payload = std::get_if<ModifiedChunkPayload>(&(msg.payload)))
-                    receiver_message_handler.process_modified_chunk(*payload, snaps);
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
-
-            case MessageType::SEND_FILE:
-            {
-                if (auto payload = std::get_if<SendFilePayload>(&(msg.payload)))
-                    receiver_message_handler.process_file(*payload, snaps);
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
-
-            // append the given chunk in corresponding file
-            case MessageType::SEND_CHUNK:
-            {
-                if (auto payload = std::get_if<SendChunkPayload>(&(msg.payload)))
-                    receiver_message_handler.process_file_chunk(*payload, snaps);
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
-
-            // send the snapshot version to peer as per request
-            case MessageType::REQ_SNAP_VERSION:
-            {
-                sender_message_handler.handle_request_snap_version(snap_version);
-                break;
-            }
 
-            // send the whole snapshot to peer as per request
-            case MessageType::REQ_SNAP:
-            {
-                sender_message_handler.handle_request_snap(snaps);
-                break;
-            }
+                // whatever was half received is of no use, the client replays it
+                session->receiver_message_handler.discard_staged_chunks();
+            });
 
-            case MessageType::REQ_DIR_LIST:
-            {
-                sender_message_handler.handle_request_dir_list();
-                break;
-            }
-            // send the requested chunk to peer
-            case MessageType::REQ_CHUNK:
-            {
-                if (auto payload = std::get_if<RequestChunkPayload>(&(msg.payload)))
-                    sender_message_handler.handle_request_chunk(*payload);
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
-
-            // send the requested files to peer
-            case MessageType::REQ_DOWNLOAD_FILES:
-            {
-                if (auto payload = std::get_if<RequestDownloadFilesPayload>(&(msg.payload)))
-                    sender_message_handler.handle_request_download_files(*payload, snaps);
-                else
-                    std::cerr << "invalid payload for: " << message_type_to_string(msg.type);
-                break;
-            }
-
-            default:
-                std::cerr << "unknown message type found" << std::endl;
-                break;
-            }
-        }
+        reactor.run();
     }
     catch (const std::exception &e)
     {
@@ -252,4 +693,4 @@ int main()
     }
 
     return 0;
-}
\ No newline at end of file
+}
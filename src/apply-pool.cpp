@@ -0,0 +1,99 @@
+#include "../include/apply-pool.hpp"
+#include "../include/utils.hpp"
+#include <future>
+
+ApplyPool::ApplyPool(const size_t no_of_workers, const size_t max_queued)
+    : max_queued(std::max<size_t>(max_queued, 1))
+{
+    for (size_t i = 0; i < std::max<size_t>(no_of_workers, 1); i++)
+        workers.emplace_back(&ApplyPool::worker_loop, this);
+}
+
+ApplyPool::~ApplyPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_stopping = true;
+    }
+    has_jobs.notify_all();
+    has_room.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+ApplyPool ApplyPool::from_env()
+{
+    return ApplyPool(get_env_number("SYNCLET_APPLY_WORKERS", 4),
+                     get_env_number("SYNCLET_APPLY_QUEUE", 16));
+}
+
+void ApplyPool::submit(const std::string &filename, std::function<void()> job)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        has_room.wait(lock, [&]()
+                      { return is_stopping || queue.size() < max_queued; });
+
+        queue.push_back(Job{.filename = filename, .run = std::move(job)});
+    }
+    has_jobs.notify_one();
+}
+
+void ApplyPool::run(const std::string &filename, std::function<void()> job)
+{
+    std::promise<void> done;
+    std::future<void> result = done.get_future();
+
+    submit(filename, [&]()
+           {
+               try
+               {
+                   job();
+                   done.set_value();
+               }
+               catch (...)
+               {
+                   done.set_exception(std::current_exception());
+               } });
+
+    result.get();
+}
+
+std::deque<ApplyPool::Job>::iterator ApplyPool::next_runnable()
+{
+    return std::ranges::find_if(queue, [&](const Job &job)
+                                { return !running_files.contains(job.filename); });
+}
+
+void ApplyPool::worker_loop()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            has_jobs.wait(lock, [&]()
+                          { return is_stopping || next_runnable() != queue.end(); });
+
+            if (is_stopping)
+                return;
+
+            auto it = next_runnable();
+            job = std::move(*it);
+            queue.erase(it);
+            running_files.insert(job.filename);
+        }
+        has_room.notify_one();
+
+        job.run();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running_files.erase(job.filename);
+        }
+
+        // a job of the same file may have been waiting for this one
+        has_jobs.notify_all();
+    }
+}
@@ -0,0 +1,179 @@
+#include "../include/async-messenger.hpp"
+#include "../include/messenger.hpp"
+#include <format>
+
+AsyncMessenger::AsyncMessenger(TcpConnection &conn, Executor &executor)
+    : connection(conn),
+      executor(executor),
+      send_turns(executor),
+      receive_turns(executor) {}
+
+void AsyncMessenger::set_compressor(ChunkCompressor *compressor)
+{
+    this->compressor = compressor;
+}
+
+void AsyncMessenger::set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter)
+{
+    this->bandwidth_limiter = bandwidth_limiter;
+}
+
+Executor &AsyncMessenger::get_executor()
+{
+    return executor;
+}
+
+// every ticket goes through both turns even after a failure, else the ones after it would wait forever
+Task<AsyncReply> AsyncMessenger::request(Message msg)
+{
+    const uint64_t ticket = next_ticket++;
+    std::exception_ptr exception;
+    AsyncReply reply;
+
+    co_await send_turns.wait_turn(ticket);
+    try
+    {
+        if (is_broken)
+            throw std::runtime_error("connection broke with requests in flight");
+
+        std::string data = Messenger::encode_json_message(msg);
+        co_await send_all(std::move(data));
+    }
+    catch (...)
+    {
+        exception = std::current_exception();
+        is_broken = true;
+    }
+    send_turns.advance();
+
+    co_await receive_turns.wait_turn(ticket);
+    try
+    {
+        if (exception || is_broken)
+            throw std::runtime_error("connection broke with requests in flight");
+
+        reply.message = co_await receive_json_message();
+
+        if (auto payload = std::get_if<SendChunkPayload>(&(reply.message.payload)))
+            reply.data = co_await receive_chunk_data(*payload);
+    }
+    catch (...)
+    {
+        if (!exception)
+            exception = std::current_exception();
+        is_broken = true;
+    }
+    receive_turns.advance();
+
+    if (exception)
+        std::rethrow_exception(exception);
+
+    co_return reply;
+}
+
+Task<void> AsyncMessenger::send_all(std::string data)
+{
+    size_t total_sent = 0;
+
+    while (total_sent < data.size())
+    {
+        // parked till the class has tokens, what a write sends is paid for after it
+        while (bandwidth_limiter)
+        {
+            const auto wait = bandwidth_limiter->delay(TrafficClass::CONTROL);
+            if (wait == std::chrono::nanoseconds::zero())
+                break;
+            co_await executor.sleep_for(wait);
+        }
+
+        const ssize_t sent = send(connection.getFD(),
+                                  data.data() + total_sent,
+                                  data.size() - total_sent,
+                                  MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (sent >= 0)
+        {
+            total_sent += sent;
+            if (bandwidth_limiter)
+                bandwidth_limiter->consume(TrafficClass::CONTROL, sent);
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await executor.wait_fd(connection.getFD(), EPOLLOUT);
+        else if (errno != EINTR)
+            throw std::runtime_error(std::format("send failed: {}", std::strerror(errno)));
+    }
+}
+
+Task<std::string> AsyncMessenger::receive_exact(const size_t size)
+{
+    std::string result(size, '\0');
+    size_t total_received = 0;
+
+    while (total_received < size)
+    {
+        const ssize_t received = recv(connection.getFD(),
+                                      result.data() + total_received,
+                                      size - total_received,
+                                      MSG_DONTWAIT);
+
+        if (received > 0)
+            total_received += received;
+        else if (received == 0)
+            throw std::runtime_error("Unexpected EOF");
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await executor.wait_fd(connection.getFD(), EPOLLIN);
+        else if (errno != EINTR)
+            throw std::runtime_error(std::format("recv failed: {}", std::strerror(errno)));
+    }
+
+    co_return result;
+}
+
+// dictionaries can come before any chunk so they are taken here and the next message is returned
+Task<Message> AsyncMessenger::receive_json_message()
+{
+    while (true)
+    {
+        const std::string &json_len_string = co_await receive_exact(sizeof(uint32_t));
+        uint32_t json_len;
+        memcpy(&json_len, json_len_string.data(), sizeof(json_len));
+
+        const std::string &message = co_await receive_exact(ntohl(json_len));
+
+        Message msg;
+        msg.payload = std::monostate{};
+
+        if (!message.empty())
+            from_json(json::parse(message), msg);
+
+        auto payload = std::get_if<DictionaryPayload>(&(msg.payload));
+        if (!payload)
+            co_return msg;
+
+        if (!compressor)
+            throw std::runtime_error("dictionary received without agreeing on compression");
+
+        const std::string &dictionary = co_await receive_exact(payload->dict_size);
+        compressor->add_peer_dictionary(payload->dict_version, dictionary);
+    }
+}
+
+Task<std::string> AsyncMessenger::receive_chunk_data(SendChunkPayload payload)
+{
+    if (payload.compression == Compression::NONE)
+    {
+        std::string chunk_data = co_await receive_exact(payload.wire_size);
+
+        if (chunk_data.size() != payload.chunk_size)
+            throw std::runtime_error(std::format("chunk of {} bytes received as {} bytes", payload.chunk_size, chunk_data.size()));
+
+        co_return chunk_data;
+    }
+
+    if (!compressor)
+        throw std::runtime_error("compressed chunk received without agreeing on compression");
+
+    const std::string &wire_data = co_await receive_exact(payload.wire_size);
+
+    co_return compressor->decompress(payload.compression, wire_data, payload.chunk_size, payload.dict_version);
+}
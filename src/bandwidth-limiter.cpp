@@ -0,0 +1,226 @@
+#include "../include/bandwidth-limiter.hpp"
+#include "../include/utils.hpp"
+#include <algorithm>
+#include <iostream>
+#include <format>
+
+namespace
+{
+    size_t index_of(const TrafficClass traffic_class)
+    {
+        return static_cast<size_t>(traffic_class);
+    }
+
+    // a quarter second of traffic when no burst is given
+    size_t default_burst(const size_t rate)
+    {
+        return std::max<size_t>(rate / 4, 16 * 1024);
+    }
+}
+
+BandwidthLimiter::BandwidthLimiter(const std::array<ClassLimit, NO_OF_CLASSES> &limits)
+    : last_refill(std::chrono::steady_clock::now())
+{
+    for (size_t i = 0; i < NO_OF_CLASSES; i++)
+    {
+        buckets[i].limit = limits[i];
+
+        if (buckets[i].limit.rate && !buckets[i].limit.burst)
+            buckets[i].limit.burst = default_burst(buckets[i].limit.rate);
+
+        // start full so that the first burst goes right away
+        buckets[i].tokens = buckets[i].limit.burst;
+    }
+}
+
+BandwidthLimiter BandwidthLimiter::from_env()
+{
+    const auto limit_from_env = [](const std::string &name)
+    {
+        return ClassLimit{
+            .rate = get_env_number(std::format("SYNCLET_RATE_{}_KBPS", name), 0) * 1024,
+            .burst = get_env_number(std::format("SYNCLET_BURST_{}_KB", name), 0) * 1024};
+    };
+
+    return BandwidthLimiter({limit_from_env("CONTROL"),
+                             limit_from_env("INTERACTIVE"),
+                             limit_from_env("BULK")});
+}
+
+void BandwidthLimiter::set_limit(const TrafficClass traffic_class, const ClassLimit &limit)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        refill();
+
+        Bucket &bucket = buckets[index_of(traffic_class)];
+        bucket.limit = limit;
+
+        if (bucket.limit.rate && !bucket.limit.burst)
+            bucket.limit.burst = default_burst(bucket.limit.rate);
+
+        bucket.tokens = std::min<double>(bucket.tokens, bucket.limit.burst);
+    }
+
+    // waiting senders should see the new limit right away
+    limit_changed.notify_all();
+}
+
+ClassLimit BandwidthLimiter::get_limit(const TrafficClass traffic_class) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return buckets[index_of(traffic_class)].limit;
+}
+
+// called with mutex held
+void BandwidthLimiter::refill()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - last_refill).count();
+    last_refill = now;
+
+    double spare_capacity = 0;
+
+    for (auto &bucket : buckets)
+    {
+        if (!bucket.limit.rate)
+            continue;
+
+        spare_capacity += bucket.limit.burst;
+        bucket.tokens += bucket.limit.rate * elapsed;
+
+        // a full bucket means the class is idle, what it can't hold is free for others
+        if (bucket.tokens > bucket.limit.burst)
+        {
+            spare_tokens += bucket.tokens - bucket.limit.burst;
+            bucket.tokens = bucket.limit.burst;
+        }
+    }
+
+    spare_tokens = std::min(spare_tokens, spare_capacity);
+}
+
+void BandwidthLimiter::acquire(const TrafficClass traffic_class, const size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Bucket &bucket = buckets[index_of(traffic_class)];
+
+    const auto start = std::chrono::steady_clock::now();
+
+    while (bucket.limit.rate)
+    {
+        refill();
+
+        // more than the burst can never fit so it goes once the bucket is full and is paid back later
+        const double needed = std::min<double>(bytes, bucket.limit.burst);
+        if (bucket.tokens >= needed)
+        {
+            bucket.tokens -= bytes;
+            break;
+        }
+
+        // own tokens are not enough, take the rest from what idle classes left
+        const double missing = bytes - std::max(0.0, bucket.tokens);
+        if (spare_tokens >= missing)
+        {
+            spare_tokens -= missing;
+            bucket.tokens = std::min(0.0, bucket.tokens);
+            bucket.stats.bytes_borrowed += static_cast<size_t>(missing);
+            break;
+        }
+
+        // wait till own bucket alone would have enough
+        const auto wait_for = std::chrono::duration<double>((needed - bucket.tokens) / bucket.limit.rate);
+        limit_changed.wait_for(lock, std::chrono::duration_cast<std::chrono::nanoseconds>(wait_for));
+    }
+
+    bucket.stats.bytes_sent += bytes;
+    bucket.stats.waited += std::chrono::steady_clock::now() - start;
+}
+
+std::chrono::nanoseconds BandwidthLimiter::delay(const TrafficClass traffic_class)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Bucket &bucket = buckets[index_of(traffic_class)];
+
+    if (!bucket.limit.rate)
+        return std::chrono::nanoseconds(0);
+
+    refill();
+
+    if (bucket.tokens > 0 || spare_tokens > 0)
+        return std::chrono::nanoseconds(0);
+
+    // till the debt is paid back and a byte more
+    const auto wait_for = std::chrono::duration<double>((1 - bucket.tokens) / bucket.limit.rate);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(wait_for);
+}
+
+void BandwidthLimiter::consume(const TrafficClass traffic_class, const size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Bucket &bucket = buckets[index_of(traffic_class)];
+
+    bucket.stats.bytes_sent += bytes;
+
+    if (!bucket.limit.rate)
+        return;
+
+    refill();
+    bucket.tokens -= bytes;
+
+    if (bucket.tokens < 0 && spare_tokens > 0)
+    {
+        const double borrowed = std::min(spare_tokens, -bucket.tokens);
+        spare_tokens -= borrowed;
+        bucket.tokens += borrowed;
+        bucket.stats.bytes_borrowed += static_cast<size_t>(borrowed);
+    }
+}
+
+size_t BandwidthLimiter::slice_size(const TrafficClass traffic_class) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const ClassLimit &limit = buckets[index_of(traffic_class)].limit;
+
+    return limit.rate ? limit.burst : SIZE_MAX;
+}
+
+TrafficStats BandwidthLimiter::get_stats(const TrafficClass traffic_class) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return buckets[index_of(traffic_class)].stats;
+}
+
+void BandwidthLimiter::print_stats() const
+{
+    for (size_t i = 0; i < NO_OF_CLASSES; i++)
+    {
+        const auto traffic_class = static_cast<TrafficClass>(i);
+        const ClassLimit &limit = get_limit(traffic_class);
+        const TrafficStats &stats = get_stats(traffic_class);
+
+        std::clog << std::format("{}: sent {} bytes, borrowed {} bytes, waited {} ms, limit {}",
+                                 traffic_class_to_string(traffic_class),
+                                 stats.bytes_sent,
+                                 stats.bytes_borrowed,
+                                 std::chrono::duration_cast<std::chrono::milliseconds>(stats.waited).count(),
+                                 limit.rate ? std::format("{} B/s", limit.rate) : std::string("none"))
+                  << std::endl;
+    }
+}
+
+std::string traffic_class_to_string(const TrafficClass traffic_class)
+{
+    switch (traffic_class)
+    {
+    case TrafficClass::CONTROL:
+        return "CONTROL";
+    case TrafficClass::INTERACTIVE:
+        return "INTERACTIVE";
+    case TrafficClass::BULK:
+        return "BULK";
+    default:
+        return "UNKNOWN";
+    }
+}
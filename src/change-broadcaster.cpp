@@ -0,0 +1,133 @@
+#include "../include/change-broadcaster.hpp"
+#include "../include/messenger.hpp"
+#include "../include/snapshot-manager.hpp"
+#include "../include/file-io.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+ChangeBroadcaster::ChangeBroadcaster(Reactor &reactor, const std::string &working_dir)
+    : reactor(reactor),
+      working_dir(working_dir) {}
+
+void ChangeBroadcaster::subscribe(const uint64_t connection_id, const std::string &session_id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    subscribers[connection_id] = session_id;
+
+    std::clog << "session " << session_id << " subscribed to changes" << std::endl;
+}
+
+void ChangeBroadcaster::unsubscribe(const uint64_t connection_id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    subscribers.erase(connection_id);
+}
+
+bool ChangeBroadcaster::has_subscribers(const std::string &origin) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return std::ranges::any_of(subscribers, [&](const auto &subscriber)
+                               { return subscriber.second != origin; });
+}
+
+std::vector<Frame> ChangeBroadcaster::encode_change(const Message &msg) const
+{
+    return {std::make_shared<const std::string>(Messenger::encode_json_message(msg))};
+}
+
+std::vector<Frame> ChangeBroadcaster::encode_file_update(const FileUpdate &file_update) const
+{
+    const FileSnapshot &curr_snap = file_update.curr_snap;
+
+    // a new file is put together from nothing
+    const FileModification &file_modification = SnapshotManager::get_file_modification(
+        curr_snap,
+        file_update.prev_snap.value_or(FileSnapshot(curr_snap.filename, 0, 0, {})));
+
+    // same content as before, like a file saved without changes
+    if (file_update.prev_snap && file_modification.modified_chunks.empty())
+        return {};
+
+    std::vector<Frame> frames;
+    frames.reserve(file_modification.modified_chunks.size() + 1);
+
+    const Message msg{
+        .type = MessageType::FILE_UPDATE,
+        .payload = FileUpdatePayload{
+            .filename = curr_snap.filename,
+            .base_digest = file_update.prev_snap ? SnapshotManager::file_digest(*file_update.prev_snap) : "",
+            .file_digest = SnapshotManager::file_digest(curr_snap),
+            .no_of_chunks = file_modification.modified_chunks.size()}};
+
+    frames.push_back(std::make_shared<const std::string>(Messenger::encode_json_message(msg)));
+
+    if (file_modification.modified_chunks.empty())
+        return frames;
+
+    FileIO fileio(working_dir + "/" + curr_snap.filename);
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (const auto &modified_chunk : file_modification.modified_chunks)
+        if (modified_chunk.chunk_type != ChunkType::REMOVE)
+            ranges.emplace_back(modified_chunk.offset, modified_chunk.chunk_size);
+
+    std::vector<std::string> chunks_data = fileio.read_ranges(ranges);
+    size_t next_data = 0;
+
+    // what was read must be the chunks curr_snap has at those offsets
+    std::unordered_map<uint64_t, std::string> hash_at;
+    for (const auto &[hash, chunk] : curr_snap.chunks)
+        hash_at[chunk.offset] = hash;
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        auto it = hash_at.find(ranges[i].first);
+
+        if (it == hash_at.end() || SnapshotManager::chunk_hash(chunks_data[i]) != it->second)
+        {
+            std::clog << curr_snap.filename << " changed again before its update was pushed, skipping it" << std::endl;
+            return {};
+        }
+    }
+
+    // chunks go raw, compression is agreed with each client on its own
+    for (const auto &modified_chunk : file_modification.modified_chunks)
+    {
+        ModifiedChunkPayload payload = modified_chunk;
+        payload.wire_size = payload.chunk_type != ChunkType::REMOVE ? payload.chunk_size : 0;
+
+        if (payload.is_last_chunk)
+            SnapshotManager::attach_file_snap(payload, file_modification);
+
+        std::string frame = Messenger::encode_json_message(Message{.type = MessageType::MODIFIED_CHUNK, .payload = payload});
+
+        if (payload.chunk_type != ChunkType::REMOVE)
+            frame += chunks_data[next_data++];
+
+        frames.push_back(std::make_shared<const std::string>(std::move(frame)));
+    }
+
+    return frames;
+}
+
+Frame ChangeBroadcaster::encode_seq(const uint64_t seq)
+{
+    const Message msg{
+        .type = MessageType::CHANGE_SEQ,
+        .payload = ChangeSeqPayload{.session_id = "", .seq = seq}};
+
+    return std::make_shared<const std::string>(Messenger::encode_json_message(msg));
+}
+
+void ChangeBroadcaster::broadcast(const std::vector<Frame> &frames, const std::string &origin)
+{
+    if (frames.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (const auto &[connection_id, session_id] : subscribers)
+        if (session_id != origin)
+            reactor.post(connection_id, frames);
+}
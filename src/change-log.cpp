@@ -0,0 +1,38 @@
+#include "../include/change-log.hpp"
+#include "../include/utils.hpp"
+#include <algorithm>
+
+ChangeLog::ChangeLog(const size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+ChangeLog ChangeLog::from_env()
+{
+    return ChangeLog(get_env_number("SYNCLET_CHANGE_LOG_SIZE", 4096));
+}
+
+uint64_t ChangeLog::record(const std::string &path, const bool is_directory, const std::string &origin)
+{
+    records.push_back(ChangeRecord{
+        .seq = ++seq,
+        .path = path,
+        .is_directory = is_directory,
+        .origin = origin});
+
+    if (records.size() > capacity)
+        records.pop_front();
+
+    return seq;
+}
+
+uint64_t ChangeLog::current_seq() const
+{
+    return seq;
+}
+
+std::optional<std::vector<ChangeRecord>> ChangeLog::changes_since(const uint64_t since) const
+{
+    // records hold the last records.size() seqs without gaps
+    if (since > seq || since < seq - records.size())
+        return std::nullopt;
+
+    return std::vector<ChangeRecord>(records.end() - (seq - since), records.end());
+}
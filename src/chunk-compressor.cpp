@@ -0,0 +1,443 @@
+#include "../include/chunk-compressor.hpp"
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <thread>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <random>
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
+#include <zdict.h>
+#include "../include/file-io.hpp"
+#include "../include/utils.hpp"
+
+namespace
+{
+    // every thread keeps its own zstd context instead of allocating one per chunk
+    ZSTD_CCtx *thread_zstd_context()
+    {
+        thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        return context.get();
+    }
+
+    ZSTD_DCtx *thread_zstd_dcontext()
+    {
+        thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        return context.get();
+    }
+
+    // 1 minute load average per core, > 1 means cpu has no headroom left
+    double load_per_core()
+    {
+        double load[1];
+        const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+        if (getloadavg(load, 1) != 1)
+            return 0;
+
+        return load[0] / cores;
+    }
+}
+
+ChunkCompressor::ChunkCompressor(const Compression compression)
+    : retrain_interval(get_env_number("SYNCLET_DICT_RETRAIN_SEC", 600))
+{
+    set_compression(compression);
+}
+
+ChunkCompressor::~ChunkCompressor()
+{
+    if (trainer.joinable())
+        trainer.join();
+}
+
+void ChunkCompressor::set_compression(const Compression compression)
+{
+    this->compression = compression;
+
+    // zstd starts from its default level, lz4 from its fastest one
+    level = compression == Compression::ZSTD ? 3 : level_range(compression).first;
+}
+
+Compression ChunkCompressor::get_compression() const
+{
+    return compression;
+}
+
+std::vector<Compression> ChunkCompressor::supported()
+{
+    return {Compression::ZSTD, Compression::LZ4};
+}
+
+Compression ChunkCompressor::pick(const std::vector<Compression> &offered)
+{
+    for (auto compression : supported())
+        if (std::find(offered.begin(), offered.end(), compression) != offered.end())
+            return compression;
+
+    return Compression::NONE;
+}
+
+std::pair<int, int> ChunkCompressor::level_range(const Compression compression)
+{
+    switch (compression)
+    {
+    case Compression::ZSTD:
+        return {1, 19};
+    case Compression::LZ4:
+        // 1 is the fast compressor, above it is lz4hc
+        return {1, 12};
+    default:
+        return {0, 0};
+    }
+}
+
+// quick look at a sample of the chunk, shannon entropy of already compressed data is ~8 bits/byte
+bool ChunkCompressor::looks_compressible(const std::string &data, const double max_entropy)
+{
+    constexpr size_t SAMPLE_RUNS = 16;
+    constexpr size_t RUN_SIZE = 256;
+
+    std::array<size_t, 256> counts{};
+    size_t sampled = 0;
+
+    // take evenly spaced runs so that a compressible header can't fool the probe
+    const size_t stride = std::max(RUN_SIZE, data.size() / SAMPLE_RUNS);
+    for (size_t start = 0; start < data.size() && sampled < SAMPLE_RUNS * RUN_SIZE; start += stride)
+    {
+        const size_t end = std::min(data.size(), start + RUN_SIZE);
+        for (size_t i = start; i < end; i++)
+            counts[static_cast<unsigned char>(data[i])]++;
+
+        sampled += end - start;
+    }
+
+    double entropy = 0;
+    for (auto count : counts)
+    {
+        if (count == 0)
+            continue;
+
+        const double p = static_cast<double>(count) / sampled;
+        entropy -= p * std::log2(p);
+    }
+
+    return entropy <= max_entropy;
+}
+
+std::string ChunkCompressor::compress_with(const Compression compression, const int level, const std::string &data) const
+{
+    std::string compressed;
+
+    if (compression == Compression::LZ4)
+    {
+        compressed.resize(LZ4_compressBound(static_cast<int>(data.size())));
+
+        const int size = level <= 1
+                             ? LZ4_compress_default(data.data(), compressed.data(), static_cast<int>(data.size()), static_cast<int>(compressed.size()))
+                             : LZ4_compress_HC(data.data(), compressed.data(), static_cast<int>(data.size()), static_cast<int>(compressed.size()), level);
+
+        if (size <= 0)
+            throw std::runtime_error("lz4 compression failed");
+
+        compressed.resize(size);
+    }
+    else if (compression == Compression::ZSTD)
+    {
+        compressed.resize(ZSTD_compressBound(data.size()));
+
+        const size_t size = ZSTD_compressCCtx(thread_zstd_context(), compressed.data(), compressed.size(), data.data(), data.size(), level);
+
+        if (ZSTD_isError(size))
+            throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(size));
+
+        compressed.resize(size);
+    }
+
+    return compressed;
+}
+
+CompressedChunk ChunkCompressor::compress(const std::string &data, const std::shared_ptr<const ZstdDictionary> &dictionary)
+{
+    const Compression current = compression;
+
+    if (current == Compression::NONE ||
+        data.size() < MIN_COMPRESS_SIZE ||
+        !looks_compressible(data, MAX_ENTROPY))
+        return {Compression::NONE, data};
+
+    const bool use_dictionary = current == Compression::ZSTD &&
+                                dictionary &&
+                                data.size() <= DICT_MAX_CHUNK_SIZE;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::string compressed;
+
+    if (use_dictionary)
+    {
+        compressed.resize(ZSTD_compressBound(data.size()));
+
+        const size_t size = ZSTD_compress_usingCDict(thread_zstd_context(), compressed.data(), compressed.size(), data.data(), data.size(), dictionary->cdict.get());
+
+        if (ZSTD_isError(size))
+            throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(size));
+
+        compressed.resize(size);
+    }
+    else
+        compressed = compress_with(current, level, data);
+
+    record_compress(data.size(), std::chrono::steady_clock::now() - start);
+
+    // not worth making the peer decompress for a few saved bytes
+    if (compressed.size() >= data.size() - data.size() / 16)
+        return {Compression::NONE, data};
+
+    return {current, std::move(compressed), use_dictionary ? dictionary->version : 0};
+}
+
+std::string ChunkCompressor::decompress(const Compression compression, const std::string &data, const size_t raw_size, const uint32_t dict_version) const
+{
+    if (compression == Compression::NONE)
+        return data;
+
+    std::string raw(raw_size, '\0');
+
+    if (compression == Compression::LZ4)
+    {
+        const int size = LZ4_decompress_safe(data.data(), raw.data(), static_cast<int>(data.size()), static_cast<int>(raw_size));
+
+        if (size < 0 || static_cast<size_t>(size) != raw_size)
+            throw std::runtime_error("lz4 decompression failed");
+    }
+    else if (compression == Compression::ZSTD && dict_version != 0)
+    {
+        std::shared_ptr<ZSTD_DDict> ddict;
+        {
+            std::lock_guard<std::mutex> lock(dictionary_mutex);
+
+            auto it = peer_dictionaries.find(dict_version);
+            if (it == peer_dictionaries.end())
+                throw std::runtime_error(std::format("chunk compressed with unknown dictionary {}", dict_version));
+
+            ddict = it->second;
+        }
+
+        const size_t size = ZSTD_decompress_usingDDict(thread_zstd_dcontext(), raw.data(), raw_size, data.data(), data.size(), ddict.get());
+
+        if (ZSTD_isError(size) || size != raw_size)
+            throw std::runtime_error("zstd decompression failed");
+    }
+    else if (compression == Compression::ZSTD)
+    {
+        const size_t size = ZSTD_decompressDCtx(thread_zstd_dcontext(), raw.data(), raw_size, data.data(), data.size());
+
+        if (ZSTD_isError(size) || size != raw_size)
+            throw std::runtime_error("zstd decompression failed");
+    }
+    else
+        throw std::runtime_error("unknown compression received");
+
+    return raw;
+}
+
+void ChunkCompressor::record_send(const size_t bytes, const std::chrono::nanoseconds took)
+{
+    if (took.count() <= 0)
+        return;
+
+    const double bytes_per_sec = bytes * 1e9 / took.count();
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    link_bytes_per_sec = link_bytes_per_sec == 0 ? bytes_per_sec : 0.8 * link_bytes_per_sec + 0.2 * bytes_per_sec;
+}
+
+void ChunkCompressor::record_compress(const size_t bytes, const std::chrono::nanoseconds took)
+{
+    if (took.count() <= 0)
+        return;
+
+    const double bytes_per_sec = bytes * 1e9 / took.count();
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    compress_bytes_per_sec = compress_bytes_per_sec == 0 ? bytes_per_sec : 0.8 * compress_bytes_per_sec + 0.2 * bytes_per_sec;
+
+    if (++chunks_since_adapt >= ADAPT_EVERY)
+    {
+        chunks_since_adapt = 0;
+        adapt_level();
+    }
+}
+
+// called with stats_mutex held
+// compression should keep up with the link: when it can't or cpu is busy go faster,
+// when it has lots of time left before the link drains spend it on a better ratio
+void ChunkCompressor::adapt_level()
+{
+    if (link_bytes_per_sec == 0 || compress_bytes_per_sec == 0)
+        return;
+
+    const auto [min_level, max_level] = level_range(compression);
+    const double speed_ratio = compress_bytes_per_sec / link_bytes_per_sec;
+    const int current = level;
+
+    int next = current;
+    if (speed_ratio < 1.0 || load_per_core() > 0.9)
+        next = std::max(min_level, current - 1);
+    else if (speed_ratio > 4.0)
+        next = std::min(max_level, current + 1);
+
+    // compressed stats belong to the old level, start fresh
+    if (next != current)
+    {
+        level = next;
+        compress_bytes_per_sec = 0;
+    }
+}
+
+std::shared_ptr<const ZstdDictionary> ChunkCompressor::get_dictionary() const
+{
+    std::lock_guard<std::mutex> lock(dictionary_mutex);
+    return dictionary;
+}
+
+void ChunkCompressor::add_peer_dictionary(const uint32_t version, const std::string &data)
+{
+    std::shared_ptr<ZSTD_DDict> ddict(ZSTD_createDDict(data.data(), data.size()), ZSTD_freeDDict);
+
+    if (!ddict)
+        throw std::runtime_error(std::format("invalid dictionary {} received", version));
+
+    std::lock_guard<std::mutex> lock(dictionary_mutex);
+    peer_dictionaries[version] = std::move(ddict);
+
+    while (peer_dictionaries.size() > MAX_PEER_DICTIONARIES)
+        peer_dictionaries.erase(peer_dictionaries.begin());
+}
+
+bool ChunkCompressor::is_retrain_due() const
+{
+    // only zstd can use the dictionary
+    if (compression != Compression::ZSTD || retrain_interval.count() == 0 || training)
+        return false;
+
+    return !last_training || std::chrono::steady_clock::now() - *last_training >= retrain_interval;
+}
+
+void ChunkCompressor::maybe_retrain(const DirSnapshot &snaps, const std::string &working_dir)
+{
+    if (!is_retrain_due())
+        return;
+
+    last_training = std::chrono::steady_clock::now();
+
+    // samples are picked here as snaps keep changing on this thread
+    std::vector<DictionarySample> samples = pick_dictionary_samples(snaps, working_dir);
+    if (samples.size() < DICT_MIN_SAMPLES)
+        return;
+
+    if (trainer.joinable())
+        trainer.join();
+
+    training = true;
+    trainer = std::thread([this, samples = std::move(samples)]()
+                          {
+                              try
+                              {
+                                  train_dictionary(samples);
+                              }
+                              catch (const std::exception &e)
+                              {
+                                  std::cerr << "dictionary training failed: " << e.what() << std::endl;
+                              }
+                              training = false; });
+}
+
+// random small chunks of the snapshot until the sample budget is filled
+std::vector<DictionarySample> ChunkCompressor::pick_dictionary_samples(const DirSnapshot &snaps, const std::string &working_dir) const
+{
+    std::vector<DictionarySample> candidates;
+
+    for (const auto &[filename, file_snap] : snaps)
+        for (const auto &[_, chunk] : file_snap.chunks)
+            if (chunk.chunk_size > 0 && chunk.chunk_size <= DICT_MAX_CHUNK_SIZE)
+                candidates.push_back(DictionarySample{
+                    .filepath = working_dir + "/" + filename,
+                    .offset = chunk.offset,
+                    .chunk_size = chunk.chunk_size});
+
+    std::shuffle(candidates.begin(), candidates.end(), std::mt19937(std::random_device{}()));
+
+    std::vector<DictionarySample> samples;
+    size_t total_size = 0;
+
+    for (auto &candidate : candidates)
+    {
+        if (total_size + candidate.chunk_size > DICT_SAMPLE_BYTES)
+            break;
+
+        total_size += candidate.chunk_size;
+        samples.push_back(std::move(candidate));
+    }
+
+    return samples;
+}
+
+void ChunkCompressor::train_dictionary(const std::vector<DictionarySample> &samples)
+{
+    std::string sample_data;
+    std::vector<size_t> sample_sizes;
+
+    for (const auto &sample : samples)
+    {
+        // files may change or vanish while we read them, a sample less doesn't matter
+        try
+        {
+            FileIO fileio(sample.filepath);
+            const std::string &chunk_data = fileio.read_file_from_offset(sample.offset, sample.chunk_size);
+
+            sample_data += chunk_data;
+            sample_sizes.push_back(chunk_data.size());
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    if (sample_sizes.size() < DICT_MIN_SAMPLES)
+        return;
+
+    std::string dict_data(DICT_CAPACITY, '\0');
+    const size_t dict_size = ZDICT_trainFromBuffer(dict_data.data(),
+                                                   dict_data.size(),
+                                                   sample_data.data(),
+                                                   sample_sizes.data(),
+                                                   static_cast<unsigned int>(sample_sizes.size()));
+
+    // happens when the samples have nothing in common
+    if (ZDICT_isError(dict_size))
+    {
+        std::clog << "no dictionary trained: " << ZDICT_getErrorName(dict_size) << std::endl;
+        return;
+    }
+
+    dict_data.resize(dict_size);
+
+    std::shared_ptr<ZSTD_CDict> cdict(ZSTD_createCDict(dict_data.data(), dict_data.size(), DICT_LEVEL), ZSTD_freeCDict);
+    if (!cdict)
+        throw std::runtime_error("failed to load the trained dictionary");
+
+    auto trained = std::make_shared<ZstdDictionary>(ZstdDictionary{
+        .version = ++last_dict_version,
+        .data = std::move(dict_data),
+        .cdict = std::move(cdict)});
+
+    std::clog << std::format("trained dictionary {} of {} bytes from {} chunks", trained->version, trained->data.size(), sample_sizes.size()) << std::endl;
+
+    std::lock_guard<std::mutex> lock(dictionary_mutex);
+    dictionary = std::move(trained);
+}
@@ -1,100 +1,195 @@
 #include "../include/chunk-handler.hpp"
+#include "../include/snapshot-manager.hpp"
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+
+namespace
+{
+    // bytes of chunk data a file keeps in memory before spilling it
+    constexpr size_t STAGING_MEMORY = 8 * 1024 * 1024;
+
+    // spill files are kept out of the synced dir
+    constexpr const char *STAGING_DIR = "./.synclet-staging";
+
+    // files staged at once by the same name get spill files of their own
+    std::atomic<uint64_t> next_store_id = 0;
+}
 
 ChunkHandler::ChunkHandler(const std::string &filename)
-    : dir_name(sanitize_filename(filename + "_dir")),
-      filename(filename)
+    : filename(filename),
+      spill_path(std::format("{}/{}-{}-{}.staged", staging_dir(), sanitize_filename(filename), getpid(), next_store_id++)),
+      memory_limit(staging_memory()) {}
+
+size_t ChunkHandler::staging_memory()
 {
+    return get_env_number("SYNCLET_STAGING_MEMORY", STAGING_MEMORY);
+}
 
-    // if directory not exists then create it
-    if (!std::filesystem::exists(dir_name))
-        std::filesystem::create_directory(dir_name);
+// created once, the first time a file is staged
+const std::string &ChunkHandler::staging_dir()
+{
+    static const std::string dir = []()
+    {
+        std::string dir = get_env_string("SYNCLET_STAGING_DIR", STAGING_DIR);
+        fs::create_directories(dir);
+        return dir;
+    }();
+
+    return dir;
 }
 
-// save the given chunk metadata + data in that corresponding file
-void ChunkHandler::save_chunk(ChunkMetadata &chunk_md, const std::string &chunk_data)
+ChunkHandler::~ChunkHandler()
 {
-    std::string filepath = std::format("{}/chunk-{}.bin",
-                                       dir_name,
-                                       chunk_md.offset);
+    spill_file.reset();
 
-    // open the file
-    std::ofstream chunk_file(filepath);
+    if (spill_size)
+        fs::remove(spill_path);
+}
+
+// the chunk is only indexed, its data is written out once the store is over the limit
+void ChunkHandler::save_chunk(const ChunkMetadata &chunk_md, const std::string &chunk_data)
+{
+    const bool has_data = chunk_md.chunk_type != ChunkType::REMOVE && !chunk_data.empty();
 
-    // write the metadata
-    chunk_file.write(reinterpret_cast<char *>(&chunk_md), sizeof(chunk_md));
+    // hashed before taking the lock, chunks of the same file may come from many threads
+    std::string hash = has_data ? SnapshotManager::chunk_hash(chunk_data) : "";
 
-    // write the data
-    chunk_file.write(chunk_data.c_str(), chunk_data.size());
+    std::lock_guard<std::mutex> lock(mutex);
 
-    // now close the chunk_file
-    chunk_file.close();
+    StagedChunk chunk{.chunk_md = chunk_md, .hash = std::move(hash)};
+
+    // removed chunk has nothing but its size
+    if (has_data)
+    {
+        chunk.data = chunk_data;
+        memory_bytes += chunk_data.size();
+    }
+
+    index.emplace(chunk_md.offset, std::move(chunk));
+
+    if (memory_bytes > memory_limit)
+        spill();
 }
 
-// read a particular chunk's metadata + data using offset
-std::pair<ChunkMetadata, std::string> ChunkHandler::read_chunk_file(uint64_t offset)
+void ChunkHandler::spill()
 {
+    if (!spill_file)
+        spill_file = std::make_unique<FileIO>(spill_path, std::ios::in | std::ios::out | std::ios::trunc);
+
+    for (auto &[offset, chunk] : index)
+    {
+        if (chunk.is_spilled || chunk.data.empty())
+            continue;
 
-    std::string filepath = std::format("{}/chunk-{}.bin",
-                                       dir_name,
-                                       offset);
+        spill_file->write_file_at_offset(spill_size, chunk.data);
 
-    // open the file
-    std::ifstream chunk_file(filepath);
+        chunk.spill_offset = spill_size;
+        chunk.is_spilled = true;
+        spill_size += chunk.data.size();
 
-    ChunkMetadata chunk_md;
-    std::string chunk_data;
+        std::string().swap(chunk.data);
+    }
 
-    // read the metadata
-    chunk_file.read(reinterpret_cast<char *>(&chunk_md), sizeof(chunk_md));
+    memory_bytes = 0;
+}
 
-    // now resize the chunk_data var for getting whole chunk data, always will be the chunk_size given as old_chunk_size is to move the cursor
-    chunk_data.resize(chunk_md.chunk_size);
+std::string ChunkHandler::read_data(const StagedChunk &chunk)
+{
+    if (!chunk.is_spilled)
+        return chunk.data;
 
-    // read the data
-    if (chunk_md.chunk_type != ChunkType::REMOVE)
-        chunk_file.read(chunk_data.data(), chunk_data.size());
+    return spill_file->read_file_from_offset(chunk.spill_offset, chunk.chunk_md.chunk_size);
+}
 
-    // now close the chunk_file
-    chunk_file.close();
+void ChunkHandler::discard()
+{
+    std::lock_guard<std::mutex> lock(mutex);
 
-    return std::make_pair(chunk_md, chunk_data);
+    std::clog << index.size() << " stale chunks discarded for: " << filename << std::endl;
+
+    index.clear();
+    memory_bytes = 0;
+}
+
+bool ChunkHandler::wrote_only_chunks_of(const FileSnapshot &file_snap) const
+{
+    return std::ranges::all_of(written_chunks, [&](const auto &written)
+                               {
+                                   auto it = file_snap.chunks.find(written.second);
+                                   return it != file_snap.chunks.end() && it->second.offset == written.first; });
+}
+
+bool ChunkHandler::is_in_place(const std::string &original_filepath) const
+{
+    if (index.empty() || !fs::exists(original_filepath))
+        return false;
+
+    const uintmax_t file_size = fs::file_size(original_filepath);
+
+    return std::ranges::all_of(index, [&](const auto &entry)
+                               {
+                                   const ChunkMetadata &chunk_md = entry.second.chunk_md;
+
+                                   return chunk_md.chunk_type == ChunkType::MODIFY &&
+                                          chunk_md.chunk_size == chunk_md.old_chunk_size &&
+                                          chunk_md.offset + chunk_md.chunk_size <= file_size; });
 }
 
 // requires a original filepath to replace it with the new file
-void ChunkHandler::finalize_file(const std::string &original_filepath)
+void ChunkHandler::finalize_file(const std::string &original_filepath, const PatchJournal *journal)
 {
-    FilePairSession file_session(original_filepath);
-    file_session.ensure_files_open();
+    std::lock_guard<std::mutex> lock(mutex);
 
-    // set to get offsets in sorted order
-    std::set<uint64_t> sorted_offset;
+    if (spill_file)
+        spill_file->flush();
 
-    // insert all the offset in set
-    for (auto &entry : fs::recursive_directory_iterator(dir_name))
+    // nothing moves, so only the changed bytes are written instead of copying the whole file
+    if (journal && is_in_place(original_filepath))
     {
-        auto filename = extract_filename_from_path(dir_name, entry.path().string());
-        auto dash = filename.find('-');
-        auto dot = filename.find('.');
-        uint64_t offset;
+        std::vector<Patch> patches;
+        for (const auto &[offset, chunk] : index)
+        {
+            patches.push_back(Patch{.offset = offset, .data = read_data(chunk)});
+            written_chunks.emplace_back(offset, chunk.hash);
+        }
 
-        // extracting the offset
-        std::from_chars(filename.data() + dash + 1, filename.data() + dot, offset);
+        journal->apply(original_filepath, patches);
 
-        sorted_offset.insert(offset);
+        std::clog << index.size() << " chunks patched in place: " << filename << std::endl;
+
+        index.clear();
+        memory_bytes = 0;
+        return;
     }
 
-    // now take each file via sorted offset
-    for (auto offset : sorted_offset)
+    FilePairSession file_session(original_filepath);
+    file_session.ensure_files_open();
+
+    // how far the new file is ahead of the original at the current offset
+    int64_t shift = 0;
+
+    // index is already sorted by offset
+    for (const auto &[offset, chunk] : index)
     {
-        // read the chunk file
-        const auto &[chunk_md, chunk_data] = read_chunk_file(offset);
+        const ChunkMetadata &chunk_md = chunk.chunk_md;
+
+        if (!chunk.hash.empty())
+            written_chunks.emplace_back(offset + shift, chunk.hash);
+
+        if (chunk_md.chunk_type == ChunkType::ADD)
+            shift += chunk_md.chunk_size;
+        else if (chunk_md.chunk_type == ChunkType::REMOVE)
+            shift -= chunk_md.chunk_size;
+        else
+            shift += static_cast<int64_t>(chunk_md.chunk_size) - static_cast<int64_t>(chunk_md.old_chunk_size);
 
         // fill gap in temp_file using original_file data till offset reach
         file_session.fill_gap_till_offset(offset);
 
         // if chunk was added then add the chunk to temp file
         if (chunk_md.chunk_type == ChunkType::ADD)
-            file_session.add_chunk(chunk_data, chunk_md.chunk_size, true);
+            file_session.add_chunk(read_data(chunk), chunk_md.chunk_size, true);
 
         // if chunk was removed then skip it copying from original and just move pointer forward by it's size
         else if (chunk_md.chunk_type == ChunkType::REMOVE)
@@ -102,14 +197,16 @@ void ChunkHandler::finalize_file(const std::string &original_filepath)
 
         // if chunk was modified then add the chunk to temp_file and move pointer forward by size in the original
         else
-            file_session.add_chunk(chunk_data, chunk_md.old_chunk_size, false);
+            file_session.add_chunk(read_data(chunk), chunk_md.old_chunk_size, false);
     }
 
     // after placing all the chunks finalize the temp_file with the rest data from original_file
     file_session.finalize_and_replace();
 
-    // now remove the whole temp_directory of the file
-    std::cout << fs::remove_all(dir_name) << " files deleted from dir: " << dir_name << std::endl;
+    std::clog << index.size() << " chunks applied to: " << filename << std::endl;
+
+    index.clear();
+    memory_bytes = 0;
 
     file_session.close_session();
-}
\ No newline at end of file
+}
@@ -0,0 +1,159 @@
+#include "../include/data-channels.hpp"
+#include <algorithm>
+
+void DataChannels::open_channels(const Messenger &messenger,
+                                 const std::string &host,
+                                 const std::string &port,
+                                 const std::string &session_id,
+                                 const size_t no_of_channels,
+                                 const LinkShaping &link_shaping)
+{
+    if (no_of_channels == 0)
+        return;
+
+    // tell peer how many connections to wait for
+    const Message msg{
+        .type = MessageType::OPEN_DATA_CHANNELS,
+        .payload = DataChannelsPayload{
+            .session_id = session_id,
+            .no_of_channels = no_of_channels}};
+    messenger.send_json_message(msg);
+
+    for (size_t i = 0; i < no_of_channels; i++)
+    {
+        auto connection = std::make_unique<TcpConnection>(host, port);
+        connection->setLinkShaping(link_shaping);
+
+        auto channel_messenger = std::make_unique<Messenger>(*connection);
+        channel_messenger->set_compressor(compressor);
+        channel_messenger->set_bandwidth_limiter(bandwidth_limiter);
+
+        // introduce the connection so that peer can place it correctly
+        const Message hello{
+            .type = MessageType::DATA_CHANNEL,
+            .payload = DataChannelPayload{
+                .session_id = session_id,
+                .channel_no = i}};
+        channel_messenger->send_json_message(hello);
+
+        connections.push_back(std::move(connection));
+        messengers.push_back(std::move(channel_messenger));
+    }
+
+    std::clog << no_of_channels << " data channels opened" << std::endl;
+}
+
+void DataChannels::expect_channels(const DataChannelsPayload &payload)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    session_id = payload.session_id;
+
+    connections.clear();
+    messengers.clear();
+
+    connections.resize(payload.no_of_channels);
+    messengers.resize(payload.no_of_channels);
+}
+
+void DataChannels::add_channel(const DataChannelPayload &hello, std::unique_ptr<TcpConnection> connection)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (hello.session_id != session_id)
+            throw std::runtime_error(std::format("data channel of unknown session {}", hello.session_id));
+
+        if (hello.channel_no >= connections.size() || connections[hello.channel_no])
+            throw std::runtime_error(std::format("invalid data channel no {}", hello.channel_no));
+
+        auto channel_messenger = std::make_unique<Messenger>(*connection);
+        channel_messenger->set_compressor(compressor);
+        channel_messenger->set_bandwidth_limiter(bandwidth_limiter);
+
+        connections[hello.channel_no] = std::move(connection);
+        messengers[hello.channel_no] = std::move(channel_messenger);
+
+        if (std::ranges::all_of(connections, [](const auto &channel)
+                                { return channel != nullptr; }))
+            std::clog << connections.size() << " data channels accepted" << std::endl;
+    }
+
+    channel_added.notify_all();
+}
+
+void DataChannels::for_each_channel(const std::function<void(const size_t, Messenger &)> &task)
+{
+    {
+        // the channels connect on their own so they can be a bit behind the announcement
+        std::unique_lock<std::mutex> lock(mutex);
+        const bool is_ready = channel_added.wait_for(lock, std::chrono::seconds(30), [&]()
+                                                     { return std::ranges::all_of(messengers, [](const auto &channel_messenger)
+                                                                                  { return channel_messenger != nullptr; }); });
+
+        if (!is_ready)
+            throw std::runtime_error("data channels didn't connect in time");
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(messengers.size());
+
+    for (size_t i = 0; i < messengers.size(); i++)
+    {
+        workers.emplace_back([&, i]()
+                             {
+                                 try
+                                 {
+                                     task(i, *messengers[i]);
+                                 }
+                                 catch (...)
+                                 {
+                                     errors[i] = std::current_exception();
+                                 } });
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
+    for (auto &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+// chunks are given round robin so channel i gets chunk i, i+n, i+2n...
+size_t DataChannels::chunks_on_channel(const size_t channel_no, const size_t no_of_chunks) const
+{
+    const size_t n = messengers.size();
+    if (n == 0)
+        return 0;
+
+    return no_of_chunks / n + (channel_no < no_of_chunks % n ? 1 : 0);
+}
+
+void DataChannels::set_compressor(ChunkCompressor *compressor)
+{
+    this->compressor = compressor;
+
+    for (auto &channel_messenger : messengers)
+        if (channel_messenger)
+            channel_messenger->set_compressor(compressor);
+}
+
+void DataChannels::set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter)
+{
+    this->bandwidth_limiter = bandwidth_limiter;
+
+    for (auto &channel_messenger : messengers)
+        if (channel_messenger)
+            channel_messenger->set_bandwidth_limiter(bandwidth_limiter);
+}
+
+size_t DataChannels::size() const
+{
+    return messengers.size();
+}
+
+bool DataChannels::empty() const
+{
+    return messengers.empty();
+}
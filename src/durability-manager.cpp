@@ -0,0 +1,125 @@
+#include "../include/durability-manager.hpp"
+#include "../include/utils.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // something renamed or removed after it was added has its new place added too, so a
+    // missing path is skipped
+    void sync_path(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd == -1)
+        {
+            if (errno != ENOENT)
+                std::cerr << std::format("failed to open {} for syncing: {}", path, std::strerror(errno)) << std::endl;
+            return;
+        }
+
+        if (fsync(fd) == -1)
+            std::cerr << std::format("failed to sync {}: {}", path, std::strerror(errno)) << std::endl;
+
+        close(fd);
+    }
+}
+
+DurabilityManager::DurabilityManager(const std::chrono::milliseconds commit_interval)
+    : commit_interval(std::max(commit_interval, std::chrono::milliseconds(1))),
+      committer(&DurabilityManager::commit_loop, this) {}
+
+DurabilityManager::~DurabilityManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_stopping = true;
+    }
+    has_commit_request.notify_all();
+
+    committer.join();
+}
+
+DurabilityManager DurabilityManager::from_env()
+{
+    return DurabilityManager(std::chrono::milliseconds(get_env_number("SYNCLET_COMMIT_INTERVAL_MS", 100)));
+}
+
+void DurabilityManager::add_file(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_files.insert(path);
+    pending_dirs.insert(fs::path(path).parent_path().string());
+    added_generation++;
+}
+
+void DurabilityManager::add_dir(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_dirs.insert(path);
+    added_generation++;
+}
+
+void DurabilityManager::commit()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    const uint64_t generation = added_generation;
+    if (committed_generation >= generation)
+        return;
+
+    is_commit_requested = true;
+    has_commit_request.notify_one();
+
+    has_committed.wait(lock, [&]()
+                       { return committed_generation >= generation; });
+}
+
+void DurabilityManager::commit_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        has_commit_request.wait_for(lock, commit_interval, [&]()
+                                    { return is_stopping || is_commit_requested; });
+
+        // whatever is pending still goes to disk before stopping
+        if (pending_files.empty() && pending_dirs.empty())
+        {
+            if (is_stopping)
+                return;
+
+            is_commit_requested = false;
+            continue;
+        }
+
+        std::set<std::string> files = std::move(pending_files);
+        std::set<std::string> dirs = std::move(pending_dirs);
+        pending_files.clear();
+        pending_dirs.clear();
+
+        const uint64_t generation = added_generation;
+        is_commit_requested = false;
+
+        lock.unlock();
+
+        // data first, then the entries pointing to it
+        for (const auto &file : files)
+            sync_path(file);
+
+        for (const auto &dir : dirs)
+            sync_path(dir);
+
+        lock.lock();
+
+        committed_generation = generation;
+        has_committed.notify_all();
+    }
+}
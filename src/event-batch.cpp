@@ -0,0 +1,84 @@
+#include "../include/event-batch.hpp"
+#include <functional>
+#include <algorithm>
+
+PathId PathTable::intern(std::string_view path)
+{
+    // kept at most half full so probes stay short
+    if ((spans.size() + 1) * 2 > slots.size())
+        grow();
+
+    const size_t mask = slots.size() - 1;
+    size_t slot = std::hash<std::string_view>{}(path) & mask;
+
+    for (; slots[slot] != NO_PATH; slot = (slot + 1) & mask)
+        if (view(slots[slot]) == path)
+            return slots[slot];
+
+    const PathId id = static_cast<PathId>(spans.size());
+    spans.push_back(Span{.offset = static_cast<uint32_t>(arena.size()), .length = static_cast<uint32_t>(path.size())});
+    arena.append(path);
+    slots[slot] = id;
+
+    return id;
+}
+
+std::string_view PathTable::view(const PathId id) const
+{
+    const Span &span = spans[id];
+    return std::string_view(arena).substr(span.offset, span.length);
+}
+
+size_t PathTable::size() const
+{
+    return spans.size();
+}
+
+void PathTable::clear()
+{
+    arena.clear();
+    spans.clear();
+    std::ranges::fill(slots, NO_PATH);
+}
+
+void PathTable::grow()
+{
+    slots.assign(std::max<size_t>(slots.size() * 2, 64), NO_PATH);
+
+    const size_t mask = slots.size() - 1;
+    for (PathId id = 0; id < spans.size(); id++)
+    {
+        size_t slot = std::hash<std::string_view>{}(view(id)) & mask;
+        while (slots[slot] != NO_PATH)
+            slot = (slot + 1) & mask;
+        slots[slot] = id;
+    }
+}
+
+void EventBatch::add(std::string_view path, const bool is_dir, EventType event_type)
+{
+    events.push_back(PathEvent{.event_type = event_type, .is_directory = is_dir, .path = paths.intern(path)});
+}
+
+void EventBatch::add_move(std::string_view old_path, std::string_view new_path, const bool is_dir)
+{
+    const PathId old_id = paths.intern(old_path);
+    events.push_back(PathEvent{.event_type = EventType::MOVED, .is_directory = is_dir, .path = paths.intern(new_path), .old_path = old_id});
+}
+
+FileEvent EventBatch::to_file_event(const PathEvent &event) const
+{
+    if (event.event_type == EventType::MOVED)
+        return FileEvent(event.is_directory,
+                         std::string(paths.view(event.old_path)),
+                         std::string(paths.view(event.path)),
+                         EventType::MOVED);
+
+    return FileEvent(std::string(paths.view(event.path)), event.is_directory, event.event_type);
+}
+
+void EventBatch::clear()
+{
+    paths.clear();
+    events.clear();
+}
@@ -0,0 +1,219 @@
+#include "../include/event-coalescer.hpp"
+#include "../include/utils.hpp"
+#include <format>
+#include <iostream>
+#include <utility>
+#include <algorithm>
+
+EventCoalescer::EventCoalescer(const std::chrono::milliseconds quiet_period, const std::chrono::milliseconds max_delay)
+    : quiet_period(quiet_period),
+      max_delay(std::max(max_delay, quiet_period)) {}
+
+EventCoalescer EventCoalescer::from_env()
+{
+    return EventCoalescer(std::chrono::milliseconds(get_env_number("SYNCLET_QUIET_MS", 100)),
+                          std::chrono::milliseconds(get_env_number("SYNCLET_MAX_DELAY_MS", 1000)));
+}
+
+void EventCoalescer::set_known_paths(std::function<bool(std::string_view)> is_known)
+{
+    this->is_known = std::move(is_known);
+}
+
+bool EventCoalescer::is_known_path(std::string_view path) const
+{
+    return is_known && is_known(path);
+}
+
+void EventCoalescer::add(const std::vector<FileEvent> &events)
+{
+    const auto now = Clock::now();
+
+    for (const auto &event : events)
+    {
+        const bool is_move = event.event_type == EventType::MOVED;
+        if (is_move && (!event.old_filepath || !event.new_filepath))
+            continue;
+
+        const std::string path = is_move ? event.new_filepath->string() : event.filepath.string();
+        const std::string old_path = is_move ? event.old_filepath->string() : "";
+
+        add(event.event_type, event.is_directory, path, old_path, now, [&]()
+            { return event; });
+    }
+}
+
+void EventCoalescer::add(const EventBatch &batch)
+{
+    const auto now = Clock::now();
+
+    for (const auto &event : batch.events)
+    {
+        const std::string_view old_path = event.old_path != PathTable::NO_PATH ? batch.paths.view(event.old_path) : "";
+
+        add(event.event_type, event.is_directory, batch.paths.view(event.path), old_path, now, [&]()
+            { return batch.to_file_event(event); });
+    }
+}
+
+void EventCoalescer::add(EventType event_type, const bool is_dir, std::string_view path, std::string_view old_path,
+                         Clock::time_point now, const std::function<FileEvent()> &make_event)
+{
+    events_received++;
+
+    // files under a dir which is created, removed or moved must go before it
+    if (is_dir)
+    {
+        flush_all();
+        ready.push_back(make_event());
+        return;
+    }
+
+    switch (event_type)
+    {
+    case EventType::CREATED:
+    {
+        PathState &state = state_of(path, is_known_path(path), now);
+
+        // a file deleted and made again has new content for peer
+        state.is_modified = state.existed;
+        state.exists = true;
+        break;
+    }
+    case EventType::MODIFIED:
+    {
+        PathState &state = state_of(path, true, now);
+        state.is_modified = true;
+        state.exists = true;
+        break;
+    }
+    case EventType::DELETED:
+    {
+        PathState &state = state_of(path, true, now);
+        state.is_modified = false;
+        state.exists = false;
+        break;
+    }
+    case EventType::MOVED:
+    {
+        // a file peer never saw moved over another, like an editor saving through a temp
+        // file, is just new content for the destination
+        auto it = pending.find(old_path);
+        if (it != pending.end() && !it->second.existed)
+        {
+            pending.erase(it);
+
+            PathState &state = state_of(path, is_known_path(path), now);
+            state.is_modified = true;
+            state.exists = true;
+            break;
+        }
+
+        flush(old_path);
+        flush(path);
+        ready.push_back(make_event());
+        break;
+    }
+    default:
+        ready.push_back(make_event());
+        break;
+    }
+}
+
+EventCoalescer::PathState &EventCoalescer::state_of(std::string_view path, const bool existed, Clock::time_point now)
+{
+    auto it = pending.find(path);
+    if (it == pending.end())
+        it = pending.emplace(std::string(path), PathState{
+                                                    .existed = existed,
+                                                    .exists = existed,
+                                                    .is_modified = false,
+                                                    .first_event = now,
+                                                    .last_event = now})
+                 .first;
+
+    it->second.last_event = now;
+
+    return it->second;
+}
+
+void EventCoalescer::flush(std::string_view path)
+{
+    auto it = pending.find(path);
+    if (it == pending.end())
+        return;
+
+    auto node = pending.extract(it);
+    const std::string &filename = node.key();
+    const PathState &state = node.mapped();
+
+    if (!state.existed && state.exists)
+        ready.emplace_back(filename, false, EventType::CREATED);
+
+    if (state.existed && !state.exists)
+        ready.emplace_back(filename, false, EventType::DELETED);
+
+    else if (state.exists && state.is_modified)
+        ready.emplace_back(filename, false, EventType::MODIFIED);
+}
+
+void EventCoalescer::flush_all()
+{
+    std::vector<std::pair<Clock::time_point, std::string>> paths;
+    for (const auto &[path, state] : pending)
+        paths.emplace_back(state.first_event, path);
+
+    std::ranges::sort(paths);
+
+    for (const auto &[_, path] : paths)
+        flush(path);
+}
+
+std::vector<FileEvent> EventCoalescer::take_ready()
+{
+    const auto now = Clock::now();
+
+    std::vector<std::pair<Clock::time_point, std::string>> paths;
+    for (const auto &[path, state] : pending)
+        if (now - state.last_event >= quiet_period || now - state.first_event >= max_delay)
+            paths.emplace_back(state.first_event, path);
+
+    std::ranges::sort(paths);
+
+    for (const auto &[_, path] : paths)
+        flush(path);
+
+    events_sent += ready.size();
+    return std::exchange(ready, {});
+}
+
+int EventCoalescer::next_timeout_ms() const
+{
+    if (!ready.empty())
+        return 0;
+
+    if (pending.empty())
+        return -1;
+
+    auto due = Clock::time_point::max();
+    for (const auto &[_, state] : pending)
+        due = std::min({due, state.last_event + quiet_period, state.first_event + max_delay});
+
+    const auto wait = std::chrono::ceil<std::chrono::milliseconds>(due - Clock::now());
+    return static_cast<int>(std::max<int64_t>(wait.count(), 0));
+}
+
+void EventCoalescer::clear()
+{
+    pending.clear();
+    ready.clear();
+}
+
+void EventCoalescer::print_stats() const
+{
+    std::clog << std::format("file events: received {}, sent {}, merged {}",
+                             events_received,
+                             events_sent,
+                             events_received - std::min(events_sent, events_received))
+              << std::endl;
+}
@@ -0,0 +1,311 @@
+#include "../include/executor.hpp"
+#include "../include/utils.hpp"
+#include <future>
+#include <format>
+#include <cstring>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace
+{
+    constexpr int MAX_EVENTS = 64;
+
+    // a coroutine nobody awaits, it runs as soon as it is called and frees itself
+    struct DetachedTask
+    {
+        struct promise_type
+        {
+            DetachedTask get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    DetachedTask run_detached(Executor &executor, Task<void> task, std::function<void(std::exception_ptr)> on_done)
+    {
+        co_await executor.resume_here();
+
+        std::exception_ptr exception;
+        try
+        {
+            co_await std::move(task);
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+
+        on_done(exception);
+    }
+}
+
+Executor::Executor(const size_t no_of_threads)
+{
+    epollfd = epoll_create1(0);
+    if (epollfd == -1)
+        throw std::runtime_error(std::format("epoll_create1 failed: {}", std::strerror(errno)));
+
+    stopfd = eventfd(0, EFD_NONBLOCK);
+    if (stopfd == -1)
+        throw std::runtime_error(std::format("eventfd failed: {}", std::strerror(errno)));
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = stopfd;
+
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, stopfd, &ev) == -1)
+        throw std::runtime_error(std::format("epoll_ctl failed: {}", std::strerror(errno)));
+
+    for (size_t i = 0; i < std::max<size_t>(no_of_threads, 1); i++)
+        threads.emplace_back(&Executor::worker_loop, this);
+
+    poller = std::thread(&Executor::poll_loop, this);
+}
+
+Executor::~Executor()
+{
+    is_stopping = true;
+
+    const uint64_t one = 1;
+    if (write(stopfd, &one, sizeof(one)) == -1)
+        std::cerr << "failed to wake executor poller: " << std::strerror(errno) << std::endl;
+
+    has_ready.notify_all();
+
+    for (auto &thread : threads)
+        thread.join();
+    poller.join();
+
+    close(stopfd);
+    close(epollfd);
+}
+
+size_t Executor::threads_from_env()
+{
+    return get_env_number("SYNCLET_EXECUTOR_THREADS", 2);
+}
+
+void Executor::schedule(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(ready_mutex);
+        ready.push_back(handle);
+    }
+    has_ready.notify_one();
+}
+
+// a timerfd parked like a socket, it is readable once the time is up
+Task<void> Executor::sleep_for(const std::chrono::nanoseconds duration)
+{
+    if (duration <= std::chrono::nanoseconds::zero())
+        co_return;
+
+    const int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd == -1)
+        throw std::runtime_error(std::format("timerfd_create failed: {}", std::strerror(errno)));
+
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
+
+    struct itimerspec its{};
+    its.it_value.tv_sec = seconds.count();
+    its.it_value.tv_nsec = (duration - seconds).count();
+
+    if (timerfd_settime(timerfd, 0, &its, nullptr) == -1)
+    {
+        close(timerfd);
+        throw std::runtime_error(std::format("timerfd_settime failed: {}", std::strerror(errno)));
+    }
+
+    co_await wait_fd(timerfd, EPOLLIN);
+
+    {
+        std::lock_guard<std::mutex> lock(fds_mutex);
+        waiting_fds.erase(timerfd);
+    }
+    close(timerfd);
+}
+
+void Executor::spawn(Task<void> task, std::function<void(std::exception_ptr)> on_done)
+{
+    run_detached(*this, std::move(task), std::move(on_done));
+}
+
+void Executor::block_on(Task<void> task)
+{
+    std::promise<void> done;
+
+    spawn(std::move(task), [&](std::exception_ptr exception)
+          {
+              if (exception)
+                  done.set_exception(exception);
+              else
+                  done.set_value(); });
+
+    done.get_future().get();
+}
+
+void Executor::park(const int fd, const uint32_t events, std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> lock(fds_mutex);
+
+    FdWaiters &waiters = waiting_fds[fd];
+    std::coroutine_handle<> &slot = (events & EPOLLOUT) ? waiters.writer : waiters.reader;
+    slot = handle;
+
+    try
+    {
+        arm(fd, waiters);
+    }
+    catch (...)
+    {
+        slot = nullptr;
+        throw;
+    }
+}
+
+// one shot so that a woken waiter is never woken again for the same readiness
+void Executor::arm(const int fd, const FdWaiters &waiters)
+{
+    struct epoll_event ev{};
+    ev.events = EPOLLONESHOT;
+    if (waiters.reader)
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (waiters.writer)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+
+    // a closed fd drops out of epoll by itself, so a reused one is added afresh
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev) == -1 &&
+        (errno != ENOENT || epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) == -1))
+        throw std::runtime_error(std::format("epoll_ctl failed: {}", std::strerror(errno)));
+}
+
+void Executor::worker_loop()
+{
+    while (true)
+    {
+        std::coroutine_handle<> handle;
+        {
+            std::unique_lock<std::mutex> lock(ready_mutex);
+            has_ready.wait(lock, [&]()
+                           { return is_stopping || !ready.empty(); });
+
+            if (is_stopping)
+                return;
+
+            handle = ready.front();
+            ready.pop_front();
+        }
+
+        handle.resume();
+    }
+}
+
+void Executor::poll_loop()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!is_stopping)
+    {
+        const int no_of_events = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+
+        if (no_of_events == -1 && errno == EINTR)
+            continue;
+
+        if (no_of_events == -1)
+        {
+            std::cerr << "executor epoll_wait failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        for (int i = 0; i < no_of_events; i++)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == stopfd)
+                return;
+
+            std::lock_guard<std::mutex> lock(fds_mutex);
+
+            auto it = waiting_fds.find(fd);
+            if (it == waiting_fds.end())
+                continue;
+
+            FdWaiters &waiters = it->second;
+
+            // errors wake both sides, each finds out about it from its own call
+            const bool has_error = events[i].events & (EPOLLERR | EPOLLHUP);
+
+            if (waiters.reader && (has_error || events[i].events & (EPOLLIN | EPOLLRDHUP)))
+                schedule(std::exchange(waiters.reader, nullptr));
+
+            if (waiters.writer && (has_error || events[i].events & EPOLLOUT))
+                schedule(std::exchange(waiters.writer, nullptr));
+
+            if (!waiters.reader && !waiters.writer)
+            {
+                waiting_fds.erase(it);
+                continue;
+            }
+
+            try
+            {
+                arm(fd, waiters);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+    }
+}
+
+TaskGroup::TaskGroup(Executor &executor) : executor(executor) {}
+
+void TaskGroup::spawn(Task<void> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+    }
+
+    executor.spawn(std::move(task), [this, &executor = executor](std::exception_ptr task_exception)
+                   {
+                       std::coroutine_handle<> to_resume;
+                       {
+                           std::lock_guard<std::mutex> lock(mutex);
+
+                           if (task_exception && !exception)
+                               exception = task_exception;
+
+                           if (--pending == 0)
+                               to_resume = std::exchange(waiter, nullptr);
+                       }
+
+                       // the group may be gone once its waiter runs
+                       if (to_resume)
+                           executor.schedule(to_resume); });
+}
+
+Sequencer::Sequencer(Executor &executor) : executor(executor) {}
+
+void Sequencer::advance()
+{
+    std::coroutine_handle<> to_resume;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        next++;
+
+        auto it = waiting.find(next);
+        if (it != waiting.end())
+        {
+            to_resume = it->second;
+            waiting.erase(it);
+        }
+    }
+
+    if (to_resume)
+        executor.schedule(to_resume);
+}
@@ -0,0 +1,209 @@
+#include "../include/fanotify-watcher.hpp"
+#include <fcntl.h>
+
+FanotifyWatcher::FanotifyWatcher(const std::string &dir) : root(fs::canonical(dir))
+{
+    fanfd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY);
+    if (fanfd == -1)
+        throw std::runtime_error(std::format("fanotify_init: {}", std::strerror(errno)));
+
+    const uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_CLOSE_WRITE | FAN_RENAME | FAN_ONDIR;
+
+    if (fanotify_mark(fanfd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, root.c_str()) == -1)
+    {
+        const std::string error = std::strerror(errno);
+        close(fanfd);
+        throw std::runtime_error(std::format("fanotify_mark on {}: {}", root.string(), error));
+    }
+
+    mount_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mount_fd == -1)
+    {
+        const std::string error = std::strerror(errno);
+        close(fanfd);
+        throw std::runtime_error(std::format("failed to open {}: {}", root.string(), error));
+    }
+}
+
+FanotifyWatcher::~FanotifyWatcher()
+{
+    if (mount_fd != -1)
+        close(mount_fd);
+    if (fanfd != -1)
+        close(fanfd);
+}
+
+int FanotifyWatcher::get_fd() const
+{
+    return fanfd;
+}
+
+std::vector<std::string> FanotifyWatcher::take_dirty_dirs()
+{
+    // the whole tree covers everything else
+    if (std::ranges::find(dirty_dirs, "") != dirty_dirs.end())
+        dirty_dirs = {""};
+
+    return std::exchange(dirty_dirs, {});
+}
+
+const EventBatch &FanotifyWatcher::poll_events()
+{
+    alignas(struct fanotify_event_metadata) char buffer[BUFFER_SIZE];
+    batch.clear();
+
+    // read till the queue is empty
+    while (true)
+    {
+        ssize_t len = read(fanfd, buffer, BUFFER_SIZE);
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                break;
+            throw std::runtime_error(std::format("fanotify read: {}", std::strerror(errno)));
+        }
+
+        for (auto metadata = reinterpret_cast<const struct fanotify_event_metadata *>(buffer);
+             FAN_EVENT_OK(metadata, len);
+             metadata = FAN_EVENT_NEXT(metadata, len))
+        {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION)
+                throw std::runtime_error("fanotify metadata version mismatch");
+
+            fill_events(metadata);
+        }
+    }
+
+    return batch;
+}
+
+void FanotifyWatcher::fill_events(const struct fanotify_event_metadata *metadata)
+{
+    // events were dropped and nothing says where, the whole tree is rescanned
+    if (metadata->mask & FAN_Q_OVERFLOW)
+    {
+        std::cerr << "fanotify queue overflowed, rescanning " << root.string() << std::endl;
+        dirty_dirs.push_back("");
+        return;
+    }
+
+    const bool is_dir = metadata->mask & FAN_ONDIR;
+
+    bool has_filepath = false;
+    bool has_old_filepath = false;
+    bool has_new_filepath = false;
+
+    // records naming the entry follow the metadata
+    const char *record = reinterpret_cast<const char *>(metadata) + metadata->metadata_len;
+    const char *end = reinterpret_cast<const char *>(metadata) + metadata->event_len;
+
+    while (record < end)
+    {
+        const auto header = reinterpret_cast<const struct fanotify_event_info_header *>(record);
+        const auto fid = reinterpret_cast<const struct fanotify_event_info_fid *>(record);
+
+        if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+            has_filepath = resolve(fid, filepath);
+        else if (header->info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME)
+            has_old_filepath = resolve(fid, old_filepath);
+        else if (header->info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME)
+            has_new_filepath = resolve(fid, new_filepath);
+
+        if (!header->len)
+            break;
+        record += header->len;
+    }
+
+    // a dir which moved or went takes the paths of handles under it along
+    if (is_dir && metadata->mask & (FAN_RENAME | FAN_DELETE))
+        dir_paths.clear();
+
+    // events on the same entry may come merged, they are taken in the order they can happen
+    if (has_filepath && metadata->mask & FAN_CREATE)
+    {
+        batch.add(filepath, is_dir, EventType::CREATED);
+        if (log_events)
+            std::cout << "file create event: " << filepath << '\n';
+    }
+
+    if (has_filepath && !is_dir && metadata->mask & FAN_CLOSE_WRITE)
+    {
+        batch.add(filepath, is_dir, EventType::MODIFIED);
+        if (log_events)
+            std::cout << "file modify event: " << filepath << '\n';
+    }
+
+    if (has_filepath && metadata->mask & FAN_DELETE)
+    {
+        batch.add(filepath, is_dir, EventType::DELETED);
+        if (log_events)
+            std::cout << "file delete event: " << filepath << '\n';
+    }
+
+    if (!(metadata->mask & FAN_RENAME))
+        return;
+
+    // moved in from outside is new here, moved out is gone
+    if (has_old_filepath && has_new_filepath)
+    {
+        batch.add_move(old_filepath, new_filepath, is_dir);
+        if (log_events)
+            std::cout << "file move event: " << old_filepath << " -> " << new_filepath << '\n';
+    }
+    else if (has_new_filepath)
+    {
+        batch.add(new_filepath, is_dir, EventType::CREATED);
+
+        // a dir moved in brings contents nobody reported
+        if (is_dir)
+            dirty_dirs.push_back(new_filepath);
+    }
+    else if (has_old_filepath)
+        batch.add(old_filepath, is_dir, EventType::DELETED);
+}
+
+bool FanotifyWatcher::resolve(const struct fanotify_event_info_fid *fid, std::string &path)
+{
+    auto handle = reinterpret_cast<struct file_handle *>(const_cast<unsigned char *>(fid->handle));
+    const char *name = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+
+    const std::string_view key(reinterpret_cast<const char *>(handle), sizeof(struct file_handle) + handle->handle_bytes);
+
+    auto it = dir_paths.find(key);
+    if (it == dir_paths.end())
+    {
+        std::optional<std::string> dir_path;
+
+        // the dir may be gone already
+        const int dirfd = open_by_handle_at(mount_fd, handle, O_PATH | O_CLOEXEC);
+        if (dirfd == -1)
+            return false;
+
+        std::error_code error;
+        const fs::path dir = fs::read_symlink(std::format("/proc/self/fd/{}", dirfd), error);
+        close(dirfd);
+
+        if (error)
+            return false;
+
+        // the mark covers the whole filesystem, only what is under the root is ours
+        const fs::path relative = dir.lexically_relative(root);
+        if (relative == ".")
+            dir_path = "";
+        else if (!relative.empty() && *relative.begin() != "..")
+            dir_path = relative.string();
+
+        it = dir_paths.emplace(key, std::move(dir_path)).first;
+    }
+
+    const std::string_view entry_name(name);
+    if (!it->second || entry_name.empty() || entry_name == ".")
+        return false;
+
+    path.assign(*it->second);
+    if (!path.empty())
+        path += '/';
+    path += entry_name;
+
+    return true;
+}
@@ -1,4 +1,9 @@
 #include "../include/file-io.hpp"
+#include "../include/io-ring.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <format>
 
 FileIO::FileIO(const std::string &filepath, std::ios::openmode mode)
 {
@@ -8,6 +13,7 @@ FileIO::FileIO(const std::string &filepath, std::ios::openmode mode)
 bool FileIO::open_file(const std::string &filepath, std::ios::openmode mode)
 {
     this->filepath = filepath;
+    this->mode = mode;
 
     fstream.open(filepath, mode | std::ios::binary);
 
@@ -23,6 +29,12 @@ void FileIO::close_file()
 {
     if (fstream.is_open())
         fstream.close();
+
+    if (fd != -1)
+    {
+        close(fd);
+        fd = -1;
+    }
 }
 
 std::string FileIO::read_file_from_offset(const size_t offset, const size_t chunk_size)
@@ -79,6 +91,68 @@ uintmax_t FileIO::get_file_size()
     return fs::file_size(filepath);
 }
 
+std::vector<std::string> FileIO::read_ranges(const std::vector<std::pair<size_t, size_t>> &ranges)
+{
+    std::vector<std::string> data(ranges.size());
+    std::vector<IoRequest> requests;
+    requests.reserve(ranges.size());
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        data[i].resize(ranges[i].second);
+        requests.push_back(IoRequest{.fd = get_fd(), .offset = ranges[i].first, .data = data[i].data(), .size = ranges[i].second, .is_write = false});
+    }
+
+    IoRing::local().submit_and_wait(requests);
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        if (requests[i].result < 0)
+            throw std::runtime_error(std::format("failed to read {}: {}", filepath, std::strerror(-requests[i].result)));
+
+        data[i].resize(requests[i].result);
+    }
+
+    return data;
+}
+
+int FileIO::get_fd()
+{
+    if (fd != -1)
+        return fd;
+
+    const bool is_writable = mode & (std::ios::out | std::ios::app);
+    fd = open(filepath.c_str(), is_writable ? O_RDWR : O_RDONLY);
+
+    if (fd == -1)
+        throw std::runtime_error(std::format("failed to open {}: {}", filepath, std::strerror(errno)));
+
+    return fd;
+}
+
+// only a hint to the filesystem, without support the file just grows as it is written
+void FileIO::preallocate(const uint64_t size, const bool keep_size)
+{
+    if (!size)
+        return;
+
+    if (fallocate(get_fd(), keep_size ? FALLOC_FL_KEEP_SIZE : 0, 0, size) == -1 && !keep_size)
+        fs::resize_file(filepath, size);
+}
+
+void FileIO::flush()
+{
+    fstream.flush();
+}
+
+void FileIO::sync_data()
+{
+    flush();
+
+    if (fdatasync(get_fd()) == -1)
+        throw std::runtime_error(std::format("failed to sync {}: {}", filepath, std::strerror(errno)));
+}
+
 FileIO::~FileIO()
 {
     close_file();
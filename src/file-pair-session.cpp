@@ -1,4 +1,36 @@
 #include "../include/file-pair-session.hpp"
+#include "../include/io-ring.hpp"
+#include "../include/utils.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+namespace
+{
+    // copy_file_range till size bytes are done, the source ends or the filesystem refuses
+    size_t copy_in_kernel_range(const int in_fd, uint64_t in_offset, const int out_fd, uint64_t out_offset, size_t size)
+    {
+        size_t done = 0;
+
+        while (done < size)
+        {
+            loff_t in_off = in_offset + done, out_off = out_offset + done;
+            const ssize_t copied = copy_file_range(in_fd, &in_off, out_fd, &out_off, size - done, 0);
+
+            if (copied == -1 && errno == EINTR)
+                continue;
+
+            if (copied <= 0)
+                break;
+
+            done += copied;
+        }
+
+        return done;
+    }
+}
 
 FilePairSession::FilePairSession(const std::string &filepath, const bool append_to_original)
     : original_filepath(filepath),
@@ -48,26 +80,63 @@ void FilePairSession::fill_gap_till_offset(const size_t offset)
     if (offset <= cursor || !temp_file)
         return;
 
-    size_t chunk_size = offset - cursor;
+    // chunks written through the stream go first, the gap is put right after them
+    temp_file->flush();
 
-    for (size_t read_so_far = 0; read_so_far < chunk_size;)
-    {
-        const std::string &to_copy = original_file->read_file_from_offset(
-            cursor + read_so_far,
-            std::min(MAX_READ_SIZE, chunk_size - read_so_far));
+    const uint64_t out_offset = temp_file->get_file_size();
+    const size_t size = offset - cursor;
 
-        if (to_copy.empty())
-            break;
+    // the kernel copies or shares the blocks, what it couldn't goes through io_uring
+    const size_t copied = copy_in_kernel(original_file->get_fd(), cursor, temp_file->get_fd(), out_offset, size);
 
-        temp_file->append_chunk(to_copy);
-
-        read_so_far += to_copy.size();
-    }
+    if (copied < size)
+        IoRing::local().copy_range(original_file->get_fd(),
+                                   cursor + copied,
+                                   temp_file->get_fd(),
+                                   out_offset + copied,
+                                   size - copied);
 
     // as we have moved BYTES forward after copying BYTES data
     cursor = offset;
 }
 
+size_t FilePairSession::copy_in_kernel(const int in_fd, uint64_t in_offset, const int out_fd, uint64_t out_offset, size_t size)
+{
+    static const bool is_enabled = get_env_number("SYNCLET_KERNEL_COPY", 1) != 0;
+    if (!is_enabled)
+        return 0;
+
+    size_t done = 0;
+
+    // a clone needs both offsets on a block boundary, so only when they are equally off one
+    struct stat out_stat;
+    const uint64_t block_size = fstat(out_fd, &out_stat) == 0 && out_stat.st_blksize > 0 ? out_stat.st_blksize : 4096;
+
+    if (in_offset % block_size == out_offset % block_size)
+    {
+        const uint64_t head = (block_size - in_offset % block_size) % block_size;
+        const uint64_t blocks = size > head ? (size - head) / block_size * block_size : 0;
+
+        if (blocks)
+        {
+            const size_t head_copied = copy_in_kernel_range(in_fd, in_offset, out_fd, out_offset, head);
+
+            struct file_clone_range clone{
+                .src_fd = in_fd,
+                .src_offset = in_offset + head,
+                .src_length = blocks,
+                .dest_offset = out_offset + head};
+
+            if (head_copied == head && ioctl(out_fd, FICLONERANGE, &clone) == 0)
+                done = head + blocks;
+            else
+                done = head_copied;
+        }
+    }
+
+    return done + copy_in_kernel_range(in_fd, in_offset + done, out_fd, out_offset + done, size - done);
+}
+
 // append chunk data to original file
 void FilePairSession::append_data(const std::string &chunk)
 {
@@ -104,7 +173,8 @@ void FilePairSession::finalize_and_replace()
     {
         fill_gap_till_offset(original_file->get_file_size());
 
-        fs::remove(original_filepath);
+        // a crash after the rename must find the new data behind the name, not an empty file
+        temp_file->sync_data();
         fs::rename(temp_filepath, original_filepath);
     }
 
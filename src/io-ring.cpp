@@ -0,0 +1,379 @@
+#include "../include/io-ring.hpp"
+#include "../include/utils.hpp"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cstring>
+#include <format>
+#include <algorithm>
+
+namespace
+{
+    constexpr unsigned RING_ENTRIES = 64;
+    constexpr size_t NO_OF_BUFFERS = 8;
+    constexpr size_t BUFFER_SIZE = 256 * 1024;
+
+    int io_uring_setup(const unsigned entries, struct io_uring_params *params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(const int ring_fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    int io_uring_register(const int ring_fd, const unsigned opcode, const void *arg, const unsigned nr_args)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+    }
+
+    template <typename T>
+    T *at(void *base, const size_t offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+}
+
+IoRing &IoRing::local()
+{
+    thread_local IoRing ring;
+    return ring;
+}
+
+IoRing::IoRing()
+{
+    if (get_env_number("SYNCLET_IO_URING", 1) == 0)
+        return;
+
+    if (!setup())
+    {
+        std::clog << "io_uring not available, using blocking file io" << std::endl;
+        teardown();
+        return;
+    }
+
+    register_buffers();
+    register_file_slots();
+}
+
+IoRing::~IoRing()
+{
+    teardown();
+}
+
+bool IoRing::is_available() const
+{
+    return ring_fd != -1;
+}
+
+bool IoRing::setup()
+{
+    struct io_uring_params params{};
+
+    ring_fd = io_uring_setup(RING_ENTRIES, &params);
+
+    // old kernel, seccomp or io_uring_disabled, all the same to us
+    if (ring_fd < 0)
+    {
+        ring_fd = -1;
+        return false;
+    }
+
+    entries = params.sq_entries;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    const bool is_single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (is_single_mmap)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        sq_ring = nullptr;
+        return false;
+    }
+
+    cq_ring = is_single_mmap
+                  ? sq_ring
+                  : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+    {
+        cq_ring = nullptr;
+        return false;
+    }
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes_map == MAP_FAILED)
+        return false;
+    sqes = static_cast<struct io_uring_sqe *>(sqes_map);
+
+    sq_head = at<unsigned>(sq_ring, params.sq_off.head);
+    sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = at<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+    cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = at<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqes = at<struct io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+    return true;
+}
+
+// pinned memory is limited by RLIMIT_MEMLOCK, copies fall back to plain reads and writes without it
+void IoRing::register_buffers()
+{
+    buffers.assign(NO_OF_BUFFERS, std::string(BUFFER_SIZE, '\0'));
+
+    std::vector<struct iovec> iovecs;
+    for (auto &buffer : buffers)
+        iovecs.push_back({.iov_base = buffer.data(), .iov_len = buffer.size()});
+
+    if (io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size()) < 0)
+        buffers.clear();
+}
+
+void IoRing::register_file_slots()
+{
+    const int fds[2] = {-1, -1};
+    has_file_slots = io_uring_register(ring_fd, IORING_REGISTER_FILES, fds, 2) == 0;
+}
+
+void IoRing::teardown()
+{
+    if (sqes)
+        munmap(sqes, sqes_size);
+    if (cq_ring && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring)
+        munmap(sq_ring, sq_ring_size);
+    if (ring_fd != -1)
+        close(ring_fd);
+
+    sqes = nullptr;
+    sq_ring = cq_ring = nullptr;
+    ring_fd = -1;
+    buffers.clear();
+}
+
+struct io_uring_sqe *IoRing::next_sqe()
+{
+    const unsigned tail = *sq_tail;
+    const unsigned index = tail & *sq_mask;
+
+    struct io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    sq_array[index] = index;
+
+    // the kernel reads the entry only after it sees the new tail
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+void IoRing::submit(const unsigned to_submit, std::vector<ssize_t> &results)
+{
+    unsigned submitted = 0;
+    unsigned completed = 0;
+
+    while (completed < to_submit)
+    {
+        const int ret = io_uring_enter(ring_fd, to_submit - submitted, to_submit - completed, IORING_ENTER_GETEVENTS);
+
+        if (ret < 0 && errno != EINTR)
+            throw std::runtime_error(std::format("io_uring_enter failed: {}", std::strerror(errno)));
+
+        if (ret > 0)
+            submitted += ret;
+
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            const struct io_uring_cqe &cqe = cqes[head & *cq_mask];
+            results[cqe.user_data] = cqe.res;
+
+            head++;
+            completed++;
+        }
+
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+void IoRing::submit_and_wait(std::vector<IoRequest> &requests)
+{
+    if (!is_available())
+    {
+        for (auto &request : requests)
+            run_blocking(request);
+        return;
+    }
+
+    // as many at once as the ring holds
+    for (size_t begin = 0; begin < requests.size(); begin += entries)
+    {
+        const size_t end = std::min<size_t>(begin + entries, requests.size());
+
+        for (size_t i = begin; i < end; i++)
+        {
+            struct io_uring_sqe *sqe = next_sqe();
+            sqe->opcode = requests[i].is_write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = requests[i].fd;
+            sqe->off = requests[i].offset;
+            sqe->addr = reinterpret_cast<uint64_t>(requests[i].data);
+            sqe->len = static_cast<uint32_t>(requests[i].size);
+            sqe->user_data = i - begin;
+        }
+
+        std::vector<ssize_t> results(end - begin);
+        submit(end - begin, results);
+
+        for (size_t i = begin; i < end; i++)
+        {
+            auto &request = requests[i];
+            request.result = results[i - begin];
+
+            // kernels without these opcodes or files which refuse them, and short writes
+            if (request.result == -EINVAL || request.result == -EOPNOTSUPP ||
+                (request.is_write && request.result >= 0 && static_cast<size_t>(request.result) < request.size))
+                run_blocking(request);
+        }
+    }
+}
+
+void IoRing::copy_range(const int in_fd, uint64_t in_offset, const int out_fd, uint64_t out_offset, size_t size)
+{
+    if (!is_available() || buffers.empty())
+        return copy_blocking(in_fd, in_offset, out_fd, out_offset, size);
+
+    // the same two files are used for every piece, so they go in the fixed slots once
+    int in_file = in_fd, out_file = out_fd;
+    uint8_t file_flags = 0;
+
+    if (has_file_slots)
+    {
+        const int fds[2] = {in_fd, out_fd};
+        struct io_uring_files_update update{.offset = 0, .resv = 0, .fds = reinterpret_cast<uint64_t>(fds)};
+
+        if (io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 2) == 2)
+        {
+            in_file = 0;
+            out_file = 1;
+            file_flags = IOSQE_FIXED_FILE;
+        }
+    }
+
+    while (size > 0)
+    {
+        // a read and its write per buffer, the ring takes two entries for each
+        const size_t no_of_pieces = std::min<size_t>({buffers.size(), entries / 2, (size + BUFFER_SIZE - 1) / BUFFER_SIZE});
+
+        std::vector<size_t> piece_sizes;
+        for (size_t i = 0; i < no_of_pieces; i++)
+        {
+            const size_t piece_size = std::min(BUFFER_SIZE, size - std::min(size, i * BUFFER_SIZE));
+
+            struct io_uring_sqe *read_sqe = next_sqe();
+            read_sqe->opcode = IORING_OP_READ_FIXED;
+            read_sqe->flags = IOSQE_IO_LINK | file_flags;
+            read_sqe->fd = in_file;
+            read_sqe->off = in_offset + i * BUFFER_SIZE;
+            read_sqe->addr = reinterpret_cast<uint64_t>(buffers[i].data());
+            read_sqe->len = static_cast<uint32_t>(piece_size);
+            read_sqe->buf_index = static_cast<uint16_t>(i);
+            read_sqe->user_data = 2 * i;
+
+            struct io_uring_sqe *write_sqe = next_sqe();
+            write_sqe->opcode = IORING_OP_WRITE_FIXED;
+            write_sqe->flags = file_flags;
+            write_sqe->fd = out_file;
+            write_sqe->off = out_offset + i * BUFFER_SIZE;
+            write_sqe->addr = reinterpret_cast<uint64_t>(buffers[i].data());
+            write_sqe->len = static_cast<uint32_t>(piece_size);
+            write_sqe->buf_index = static_cast<uint16_t>(i);
+            write_sqe->user_data = 2 * i + 1;
+
+            piece_sizes.push_back(piece_size);
+        }
+
+        std::vector<ssize_t> results(2 * no_of_pieces);
+        submit(2 * no_of_pieces, results);
+
+        size_t copied = 0;
+        for (size_t i = 0; i < no_of_pieces; i++)
+        {
+            // a short read cancels its write, that piece is copied again the plain way
+            if (results[2 * i + 1] != static_cast<ssize_t>(piece_sizes[i]))
+                copy_blocking(in_fd, in_offset + copied, out_fd, out_offset + copied, piece_sizes[i]);
+
+            copied += piece_sizes[i];
+        }
+
+        in_offset += copied;
+        out_offset += copied;
+        size -= copied;
+    }
+}
+
+void IoRing::run_blocking(IoRequest &request)
+{
+    size_t done = 0;
+
+    while (done < request.size)
+    {
+        const ssize_t result = request.is_write
+                                   ? pwrite(request.fd, request.data + done, request.size - done, request.offset + done)
+                                   : pread(request.fd, request.data + done, request.size - done, request.offset + done);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result < 0)
+        {
+            request.result = -errno;
+            return;
+        }
+
+        // end of file
+        if (result == 0)
+            break;
+
+        done += result;
+    }
+
+    request.result = static_cast<ssize_t>(done);
+}
+
+void IoRing::copy_blocking(const int in_fd, uint64_t in_offset, const int out_fd, uint64_t out_offset, size_t size)
+{
+    std::string buffer(std::min(size, BUFFER_SIZE), '\0');
+
+    while (size > 0)
+    {
+        IoRequest read_request{.fd = in_fd, .offset = in_offset, .data = buffer.data(), .size = std::min(size, buffer.size()), .is_write = false};
+        run_blocking(read_request);
+
+        if (read_request.result < 0)
+            throw std::runtime_error(std::format("failed to copy file data: {}", std::strerror(-read_request.result)));
+
+        // source is shorter than asked, there is nothing more to copy
+        if (read_request.result == 0)
+            return;
+
+        IoRequest write_request{.fd = out_fd, .offset = out_offset, .data = buffer.data(), .size = static_cast<size_t>(read_request.result), .is_write = true};
+        run_blocking(write_request);
+
+        if (write_request.result < 0)
+            throw std::runtime_error(std::format("failed to copy file data: {}", std::strerror(-write_request.result)));
+
+        in_offset += read_request.result;
+        out_offset += read_request.result;
+        size -= read_request.result;
+    }
+}
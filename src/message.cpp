@@ -49,6 +49,28 @@ std::string message_type_to_string(MessageType type)
         return "SEND_CHUNK";
     case MessageType::REQ_DOWNLOAD_FILES:
         return "REQ_DOWNLOAD_FILES";
+    case MessageType::OPEN_DATA_CHANNELS:
+        return "OPEN_DATA_CHANNELS";
+    case MessageType::DATA_CHANNEL:
+        return "DATA_CHANNEL";
+    case MessageType::HANDSHAKE:
+        return "HANDSHAKE";
+    case MessageType::ZSTD_DICT:
+        return "ZSTD_DICT";
+    case MessageType::RESUME_QUERY:
+        return "RESUME_QUERY";
+    case MessageType::RESUME_FROM:
+        return "RESUME_FROM";
+    case MessageType::SESSION_RESUME:
+        return "SESSION_RESUME";
+    case MessageType::SESSION_STATE:
+        return "SESSION_STATE";
+    case MessageType::CHANGE_SEQ:
+        return "CHANGE_SEQ";
+    case MessageType::SUBSCRIBE:
+        return "SUBSCRIBE";
+    case MessageType::FILE_UPDATE:
+        return "FILE_UPDATE";
 
     default:
         return "UNKNOWN";
@@ -100,6 +122,28 @@ MessageType message_type_from_string(const std::string &type)
         return MessageType::SEND_CHUNK;
     else if (type == "REQ_DOWNLOAD_FILES")
         return MessageType::REQ_DOWNLOAD_FILES;
+    else if (type == "OPEN_DATA_CHANNELS")
+        return MessageType::OPEN_DATA_CHANNELS;
+    else if (type == "DATA_CHANNEL")
+        return MessageType::DATA_CHANNEL;
+    else if (type == "HANDSHAKE")
+        return MessageType::HANDSHAKE;
+    else if (type == "ZSTD_DICT")
+        return MessageType::ZSTD_DICT;
+    else if (type == "RESUME_QUERY")
+        return MessageType::RESUME_QUERY;
+    else if (type == "RESUME_FROM")
+        return MessageType::RESUME_FROM;
+    else if (type == "SESSION_RESUME")
+        return MessageType::SESSION_RESUME;
+    else if (type == "SESSION_STATE")
+        return MessageType::SESSION_STATE;
+    else if (type == "CHANGE_SEQ")
+        return MessageType::CHANGE_SEQ;
+    else if (type == "SUBSCRIBE")
+        return MessageType::SUBSCRIBE;
+    else if (type == "FILE_UPDATE")
+        return MessageType::FILE_UPDATE;
 
     throw std::runtime_error(std::format("unknown message type received {}", type));
 }
@@ -219,7 +263,121 @@ void from_json(const json &j, Message &m)
         m.payload = payload_json.get<RequestDownloadFilesPayload>();
         break;
 
+    case MessageType::OPEN_DATA_CHANNELS:
+        m.payload = payload_json.get<DataChannelsPayload>();
+        break;
+
+    case MessageType::DATA_CHANNEL:
+        m.payload = payload_json.get<DataChannelPayload>();
+        break;
+
+    case MessageType::HANDSHAKE:
+        m.payload = payload_json.get<HandshakePayload>();
+        break;
+
+    case MessageType::ZSTD_DICT:
+        m.payload = payload_json.get<DictionaryPayload>();
+        break;
+
+    case MessageType::RESUME_QUERY:
+        m.payload = payload_json.get<ResumeQueryPayload>();
+        break;
+
+    case MessageType::RESUME_FROM:
+        m.payload = payload_json.get<ResumeFromPayload>();
+        break;
+
+    case MessageType::SESSION_RESUME:
+        m.payload = payload_json.get<SessionResumePayload>();
+        break;
+
+    case MessageType::SESSION_STATE:
+        m.payload = payload_json.get<SessionStatePayload>();
+        break;
+
+    case MessageType::CHANGE_SEQ:
+        m.payload = payload_json.get<ChangeSeqPayload>();
+        break;
+
+    case MessageType::SUBSCRIBE:
+        m.payload = payload_json.get<SubscribePayload>();
+        break;
+
+    case MessageType::FILE_UPDATE:
+        m.payload = payload_json.get<FileUpdatePayload>();
+        break;
+
     default:
         m.payload = std::monostate{};
     }
-}
\ No newline at end of file
+}
+TrafficClass traffic_class_of(MessageType type)
+{
+    switch (type)
+    {
+    // realtime edits, someone is waiting to see them on the other side
+    case MessageType::MODIFIED_CHUNK:
+        return TrafficClass::INTERACTIVE;
+
+    // whole files and chunk downloads
+    case MessageType::SEND_FILE:
+    case MessageType::SEND_CHUNK:
+    case MessageType::DATA_SNAP:
+    case MessageType::ZSTD_DICT:
+        return TrafficClass::BULK;
+
+    default:
+        return TrafficClass::CONTROL;
+    }
+}
+
+// paths a message changes once it is applied, with whether each is a directory
+std::vector<std::pair<std::string, bool>> changed_paths(const Message &msg)
+{
+    std::vector<std::pair<std::string, bool>> paths;
+
+    if (auto payload = std::get_if<FileCreateRemovePayload>(&(msg.payload)))
+        paths.emplace_back(payload->filename, false);
+
+    else if (auto payload = std::get_if<FilesCreatedPayload>(&(msg.payload)))
+        for (const auto &filename : payload->files)
+            paths.emplace_back(filename, false);
+
+    else if (auto payload = std::get_if<FilesRemovedPayload>(&(msg.payload)))
+        for (const auto &filename : payload->files)
+            paths.emplace_back(filename, false);
+
+    else if (auto payload = std::get_if<FileMovedPayload>(&(msg.payload)))
+    {
+        paths.emplace_back(payload->old_filename, false);
+        paths.emplace_back(payload->new_filename, false);
+    }
+
+    else if (auto payload = std::get_if<DirCreateRemovePayload>(&(msg.payload)))
+        paths.emplace_back(payload->dir_path, true);
+
+    else if (auto payload = std::get_if<DirsCreatedRemovedPayload>(&(msg.payload)))
+        for (const auto &dir_path : payload->dirs)
+            paths.emplace_back(dir_path, true);
+
+    else if (auto payload = std::get_if<DirMovedPayload>(&(msg.payload)))
+    {
+        paths.emplace_back(payload->old_dir_path, true);
+        paths.emplace_back(payload->new_dir_path, true);
+    }
+
+    // content changes count once the whole file is there
+    else if (auto payload = std::get_if<ModifiedChunkPayload>(&(msg.payload)); payload && payload->is_last_chunk)
+        paths.emplace_back(payload->filename, false);
+
+    else if (auto payload = std::get_if<SendFilePayload>(&(msg.payload)); payload && payload->is_last_part)
+        paths.emplace_back(payload->filename, false);
+
+    else if (auto payload = std::get_if<SendChunkPayload>(&(msg.payload)))
+        paths.emplace_back(payload->filename, false);
+
+    else if (auto payload = std::get_if<FileUpdatePayload>(&(msg.payload)))
+        paths.emplace_back(payload->filename, false);
+
+    return paths;
+}
@@ -1,5 +1,6 @@
 #include <nlohmann/json.hpp>
 #include <iostream>
+#include <format>
 #include "../include/messenger.hpp"
 #include "../include/utils.hpp"
 
@@ -7,23 +8,47 @@ using json = nlohmann::json;
 
 Messenger::Messenger(TcpConnection &conn) : client(conn) {}
 
-void Messenger::send_file_data(FileIO &fileio, const size_t offset, const size_t chunk_size) const
+void Messenger::set_compressor(ChunkCompressor *compressor)
 {
-    std::string chunk_string = fileio.read_file_from_offset(offset, chunk_size);
+    this->compressor = compressor;
+}
+
+void Messenger::set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter)
+{
+    this->bandwidth_limiter = bandwidth_limiter;
+}
 
-    // send the message raw data
-    client.sendAll(chunk_string);
+void Messenger::send_limited(const std::string &data, const TrafficClass traffic_class) const
+{
+    if (!bandwidth_limiter)
+    {
+        client.sendAll(data);
+        return;
+    }
 
-    // now send EOF to stop waiting
-    // client.shutdownWrite();
+    const size_t slice_size = bandwidth_limiter->slice_size(traffic_class);
+
+    for (size_t offset = 0; offset < data.size(); offset += slice_size)
+    {
+        const size_t size = std::min(slice_size, data.size() - offset);
+
+        bandwidth_limiter->acquire(traffic_class, size);
+        client.sendAll(size == data.size() ? data : data.substr(offset, size));
+    }
 }
 
-void Messenger::send_file_data(const std::string &data) const
+void Messenger::send_file_data(const std::string &data, const TrafficClass traffic_class) const
 {
-    client.sendAll(data);
+    const auto start = std::chrono::steady_clock::now();
+
+    send_limited(data, traffic_class);
+
+    // lets the compressor know how fast the link is draining
+    if (compressor)
+        compressor->record_send(data.size(), std::chrono::steady_clock::now() - start);
 }
 
-void Messenger::send_json_message(const Message &msg) const
+std::string Messenger::encode_json_message(const Message &msg)
 {
     json j;
 
@@ -31,12 +56,13 @@ void Messenger::send_json_message(const Message &msg) const
 
     const std::string &message = j.dump();
 
-    // sending the len of json message
-    std::string json_len_string = convert_to_binary_string(message.size());
-    client.sendAll(json_len_string);
+    // the len of json message followed by the json message
+    return convert_to_binary_string(message.size()) + message;
+}
 
-    // sending the json message
-    client.sendAll(message);
+void Messenger::send_json_message(const Message &msg) const
+{
+    send_limited(encode_json_message(msg), traffic_class_of(msg.type));
 
     // if (msg.type != MessageType::ADDED_CHUNK && msg.type != MessageType::MODIFIED_CHUNK)
     //     client.shutdownWrite();
@@ -44,9 +70,6 @@ void Messenger::send_json_message(const Message &msg) const
 
 Message Messenger::receive_json_message() const
 {
-    json j;
-    Message msg;
-
     // receive and parse the length of message
     std::string json_len_string = client.receiveSome(sizeof(uint32_t));
     uint32_t json_len;
@@ -54,7 +77,13 @@ Message Messenger::receive_json_message() const
     json_len = ntohl(json_len);
 
     // receive exact message bytes
-    const std::string &message = client.receiveSome(json_len);
+    return decode_json_message(client.receiveSome(json_len));
+}
+
+Message Messenger::decode_json_message(const std::string &message) const
+{
+    json j;
+    Message msg;
 
     if (!message.empty())
     {
@@ -69,6 +98,13 @@ Message Messenger::receive_json_message() const
         msg.payload = std::monostate{};
     }
 
+    // dictionaries can come before any chunk so they are taken here and the next message is returned
+    if (auto payload = std::get_if<DictionaryPayload>(&(msg.payload)))
+    {
+        receive_dictionary(*payload);
+        return receive_json_message();
+    }
+
     return msg;
 }
 
@@ -80,4 +116,54 @@ std::string Messenger::receive_full_data()
 std::string Messenger::receive_max_given_bytes(size_t max_bytes) const
 {
     return client.receiveSome(max_bytes);
+}
+
+std::string Messenger::receive_chunk_data(const size_t chunk_size, const Compression compression, const size_t wire_size, const uint32_t dict_version) const
+{
+    // all of what was sent is taken off the connection even if it isn't the size it says
+    if (compression == Compression::NONE)
+    {
+        std::string chunk_data = client.receiveSome(wire_size);
+
+        if (chunk_data.size() != chunk_size)
+            throw std::runtime_error(std::format("chunk of {} bytes received as {} bytes", chunk_size, chunk_data.size()));
+
+        return chunk_data;
+    }
+
+    if (!compressor)
+        throw std::runtime_error("compressed chunk received without agreeing on compression");
+
+    const std::string &wire_data = client.receiveSome(wire_size);
+
+    return compressor->decompress(compression, wire_data, chunk_size, dict_version);
+}
+
+std::shared_ptr<const ZstdDictionary> Messenger::share_dictionary() const
+{
+    auto dictionary = compressor->get_dictionary();
+
+    if (dictionary && dictionary->version != sent_dict_version)
+    {
+        const Message msg{
+            .type = MessageType::ZSTD_DICT,
+            .payload = DictionaryPayload{
+                .dict_version = dictionary->version,
+                .dict_size = dictionary->data.size()}};
+
+        send_json_message(msg);
+        send_limited(dictionary->data, TrafficClass::BULK);
+
+        sent_dict_version = dictionary->version;
+    }
+
+    return dictionary;
+}
+
+void Messenger::receive_dictionary(const DictionaryPayload &payload) const
+{
+    if (!compressor)
+        throw std::runtime_error("dictionary received without agreeing on compression");
+
+    compressor->add_peer_dictionary(payload.dict_version, client.receiveSome(payload.dict_size));
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "../include/patch-journal.hpp"
+#include "../include/resume-store.hpp"
+#include "../include/utils.hpp"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <format>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr char JOURNAL_MAGIC[] = "SYNCLETJ";
+
+    template <typename T>
+    void write_value(std::ofstream &file, const T &value)
+    {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    T read_value(std::ifstream &file)
+    {
+        T value;
+        if (!file.read(reinterpret_cast<char *>(&value), sizeof(value)))
+            throw std::runtime_error("journal ends early");
+
+        return value;
+    }
+
+    std::string read_bytes(std::ifstream &file, const size_t size)
+    {
+        std::string bytes(size, '\0');
+        if (!file.read(bytes.data(), size))
+            throw std::runtime_error("journal ends early");
+
+        return bytes;
+    }
+}
+
+PatchJournal::PatchJournal(const std::string &journal_dir) : journal_dir(journal_dir)
+{
+    if (!fs::exists(this->journal_dir))
+        fs::create_directories(this->journal_dir);
+}
+
+// different paths can sanitize to the same name, the hash keeps them apart
+fs::path PatchJournal::journal_path(const std::string &filepath) const
+{
+    return journal_dir / std::format("{}-{:x}.journal", sanitize_filename(filepath), std::hash<std::string>{}(filepath));
+}
+
+void PatchJournal::write_patches(const std::string &filepath, const std::vector<Patch> &patches)
+{
+    const int fd = open(filepath.c_str(), O_WRONLY);
+
+    if (fd == -1)
+        throw std::runtime_error(std::format("failed to open {} for patching: {}", filepath, std::strerror(errno)));
+
+    for (const auto &patch : patches)
+    {
+        size_t written = 0;
+
+        while (written < patch.data.size())
+        {
+            const ssize_t result = pwrite(fd, patch.data.data() + written, patch.data.size() - written, patch.offset + written);
+
+            if (result == -1 && errno == EINTR)
+                continue;
+
+            if (result == -1)
+            {
+                const std::string error = std::strerror(errno);
+                close(fd);
+                throw std::runtime_error(std::format("failed to patch {}: {}", filepath, error));
+            }
+
+            written += result;
+        }
+    }
+
+    const int result = fsync(fd);
+    close(fd);
+
+    if (result == -1)
+        throw std::runtime_error(std::format("failed to sync {}: {}", filepath, std::strerror(errno)));
+}
+
+// the journal appears by rename, so it is either whole or not there at all
+void PatchJournal::apply(const std::string &filepath, const std::vector<Patch> &patches) const
+{
+    const fs::path path = journal_path(filepath);
+    const fs::path temp_path = path.string() + ".tmp";
+
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+
+        file.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        write_value(file, static_cast<uint64_t>(filepath.size()));
+        file.write(filepath.data(), filepath.size());
+        write_value(file, static_cast<uint64_t>(patches.size()));
+
+        for (const auto &patch : patches)
+        {
+            write_value(file, patch.offset);
+            write_value(file, static_cast<uint64_t>(patch.data.size()));
+            file.write(patch.data.data(), patch.data.size());
+        }
+
+        if (!file)
+            throw std::runtime_error(std::format("failed to write journal of {}", filepath));
+    }
+
+    ResumeStore::sync_file(temp_path);
+    fs::rename(temp_path, path);
+    ResumeStore::sync_file(journal_dir);
+
+    write_patches(filepath, patches);
+
+    fs::remove(path);
+}
+
+// writing the same bytes again is harmless, so a journal is replayed whole
+void PatchJournal::recover() const
+{
+    for (const auto &entry : fs::directory_iterator(journal_dir))
+    {
+        const fs::path &path = entry.path();
+
+        // never renamed, the file was not touched yet
+        if (path.extension() != ".journal")
+        {
+            fs::remove(path);
+            continue;
+        }
+
+        try
+        {
+            std::ifstream file(path, std::ios::binary);
+
+            if (read_bytes(file, sizeof(JOURNAL_MAGIC)) != std::string(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)))
+                throw std::runtime_error("not a journal");
+
+            const std::string filepath = read_bytes(file, read_value<uint64_t>(file));
+
+            std::vector<Patch> patches(read_value<uint64_t>(file));
+            for (auto &patch : patches)
+            {
+                patch.offset = read_value<uint64_t>(file);
+                patch.data = read_bytes(file, read_value<uint64_t>(file));
+            }
+
+            if (fs::exists(filepath))
+            {
+                write_patches(filepath, patches);
+                std::clog << std::format("finished patching {} from its journal", filepath) << std::endl;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "ignoring broken journal " << path << ": " << e.what() << std::endl;
+        }
+
+        fs::remove(path);
+    }
+}
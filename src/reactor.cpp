@@ -0,0 +1,484 @@
+#include "../include/reactor.hpp"
+#include "../include/utils.hpp"
+#include <format>
+#include <arpa/inet.h>
+
+namespace
+{
+    constexpr uint64_t LISTEN_ID = 0;
+    constexpr int MAX_EVENTS = 256;
+}
+
+ReactorConnection::ReactorConnection(const uint64_t id, std::unique_ptr<TcpConnection> connection)
+    : id(id),
+      connection(std::move(connection)) {}
+
+uint64_t ReactorConnection::get_id() const
+{
+    return id;
+}
+
+TcpConnection &ReactorConnection::get_connection()
+{
+    return *connection;
+}
+
+std::unique_ptr<TcpConnection> ReactorConnection::detach()
+{
+    return std::move(connection);
+}
+
+Reactor::Reactor(TcpServer &server, const size_t no_of_workers, const size_t max_queued_bytes)
+    : server(server),
+      max_queued_bytes(max_queued_bytes)
+{
+    epollfd = epoll_create1(0);
+    if (epollfd == -1)
+        throw std::runtime_error(std::format("epoll_create1 failed: {}", std::strerror(errno)));
+
+    server.setNonBlocking();
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = LISTEN_ID;
+
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, server.getFD(), &ev) == -1)
+        throw std::runtime_error(std::format("epoll_ctl failed for listening socket: {}", std::strerror(errno)));
+
+    for (size_t i = 0; i < std::max<size_t>(no_of_workers, 1); i++)
+        workers.emplace_back(&Reactor::worker_loop, this);
+}
+
+Reactor::~Reactor()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        is_stopping = true;
+    }
+    job_added.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+
+    close(epollfd);
+}
+
+size_t Reactor::workers_from_env()
+{
+    return get_env_number("SYNCLET_SERVER_WORKERS", std::max(4u, std::thread::hardware_concurrency()));
+}
+
+size_t Reactor::queue_limit_from_env()
+{
+    return get_env_number("SYNCLET_PUSH_QUEUE_KB", 64 * 1024) * 1024;
+}
+
+void Reactor::set_bandwidth_limiter(BandwidthLimiter *bandwidth_limiter)
+{
+    this->bandwidth_limiter = bandwidth_limiter;
+}
+
+void Reactor::set_handlers(ConnectionHandler on_accept, MessageHandler on_message, ConnectionHandler on_close)
+{
+    this->on_accept = std::move(on_accept);
+    this->on_message = std::move(on_message);
+    this->on_close = std::move(on_close);
+}
+
+void Reactor::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true)
+    {
+        const int no_of_events = epoll_wait(epollfd, events, MAX_EVENTS, wake_throttled());
+
+        if (no_of_events == -1 && errno == EINTR)
+            continue;
+
+        if (no_of_events == -1)
+            throw std::runtime_error(std::format("epoll_wait failed: {}", std::strerror(errno)));
+
+        for (int i = 0; i < no_of_events; i++)
+        {
+            if (events[i].data.u64 == LISTEN_ID)
+            {
+                accept_clients();
+                continue;
+            }
+
+            std::shared_ptr<ReactorConnection> conn;
+            {
+                std::lock_guard<std::mutex> lock(connections_mutex);
+                auto it = connections.find(events[i].data.u64);
+                if (it != connections.end())
+                    conn = it->second;
+            }
+
+            if (conn)
+                handle_event(conn, events[i].events);
+        }
+    }
+}
+
+// edge triggered so accept till nobody is waiting
+void Reactor::accept_clients()
+{
+    while (auto connection = server.tryAcceptClient())
+    {
+        std::shared_ptr<ReactorConnection> conn;
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            conn = std::make_shared<ReactorConnection>(next_id++, std::move(connection));
+            connections[conn->id] = conn;
+        }
+
+        std::clog << "client connected..." << std::endl;
+
+        if (on_accept)
+            on_accept(*conn);
+
+        struct epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+        ev.data.u64 = conn->id;
+
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, conn->connection->getFD(), &ev) == -1)
+        {
+            std::cerr << "epoll_ctl failed for client: " << std::strerror(errno) << std::endl;
+            close_connection(conn);
+        }
+    }
+}
+
+void Reactor::handle_event(const std::shared_ptr<ReactorConnection> &conn, const uint32_t events)
+{
+    // a worker has it, the worker arms it again when done
+    if (conn->is_busy)
+        return;
+
+    try
+    {
+        if (events & EPOLLOUT)
+            flush_writes(*conn);
+
+        std::string message;
+        if (read_message(*conn, message))
+        {
+            conn->is_busy = true;
+            {
+                std::lock_guard<std::mutex> lock(jobs_mutex);
+                jobs.emplace_back(conn, std::move(message));
+            }
+            job_added.notify_one();
+            return;
+        }
+
+        arm(*conn);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        close_connection(conn);
+    }
+}
+
+bool Reactor::read_message(ReactorConnection &conn, std::string &message)
+{
+    const int fd = conn.connection->getFD();
+
+    while (true)
+    {
+        if (conn.read_buffer.empty())
+            conn.read_buffer.resize(sizeof(uint32_t));
+
+        // a whole part is in, move on to the next one
+        if (conn.read_size == conn.read_buffer.size())
+        {
+            if (!conn.is_reading_length)
+            {
+                message = std::move(conn.read_buffer);
+                conn.read_buffer.clear();
+                conn.read_size = 0;
+                conn.is_reading_length = true;
+                return true;
+            }
+
+            uint32_t json_len;
+            memcpy(&json_len, conn.read_buffer.data(), sizeof(json_len));
+
+            conn.read_buffer.assign(ntohl(json_len), '\0');
+            conn.read_size = 0;
+            conn.is_reading_length = false;
+            continue;
+        }
+
+        // read no further than the message, what follows it belongs to its handler
+        const ssize_t received = recv(fd,
+                                      conn.read_buffer.data() + conn.read_size,
+                                      conn.read_buffer.size() - conn.read_size,
+                                      0);
+
+        if (received > 0)
+            conn.read_size += received;
+        else if (received == 0)
+            throw std::runtime_error("client disconnected");
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+        else if (errno != EINTR)
+            throw std::runtime_error(std::format("recv failed: {}", std::strerror(errno)));
+    }
+}
+
+void Reactor::flush_writes(ReactorConnection &conn)
+{
+    std::lock_guard<std::mutex> lock(conn.write_mutex);
+
+    while (!conn.write_queue.empty())
+    {
+        // waits out of the loop, wake_throttled picks it up again
+        const auto delay = bandwidth_limiter ? bandwidth_limiter->delay(TrafficClass::INTERACTIVE) : std::chrono::nanoseconds(0);
+        if (delay.count() > 0)
+        {
+            conn.throttled_until = std::chrono::steady_clock::now() + delay;
+            throttled[conn.id] = conn.throttled_until;
+            break;
+        }
+
+        const std::string &frame = *conn.write_queue.front();
+        const size_t size = std::min(frame.size() - conn.write_offset,
+                                     bandwidth_limiter ? bandwidth_limiter->slice_size(TrafficClass::INTERACTIVE) : SIZE_MAX);
+
+        const ssize_t sent = send(conn.connection->getFD(),
+                                  frame.data() + conn.write_offset,
+                                  size,
+                                  MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (sent > 0)
+        {
+            conn.write_offset += sent;
+            conn.queued_bytes -= sent;
+
+            if (bandwidth_limiter)
+                bandwidth_limiter->consume(TrafficClass::INTERACTIVE, sent);
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else if (errno != EINTR)
+            throw std::runtime_error(std::format("send failed: {}", std::strerror(errno)));
+
+        if (conn.write_offset == frame.size())
+        {
+            conn.write_queue.pop_front();
+            conn.write_offset = 0;
+        }
+    }
+}
+
+// the worker owns the connection, so the frames are taken out and sent without holding the lock
+void Reactor::drain_writes(ReactorConnection &conn)
+{
+    std::deque<Frame> frames;
+    size_t offset = 0;
+    {
+        std::lock_guard<std::mutex> lock(conn.write_mutex);
+        frames.swap(conn.write_queue);
+        std::swap(offset, conn.write_offset);
+        conn.queued_bytes = 0;
+    }
+
+    for (; !frames.empty(); frames.pop_front(), offset = 0)
+    {
+        const std::string &frame = *frames.front();
+
+        while (offset < frame.size())
+        {
+            const size_t size = std::min(frame.size() - offset,
+                                         bandwidth_limiter ? bandwidth_limiter->slice_size(TrafficClass::INTERACTIVE) : SIZE_MAX);
+
+            if (bandwidth_limiter)
+                bandwidth_limiter->acquire(TrafficClass::INTERACTIVE, size);
+
+            conn.connection->sendAll(frame.data() + offset, size);
+            offset += size;
+        }
+    }
+}
+
+int Reactor::wake_throttled()
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<uint64_t> due;
+    auto next = std::chrono::steady_clock::time_point::max();
+
+    for (auto it = throttled.begin(); it != throttled.end();)
+    {
+        if (it->second <= now)
+        {
+            due.push_back(it->first);
+            it = throttled.erase(it);
+        }
+        else
+        {
+            next = std::min(next, it->second);
+            it++;
+        }
+    }
+
+    for (const uint64_t id : due)
+    {
+        std::shared_ptr<ReactorConnection> conn;
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            auto it = connections.find(id);
+            if (it != connections.end())
+                conn = it->second;
+        }
+
+        if (conn)
+            handle_event(conn, EPOLLOUT);
+    }
+
+    // a connection throttled again while waking the others is due no sooner than now
+    for (const auto &[id, until] : throttled)
+        next = std::min(next, until);
+
+    if (next == std::chrono::steady_clock::time_point::max())
+        return -1;
+
+    const auto wait_for = std::chrono::ceil<std::chrono::milliseconds>(next - std::chrono::steady_clock::now());
+    return static_cast<int>(std::max<int64_t>(wait_for.count(), 0));
+}
+
+void Reactor::arm(ReactorConnection &conn)
+{
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.u64 = conn.id;
+
+    // a throttled connection is woken by wake_throttled instead, a writable socket would wake it right away
+    {
+        std::lock_guard<std::mutex> lock(conn.write_mutex);
+        if (!conn.write_queue.empty() && conn.throttled_until <= std::chrono::steady_clock::now())
+            ev.events |= EPOLLOUT;
+    }
+
+    // re-arming reports data which is already waiting, so nothing is missed in between
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, conn.connection->getFD(), &ev) == -1)
+        throw std::runtime_error(std::format("epoll_ctl failed: {}", std::strerror(errno)));
+}
+
+void Reactor::post(const uint64_t connection_id, const std::vector<Frame> &frames)
+{
+    std::shared_ptr<ReactorConnection> conn;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        auto it = connections.find(connection_id);
+        if (it == connections.end())
+            return;
+        conn = it->second;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(conn->write_mutex);
+
+        if (conn->is_overflowed)
+            return;
+
+        size_t bytes = 0;
+        for (const auto &frame : frames)
+            bytes += frame->size();
+
+        // closing it here could wait on whoever posts, the reactor closes it once it sees the shutdown
+        if (conn->queued_bytes + bytes > max_queued_bytes)
+        {
+            std::cerr << std::format("connection {} is {} bytes behind, cutting it off", conn->id, conn->queued_bytes) << std::endl;
+
+            conn->is_overflowed = true;
+            conn->write_queue.clear();
+            conn->write_offset = 0;
+            conn->queued_bytes = 0;
+
+            if (conn->connection)
+                shutdown(conn->connection->getFD(), SHUT_RDWR);
+            return;
+        }
+
+        conn->write_queue.insert(conn->write_queue.end(), frames.begin(), frames.end());
+        conn->queued_bytes += bytes;
+    }
+
+    // an idle connection is woken up to send it, a busy one gets armed for it by its worker
+    if (!conn->is_busy)
+    {
+        try
+        {
+            arm(*conn);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+}
+
+void Reactor::close_connection(const std::shared_ptr<ReactorConnection> &conn)
+{
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        if (!connections.erase(conn->id))
+            return;
+    }
+
+    if (conn->connection)
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->connection->getFD(), nullptr);
+
+    if (on_close)
+        on_close(*conn);
+
+    // the socket itself closes when the last reference is gone
+}
+
+void Reactor::worker_loop()
+{
+    while (true)
+    {
+        std::shared_ptr<ReactorConnection> conn;
+        std::string message;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            job_added.wait(lock, [&]()
+                           { return is_stopping || !jobs.empty(); });
+
+            if (is_stopping)
+                return;
+
+            std::tie(conn, message) = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        try
+        {
+            // whatever was posted goes out before the handler writes anything
+            drain_writes(*conn);
+
+            const int fd = conn->connection->getFD();
+            on_message(*conn, message);
+
+            // handed over somewhere else, stop watching it
+            if (!conn->connection)
+            {
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, nullptr);
+                close_connection(conn);
+                continue;
+            }
+
+            conn->is_busy = false;
+            arm(*conn);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            close_connection(conn);
+        }
+    }
+}
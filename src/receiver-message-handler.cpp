@@ -1,5 +1,66 @@
 #include "../include/receiver-message-handler.hpp"
 
+namespace
+{
+    // chunk requests of one file in flight at once
+    constexpr size_t FETCH_WINDOW_CHUNKS = 16;
+
+    // the peer's snap of the file is taken over when the chunks written are the ones it has at
+    // their offsets and the size adds up, otherwise the file is read and hashed again. the
+    // caller passes one only if the change was made against the version we had, which makes
+    // the bytes in between the chunks the peer's too
+    FileSnapshot snapshot_applied(const ChunkHandler &chunk_handler,
+                                  const std::string &filepath,
+                                  const std::string &working_dir,
+                                  const std::optional<FileSnapshot> &peer_snap)
+    {
+        if (!peer_snap ||
+            fs::file_size(filepath) != peer_snap->file_size ||
+            !chunk_handler.wrote_only_chunks_of(*peer_snap))
+            return SnapshotManager::createSnapshot(filepath, working_dir);
+
+        FileSnapshot file_snap = *peer_snap;
+        file_snap.filename = extract_filename_from_path(working_dir, filepath);
+        file_snap.mtime = to_unix_timestamp(fs::last_write_time(filepath));
+
+        return file_snap;
+    }
+
+    // chunks of a file coming whole are the chunks of the peer's snap, hashing them as they are
+    // written saves reading the file again afterwards
+    void add_received_chunk(FileSnapshot &received_snap, const SendChunkPayload &chunk_payload, const std::string &chunk_data)
+    {
+        const std::string &hash = SnapshotManager::chunk_hash(chunk_data);
+        received_snap.chunks[hash] = ChunkInfo(chunk_payload.offset, chunk_data.size(), hash, chunk_payload.chunk_no);
+    }
+
+    // what came must be the file the peer has, otherwise the old version stays. its data is on
+    // disk before it takes the name, only the dir entry is left for the group commit
+    FileSnapshot publish_received_file(const SendFilePayload &payload,
+                                       const std::string &filepath,
+                                       FileIO &incoming,
+                                       FileSnapshot received_snap,
+                                       const uint64_t bytes_received)
+    {
+        const std::string incoming_path = filepath + ".incoming";
+
+        if (bytes_received != payload.file_size ||
+            (!payload.file_digest.empty() && SnapshotManager::file_digest(received_snap) != payload.file_digest))
+        {
+            incoming.close_file();
+            fs::remove(incoming_path);
+            throw std::runtime_error(std::format("{} arrived different from what peer has", payload.filename));
+        }
+
+        incoming.sync_data();
+        incoming.close_file();
+        fs::rename(incoming_path, filepath);
+
+        received_snap.mtime = to_unix_timestamp(fs::last_write_time(filepath));
+        return received_snap;
+    }
+}
+
 /*
   . 'old_chunk_size' will always be used for moving cursor
   . 'chunk_size will be used for writing that amount of data'
@@ -13,10 +74,81 @@ ReceiverMessageHandler::ReceiverMessageHandler(const std::string &working_dir, M
     : working_dir(working_dir),
       messenger(messenger) {}
 
+void ReceiverMessageHandler::set_data_channels(DataChannels *data_channels)
+{
+    this->data_channels = data_channels;
+}
+
+void ReceiverMessageHandler::set_resume_store(ResumeStore *resume_store)
+{
+    this->resume_store = resume_store;
+}
+
+void ReceiverMessageHandler::set_async_messenger(AsyncMessenger *async_messenger)
+{
+    this->async_messenger = async_messenger;
+}
+
+void ReceiverMessageHandler::set_apply_pool(ApplyPool *apply_pool)
+{
+    this->apply_pool = apply_pool;
+}
+
+void ReceiverMessageHandler::set_on_applied(std::function<void(const FileSnapshot &)> on_applied)
+{
+    this->on_applied = std::move(on_applied);
+}
+
+void ReceiverMessageHandler::set_snap_lookup(std::function<std::optional<FileSnapshot>(const std::string &)> snap_lookup)
+{
+    this->snap_lookup = std::move(snap_lookup);
+}
+
+bool ReceiverMessageHandler::has_base(const std::string &filename, const std::string &base_digest, const DirSnapshot &snaps) const
+{
+    if (base_digest.empty())
+        return false;
+
+    if (auto it = snaps.find(filename); it != snaps.end())
+        return SnapshotManager::file_digest(it->second) == base_digest;
+
+    const std::optional<FileSnapshot> local_snap = snap_lookup ? snap_lookup(filename) : std::nullopt;
+    return local_snap && SnapshotManager::file_digest(*local_snap) == base_digest;
+}
+
+void ReceiverMessageHandler::set_patch_journal(PatchJournal *patch_journal)
+{
+    this->patch_journal = patch_journal;
+}
+
+void ReceiverMessageHandler::set_durability_manager(DurabilityManager *durability_manager)
+{
+    this->durability_manager = durability_manager;
+}
+
+void ReceiverMessageHandler::make_durable()
+{
+    if (durability_manager)
+        durability_manager->commit();
+}
+
+void ReceiverMessageHandler::mark_written(const std::string &path) const
+{
+    if (durability_manager)
+        durability_manager->add_file(path);
+}
+
+void ReceiverMessageHandler::mark_dir_changed(const std::string &dir_path) const
+{
+    if (durability_manager)
+        durability_manager->add_dir(dir_path);
+}
+
 // creates and appends stream data to file then create and add snapshot
 void ReceiverMessageHandler::process_create_file(const FileCreateRemovePayload &payload, DirSnapshot &snaps)
 {
     FileIO fileio(std::format("{}/{}", working_dir, payload.filename), std::ios::out);
+    mark_written(fileio.get_filepath());
     snaps[payload.filename] = SnapshotManager::createSnapshot(fileio.get_filepath(), working_dir);
 }
 
@@ -25,7 +157,12 @@ void ReceiverMessageHandler::process_create_file(const FilesCreatedPayload &payl
 {
     for (auto &filename : payload.files)
     {
+        // a partially received file is kept as it is, peer will ask where to resume from
+        if (resume_store && resume_store->load(filename))
+            continue;
+
         FileIO fileio(std::format("{}/{}", working_dir, filename), std::ios::out);
+        mark_written(fileio.get_filepath());
         snaps[filename] = SnapshotManager::createSnapshot(fileio.get_filepath(), working_dir);
     }
 }
@@ -39,6 +176,8 @@ void ReceiverMessageHandler::process_delete_file(const FileCreateRemovePayload &
     if (!fs::exists(filepath) || !fs::remove(filepath))
         std::cerr << "failed to delete file: " << payload.filename << std::endl;
 
+    mark_dir_changed(fs::path(filepath).parent_path().string());
+
     snaps.erase(payload.filename);
 }
 
@@ -53,6 +192,8 @@ void ReceiverMessageHandler::process_delete_file(const FilesRemovedPayload &payl
         if (!fs::exists(filepath) || !fs::remove(filepath))
             std::cerr << "failed to delete file: " << filename << std::endl;
 
+        mark_dir_changed(fs::path(filepath).parent_path().string());
+
         // remove the file from snaps too!
         snaps.erase(filename);
     }
@@ -66,6 +207,9 @@ void ReceiverMessageHandler::process_file_moved(const FileMovedPayload &payload,
 
     fs::rename(old_filepath, new_filepath);
 
+    mark_written(new_filepath);
+    mark_dir_changed(fs::path(old_filepath).parent_path().string());
+
     auto file_snap = std::move(snaps[payload.old_filename]);
     snaps[payload.new_filename] = std::move(file_snap);
     snaps.erase(payload.old_filename);
@@ -85,6 +229,8 @@ void ReceiverMessageHandler::process_create_dir(const DirCreateRemovePayload &pa
     {
         std::clog << "Failed to create Directory: " << fullpath << " Might be Already Exist!" << std::endl;
     }
+
+    mark_written(fullpath);
 }
 
 void ReceiverMessageHandler::process_create_dir(const DirsCreatedRemovedPayload &payload)
@@ -100,6 +246,8 @@ void ReceiverMessageHandler::process_create_dir(const DirsCreatedRemovedPayload
         std::string fullpath = std::format("{}/{}", working_dir, dir_path);
         if (!fs::create_directory(fullpath))
             std::cerr << "Failed o create Directory: " << fullpath << " Might be Already Exist!" << std::endl;
+
+        mark_written(fullpath);
     }
 }
 
@@ -131,6 +279,7 @@ void ReceiverMessageHandler::process_delete_dir(const DirCreateRemovePayload &pa
     std::string fullpath = std::format("{}/{}", working_dir, payload.dir_path);
 
     std::clog << fs::remove_all(fullpath) << " entries deleted for " << fullpath << std::endl;
+    mark_dir_changed(fs::path(fullpath).parent_path().string());
 }
 
 void ReceiverMessageHandler::process_delete_dir(const DirsCreatedRemovedPayload &payload, DirSnapshot &snaps)
@@ -168,6 +317,7 @@ void ReceiverMessageHandler::process_delete_dir(const DirsCreatedRemovedPayload
     {
         std::string fullpath = std::format("{}/{}", working_dir, dir_path);
         std::clog << fs::remove_all(fullpath) << " entries deleted for " << fullpath << std::endl;
+        mark_dir_changed(fs::path(fullpath).parent_path().string());
     }
 }
 
@@ -179,6 +329,9 @@ void ReceiverMessageHandler::process_dir_moved(const DirMovedPayload &payload, D
     const std::string &to = std::format("{}/{}", working_dir, payload.new_dir_path);
     fs::rename(from, to);
 
+    mark_written(to);
+    mark_dir_changed(fs::path(from).parent_path().string());
+
     // updating the new path in each file entry
     std::vector<std::pair<std::string, FileSnapshot>> snap_arr;
     for (auto it = snaps.begin(); it != snaps.end();)
@@ -212,84 +365,279 @@ void ReceiverMessageHandler::process_dir_moved(const DirMovedPayload &payload, D
 }
 
 // handle the case where peer is sending modified chunks and update the snap of that file too!
-void ReceiverMessageHandler::process_modified_chunk(const ModifiedChunkPayload &provided_payload, DirSnapshot &snaps)
+// chunks are staged on disk per file, so chunks of other files can come in between
+void ReceiverMessageHandler::process_modified_chunk(const ModifiedChunkPayload &payload, DirSnapshot &snaps)
 {
-    ChunkHandler chunk_handler(provided_payload.filename);
+    wait_for_apply(payload.filename, snaps);
+
+    auto &chunk_handler = staged_files[payload.filename];
+    if (!chunk_handler)
+        chunk_handler = std::make_shared<ChunkHandler>(payload.filename);
+
+    ChunkMetadata chunk_md{
+        .chunk_type = payload.chunk_type,
+        .offset = payload.offset,
+        .chunk_size = payload.chunk_size,
+        .old_chunk_size = payload.old_chunk_size,
+        .is_last_chunk = payload.is_last_chunk};
+
+    // now take the chunk data if it is not removed
+    const std::string &data = payload.chunk_type != ChunkType::REMOVE ? messenger.receive_chunk_data(payload) : "";
+
+    if (data.size() != payload.chunk_size)
+        std::clog << std::format("requested {} size data but got {} size", payload.chunk_size, data.size());
+
+    // stage the whole chunk for its file
+    chunk_handler->save_chunk(chunk_md, data);
+
+    // file is put together once its last chunk arrives
+    if (!payload.is_last_chunk)
+        return;
+
+    auto staged = std::move(chunk_handler);
+    staged_files.erase(payload.filename);
 
-    auto payload = provided_payload;
+    // peer's snap is of no use when the change was made against another version than ours
+    std::optional<FileSnapshot> peer_snap;
+    if (has_base(payload.filename, payload.base_digest, snaps))
+        peer_snap = SnapshotManager::from_chunks(payload.filename, payload.file_size, payload.file_chunks);
 
-    while (true)
+    // now create a final version using the chunks + copying data on gaps
+    apply_staged_file(std::move(staged), payload.filename, snaps, std::move(peer_snap));
+}
+
+void ReceiverMessageHandler::apply_staged_file(std::shared_ptr<ChunkHandler> chunk_handler, const std::string &filename, DirSnapshot &snaps, std::optional<FileSnapshot> peer_snap)
+{
+    const std::string filepath = working_dir + "/" + filename;
+
+    if (!apply_pool)
     {
-        ChunkMetadata chunk_md{
-            .chunk_type = payload.chunk_type,
-            .offset = payload.offset,
-            .chunk_size = payload.chunk_size,
-            .old_chunk_size = payload.old_chunk_size,
-            .is_last_chunk = payload.is_last_chunk};
+        chunk_handler->finalize_file(filepath, patch_journal);
+        mark_dir_changed(fs::path(filepath).parent_path().string());
+        snaps[filename] = snapshot_applied(*chunk_handler, filepath, working_dir, peer_snap);
+        return;
+    }
 
-        // now take the chunk data if it is not removed
-        const std::string &data = payload.chunk_type != ChunkType::REMOVE ? messenger.receive_max_given_bytes(payload.chunk_size) : "";
+    auto result = std::make_shared<std::promise<FileSnapshot>>();
+    pending_applies[filename] = result->get_future();
+
+    apply_pool->submit(filename, [this, result, chunk_handler, filepath, working_dir = working_dir, patch_journal = patch_journal, durability_manager = durability_manager, peer_snap = std::move(peer_snap)]()
+                       {
+                           try
+                           {
+                               chunk_handler->finalize_file(filepath, patch_journal);
+                               if (durability_manager)
+                                   durability_manager->add_dir(fs::path(filepath).parent_path().string());
+                               complete_apply(*result, snapshot_applied(*chunk_handler, filepath, working_dir, peer_snap));
+                           }
+                           catch (...)
+                           {
+                               result->set_exception(std::current_exception());
+                           } });
+}
 
-        if (data.size() != payload.chunk_size)
-            std::clog << std::format("requested {} size data but got {} size", payload.chunk_size, data.size());
+void ReceiverMessageHandler::wait_for_apply(const std::string &filename, DirSnapshot &snaps)
+{
+    auto node = pending_applies.extract(filename);
+    if (node.empty())
+        return;
 
-        // save the whole chunk to corresponding file
-        chunk_handler.save_chunk(chunk_md, data);
+    FileSnapshot file_snap = node.mapped().get();
+    if (!on_applied)
+        snaps[filename] = std::move(file_snap);
+}
 
-        // leave when this was the last chunk
-        if (payload.is_last_chunk)
-            break;
+// the snap is handed over before the future is ready, so whoever waits for the file sees it landed
+void ReceiverMessageHandler::complete_apply(std::promise<FileSnapshot> &result, FileSnapshot file_snap) const
+{
+    if (on_applied)
+        on_applied(file_snap);
 
-        const Message &msg = messenger.receive_json_message();
+    result.set_value(std::move(file_snap));
+}
 
-        if (auto payload_ptr = std::get_if<ModifiedChunkPayload>(&(msg.payload)))
-            payload = *payload_ptr;
+// every file lands before the first failure is thrown
+void ReceiverMessageHandler::finish_applies(DirSnapshot &snaps)
+{
+    std::exception_ptr exception;
 
-        else
+    for (auto &[filename, result] : pending_applies)
+    {
+        try
         {
-            std::cerr << "invalid payload received for modified chunk";
-            break;
+            FileSnapshot file_snap = result.get();
+            if (!on_applied)
+                snaps[filename] = std::move(file_snap);
+        }
+        catch (...)
+        {
+            if (!exception)
+                exception = std::current_exception();
         }
     }
+    pending_applies.clear();
 
-    const auto &filepath = working_dir + "/" + payload.filename;
-
-    // now create a final version using the chunks + copying data on gaps
-    chunk_handler.finalize_file(filepath);
-
-    // now update the snap of the file
-    snaps[payload.filename] = SnapshotManager::createSnapshot(filepath, working_dir);
+    if (exception)
+        std::rethrow_exception(exception);
 }
 
 void ReceiverMessageHandler::process_file(const SendFilePayload &payload, DirSnapshot &snaps)
 {
     const std::string &filepath = std::format("{}/{}", working_dir, payload.filename);
-    FilePairSession file_session(filepath, true);
-    file_session.ensure_files_open();
 
-    // take all the chunks and append them to the original file
+    // an earlier version of the file may still be put in place on the pool
+    wait_for_apply(payload.filename, snaps);
+
+    // peer sends the whole file instead of a change of it which it couldn't finish
+    if (auto staged = staged_files.extract(payload.filename))
+        staged.mapped()->discard();
+
+    // every file is written next to it and put in place once complete, one coming in parts stays
+    // there between them so that its checkpoint can continue it
+    const std::string incoming_path = filepath + ".incoming";
+
+    // the chunks are the chunks of the peer's snap, they are hashed as they come instead of
+    // reading the file again afterwards
+    FileSnapshot received_snap(payload.filename, payload.file_size, 0, {});
+    uint64_t bytes_received = 0;
+
+    if (payload.is_striped)
+    {
+        const ChunkInfo &last_chunk = process_striped_file(payload, incoming_path, received_snap, bytes_received);
+
+        if (!payload.is_last_part)
+            return save_checkpoint(payload, incoming_path, last_chunk, received_snap);
+
+        FileIO incoming(incoming_path, std::ios::in | std::ios::out);
+        return publish_incoming_file(payload, filepath, incoming, std::move(received_snap), bytes_received, snaps);
+    }
+
+    const bool is_whole_file = !payload.is_continuation && payload.is_last_part;
+
+    // a small file is only read off the connection here, the pool writes it while the next comes
+    if (is_whole_file && apply_pool && payload.file_size <= ChunkHandler::staging_memory())
+        return stage_whole_file(payload, filepath);
+
+    // parts after the first one are written after what is already there
+    FileIO fileio(incoming_path, payload.is_continuation ? std::ios::in | std::ios::out : std::ios::out | std::ios::trunc);
+
+    // blocks of the whole file are reserved once instead of growing it chunk by chunk
+    if (!payload.is_continuation)
+        fileio.preallocate(payload.file_size, !is_whole_file);
+
+    ChunkInfo last_chunk(0, 0, "", 0);
+
+    // take all the chunks and write them at their offsets
+    receive_file_chunks(payload, [&](const SendChunkPayload &chunk_payload, std::string chunk_data)
+                        {
+                            fileio.write_file_at_offset(chunk_payload.offset, chunk_data);
+                            bytes_received += chunk_data.size();
+                            add_received_chunk(received_snap, chunk_payload, chunk_data);
+
+                            last_chunk.offset = chunk_payload.offset;
+                            last_chunk.chunk_size = chunk_data.size(); });
+
+    // rest of the file is yet to come
+    if (!payload.is_last_part)
+    {
+        fileio.close_file();
+        return save_checkpoint(payload, incoming_path, last_chunk, received_snap);
+    }
+
+    publish_incoming_file(payload, filepath, fileio, std::move(received_snap), bytes_received, snaps);
+}
+
+// chunks of the parts before the last one come from the resume store, then the file is checked
+// against the peer's digest and put in place
+void ReceiverMessageHandler::publish_incoming_file(const SendFilePayload &payload,
+                                                   const std::string &filepath,
+                                                   FileIO &incoming,
+                                                   FileSnapshot received_snap,
+                                                   uint64_t bytes_received,
+                                                   DirSnapshot &snaps)
+{
+    if (resume_store)
+    {
+        const auto checkpoint = payload.is_continuation ? resume_store->load(payload.filename) : std::nullopt;
+
+        if (checkpoint)
+            for (auto &chunk : resume_store->load_chunks(payload.filename, checkpoint->committed_bytes))
+            {
+                bytes_received += chunk.chunk_size;
+                received_snap.chunks[chunk.hash] = std::move(chunk);
+            }
+
+        resume_store->remove(payload.filename);
+    }
+
+    snaps[payload.filename] = publish_received_file(payload, filepath, incoming, std::move(received_snap), bytes_received);
+    mark_dir_changed(fs::path(filepath).parent_path().string());
+}
+
+// the chunks are kept in memory till the last one and the file is written on the pool
+void ReceiverMessageHandler::stage_whole_file(const SendFilePayload &payload, const std::string &filepath)
+{
+    auto chunks = std::make_shared<std::vector<std::pair<SendChunkPayload, std::string>>>();
+    chunks->reserve(payload.no_of_chunks);
+
+    receive_file_chunks(payload, [&](const SendChunkPayload &chunk_payload, std::string chunk_data)
+                        { chunks->emplace_back(chunk_payload, std::move(chunk_data)); });
+
+    auto result = std::make_shared<std::promise<FileSnapshot>>();
+    pending_applies[payload.filename] = result->get_future();
+
+    apply_pool->submit(payload.filename, [this, result, chunks, payload, filepath, durability_manager = durability_manager]()
+                       {
+                           try
+                           {
+                               const std::string incoming_path = filepath + ".incoming";
+
+                               FileIO fileio(incoming_path, std::ios::out | std::ios::trunc);
+                               fileio.preallocate(payload.file_size, false);
+
+                               FileSnapshot received_snap(payload.filename, payload.file_size, 0, {});
+                               uint64_t bytes_received = 0;
+
+                               for (const auto &[chunk_payload, chunk_data] : *chunks)
+                               {
+                                   fileio.write_file_at_offset(chunk_payload.offset, chunk_data);
+                                   bytes_received += chunk_data.size();
+                                   add_received_chunk(received_snap, chunk_payload, chunk_data);
+                               }
+
+                               FileSnapshot file_snap = publish_received_file(payload, filepath, fileio, std::move(received_snap), bytes_received);
+                               if (durability_manager)
+                                   durability_manager->add_dir(fs::path(filepath).parent_path().string());
+
+                               complete_apply(*result, std::move(file_snap));
+                           }
+                           catch (...)
+                           {
+                               result->set_exception(std::current_exception());
+                           } });
+}
+
+// reads the SEND_CHUNK messages of one part of a file and hands over each chunk as it comes
+void ReceiverMessageHandler::receive_file_chunks(const SendFilePayload &payload,
+                                                 const std::function<void(const SendChunkPayload &, std::string)> &on_chunk)
+{
     for (int i = 0; i < payload.no_of_chunks; ++i)
     {
         const Message &msg = messenger.receive_json_message();
 
         if (msg.type != MessageType::SEND_CHUNK)
-            std::runtime_error("invalid message type received!");
+            throw std::runtime_error("invalid message type received!");
 
-        // now fetch all the chunks and append to file
+        // now fetch all the chunks and write to file
         if (auto chunk_payload = std::get_if<SendChunkPayload>(&(msg.payload)))
         {
             if (chunk_payload->filename != payload.filename)
                 throw std::runtime_error(std::format("invalid chunk received from another file: {} instead of {}", chunk_payload->filename, payload.filename));
 
-            const std::string &chunk_data = messenger.receive_max_given_bytes(chunk_payload->chunk_size);
-
-            file_session.append_data(chunk_data);
+            on_chunk(*chunk_payload, messenger.receive_chunk_data(*chunk_payload));
 
             if (chunk_payload->is_last_chunk)
-            {
-                file_session.close_session();
                 break;
-            }
         }
         else
             throw std::runtime_error("invalid payload type received!");
@@ -297,22 +645,165 @@ void ReceiverMessageHandler::process_file(const SendFilePayload &payload, DirSna
         print_progress_bar(std::format("fetching {}...", payload.filename), static_cast<double>(i + 1) / payload.no_of_chunks);
     }
     std::clog << "\n\n";
+}
 
-    // update the file snap
-    snaps[payload.filename] = SnapshotManager::createSnapshot(filepath, working_dir);
+// chunks of the file come over every data channel so write each at its offset in the incoming
+// file, returns the chunk which ends furthest in the file
+ChunkInfo ReceiverMessageHandler::process_striped_file(const SendFilePayload &payload,
+                                                     const std::string &incoming_path,
+                                                     FileSnapshot &received_snap,
+                                                     uint64_t &bytes_received)
+{
+    if (!data_channels || data_channels->empty())
+        throw std::runtime_error(std::format("no data channels to receive striped file {}", payload.filename));
+
+    // size the file upfront so that every channel can write at its offset
+    if (!payload.is_continuation)
+    {
+        std::ofstream(incoming_path, std::ios::binary | std::ios::trunc).close();
+        fs::resize_file(incoming_path, payload.file_size);
+    }
+
+    std::atomic<size_t> chunks_received = 0;
+    std::mutex progress_mutex;
+    ChunkInfo last_chunk(0, 0, "", 0);
+
+    data_channels->for_each_channel(
+        [&](const size_t channel_no, Messenger &channel_messenger)
+        {
+            FileIO fileio(incoming_path, std::ios::in | std::ios::out);
+            const size_t no_of_chunks = data_channels->chunks_on_channel(channel_no, payload.no_of_chunks);
+
+            for (size_t i = 0; i < no_of_chunks; i++)
+            {
+                const Message &msg = channel_messenger.receive_json_message();
+                auto chunk_payload = std::get_if<SendChunkPayload>(&(msg.payload));
+
+                if (msg.type != MessageType::SEND_CHUNK || !chunk_payload)
+                    throw std::runtime_error("invalid message received on data channel!");
+
+                if (chunk_payload->filename != payload.filename)
+                    throw std::runtime_error(std::format("invalid chunk received from another file: {} instead of {}", chunk_payload->filename, payload.filename));
+
+                const std::string &chunk_data = channel_messenger.receive_chunk_data(*chunk_payload);
+                fileio.write_file_at_offset(chunk_payload->offset, chunk_data);
+
+                const std::string &hash = SnapshotManager::chunk_hash(chunk_data);
+
+                const size_t received = ++chunks_received;
+                std::lock_guard<std::mutex> lock(progress_mutex);
+
+                received_snap.chunks[hash] = ChunkInfo(chunk_payload->offset, chunk_data.size(), hash, chunk_payload->chunk_no);
+                bytes_received += chunk_data.size();
+
+                if (chunk_payload->offset + chunk_data.size() > last_chunk.offset + last_chunk.chunk_size)
+                {
+                    last_chunk.offset = chunk_payload->offset;
+                    last_chunk.chunk_size = chunk_data.size();
+                }
+
+                print_progress_bar(std::format("fetching {}...", payload.filename), static_cast<double>(received) / payload.no_of_chunks);
+            }
+        });
+
+    std::clog << "\n\n";
+
+    return last_chunk;
+}
+
+// everything up to the end of the part, its chunks' hashes too, is flushed to disk before the
+// checkpoint says so
+void ReceiverMessageHandler::save_checkpoint(const SendFilePayload &payload,
+                                             const std::string &incoming_path,
+                                             const ChunkInfo &last_chunk,
+                                             const FileSnapshot &part_snap)
+{
+    if (!resume_store || payload.file_digest.empty() || !last_chunk.chunk_size)
+        return;
+
+    ResumeStore::sync_file(incoming_path);
+
+    // a file starting over has nothing logged of it yet
+    if (!payload.is_continuation)
+        resume_store->remove(payload.filename);
+
+    std::vector<ChunkInfo> chunks;
+    chunks.reserve(part_snap.chunks.size());
+    for (const auto &[_, chunk] : part_snap.chunks)
+        chunks.push_back(chunk);
+
+    resume_store->append_chunks(payload.filename, chunks);
+
+    // hash what actually landed on disk, not what we think was written
+    FileIO fileio(incoming_path);
+    const std::string &chunk_data = fileio.read_file_from_offset(last_chunk.offset, last_chunk.chunk_size);
+
+    resume_store->save(ResumeCheckpoint{
+        .filename = payload.filename,
+        .file_size = payload.file_size,
+        .file_digest = payload.file_digest,
+        .committed_bytes = last_chunk.offset + last_chunk.chunk_size,
+        .last_chunk_offset = last_chunk.offset,
+        .last_chunk_size = last_chunk.chunk_size,
+        .last_chunk_hash = SnapshotManager::chunk_hash(chunk_data)});
 }
 
-// just opens the file appends the data and updates the snap of the file
+// tell the peer how much of the file we already have, or to start over
+void ReceiverMessageHandler::process_resume_query(const ResumeQueryPayload &payload)
+{
+    // parts received so far are in the incoming file next to the old version
+    const std::string &incoming_path = std::format("{}/{}.incoming", working_dir, payload.filename);
+
+    ResumeFromPayload reply{.filename = payload.filename, .offset = 0, .chunk_hash = ""};
+
+    const auto checkpoint = resume_store ? resume_store->load(payload.filename) : std::nullopt;
+
+    // only the same version of the file can be continued
+    if (checkpoint &&
+        checkpoint->file_digest == payload.file_digest &&
+        checkpoint->file_size == payload.file_size &&
+        fs::exists(incoming_path) &&
+        fs::file_size(incoming_path) >= checkpoint->committed_bytes)
+    {
+        FileIO fileio(incoming_path);
+        const std::string &chunk_data = fileio.read_file_from_offset(checkpoint->last_chunk_offset, checkpoint->last_chunk_size);
+
+        if (SnapshotManager::chunk_hash(chunk_data) == checkpoint->last_chunk_hash)
+        {
+            // anything after the committed bytes may be half written
+            fs::resize_file(incoming_path, checkpoint->committed_bytes);
+
+            reply.offset = checkpoint->committed_bytes;
+            reply.chunk_hash = checkpoint->last_chunk_hash;
+        }
+    }
+
+    if (reply.offset)
+        std::clog << std::format("resuming {} from {} bytes", payload.filename, reply.offset) << std::endl;
+    else if (resume_store)
+        resume_store->remove(payload.filename);
+
+    messenger.send_json_message(Message{.type = MessageType::RESUME_FROM, .payload = std::move(reply)});
+}
+
+// the file stays open till its last chunk, only then it is snapshotted
 void ReceiverMessageHandler::process_file_chunk(const SendChunkPayload &payload, DirSnapshot &snaps)
 {
-    FilePairSession file_session(working_dir + "/" + payload.filename, true);
-    file_session.ensure_files_open();
+    const std::string &filepath = working_dir + "/" + payload.filename;
 
-    const std::string &chunk_data = messenger.receive_max_given_bytes(payload.chunk_size);
-    file_session.append_data(chunk_data);
-    file_session.close_session();
+    auto &fileio = receiving_files[payload.filename];
+    if (!fileio)
+        fileio = std::make_unique<FileIO>(filepath, fs::exists(filepath) ? std::ios::in | std::ios::out : std::ios::out);
 
-    snaps[payload.filename] = SnapshotManager::createSnapshot(working_dir + "/" + payload.filename, working_dir);
+    const std::string &chunk_data = messenger.receive_chunk_data(payload);
+    fileio->write_file_at_offset(payload.offset, chunk_data);
+
+    if (!payload.is_last_chunk)
+        return;
+
+    receiving_files.erase(payload.filename);
+    mark_written(filepath);
+    snaps[payload.filename] = SnapshotManager::createSnapshot(filepath, working_dir);
 }
 
 // request peer to send the list of files and save on receiving + creates snaps of that files
@@ -326,22 +817,24 @@ void ReceiverMessageHandler::process_fetch_files(const std::vector<std::string>
         .payload = std::move(req_payload)};
     messenger.send_json_message(msg);
 
-    // now get all the files and save them
+    // now get all the files and save them, the last ones may still be written on the pool
     process_get_files(files, snaps);
+    finish_applies(snaps);
 }
 
 // fetch modified chunks from peer and save in your file
 void ReceiverMessageHandler::process_fetch_modified_chunks(const std::vector<FileModification> &modified_files, DirSnapshot &snaps)
 {
 
-    // fetches that amount of chunk and saves to corresponding chunk file
+    // saves the fetched chunk to corresponding chunk file
     const auto save_as_chunk_file = [&](
                                         ChunkHandler &chunk_handler,
                                         const ChunkType chunk_type,
                                         const uint64_t offset,
                                         const uint64_t chunk_size,
                                         const uint64_t old_chunk_size,
-                                        const bool is_last_chunk)
+                                        const bool is_last_chunk,
+                                        const std::string &chunk_data)
     {
         ChunkMetadata chunk_md{
             .chunk_type = chunk_type,
@@ -350,17 +843,14 @@ void ReceiverMessageHandler::process_fetch_modified_chunks(const std::vector<Fil
             .old_chunk_size = old_chunk_size,
             .is_last_chunk = is_last_chunk};
 
-        std::string &&chunk_data = "";
-
-        if (chunk_type != ChunkType::REMOVE)
-            chunk_data = messenger.receive_max_given_bytes(chunk_size);
-
         chunk_handler.save_chunk(chunk_md, chunk_data);
     };
 
     for (auto &file_modification : modified_files)
     {
-        ChunkHandler chunk_handler(file_modification.filename);
+        wait_for_apply(file_modification.filename, snaps);
+
+        auto chunk_handler = std::make_shared<ChunkHandler>(file_modification.filename);
 
         // fetch the new and modified chunks and save chunks
         for (size_t i = 0; i < file_modification.modified_chunks.size(); ++i)
@@ -370,12 +860,13 @@ void ReceiverMessageHandler::process_fetch_modified_chunks(const std::vector<Fil
             // added chunk will be saved as removable
             if (modified_chunk.chunk_type == ChunkType::ADD)
             {
-                save_as_chunk_file(chunk_handler,
+                save_as_chunk_file(*chunk_handler,
                                    ChunkType::REMOVE,
                                    modified_chunk.offset,
                                    modified_chunk.chunk_size,
                                    0,
-                                   modified_chunk.is_last_chunk);
+                                   modified_chunk.is_last_chunk,
+                                   "");
                 continue;
             }
 
@@ -409,12 +900,13 @@ void ReceiverMessageHandler::process_fetch_modified_chunks(const std::vector<Fil
                     std::cerr << "received inequal chunk on response" << std::endl;
 
                 // removed will be saved as added type
-                save_as_chunk_file(chunk_handler,
+                save_as_chunk_file(*chunk_handler,
                                    is_modified_chunk ? ChunkType::MODIFY : ChunkType::ADD,
                                    modified_chunk.offset,
                                    payload->chunk_size,
                                    chunk_size_to_move,
-                                   modified_chunk.is_last_chunk);
+                                   modified_chunk.is_last_chunk,
+                                   messenger.receive_chunk_data(*payload));
             }
             else
             {
@@ -426,17 +918,67 @@ void ReceiverMessageHandler::process_fetch_modified_chunks(const std::vector<Fil
         }
         std::clog << "\n\n";
 
-        const auto &filepath = working_dir + "/" + file_modification.filename;
+        // the change turns our curr_snap into peer's prev_snap, only if we still have curr_snap
+        std::optional<FileSnapshot> peer_snap;
+        if (has_base(file_modification.filename, SnapshotManager::file_digest(file_modification.curr_snap), snaps))
+            peer_snap = file_modification.prev_snap;
 
-        // finally create the file
-        chunk_handler.finalize_file(filepath);
-
-        // now update the snap of the file
-        snaps[file_modification.filename] = SnapshotManager::createSnapshot(filepath, working_dir);
+        // finally create the file, the next file is fetched meanwhile
+        apply_staged_file(std::move(chunk_handler), file_modification.filename, snaps, std::move(peer_snap));
     }
+
+    finish_applies(snaps);
 }
 
 // request and returnt the snapshot version of peer
+// offer the compressions we support and use the one peer agreed on
+void ReceiverMessageHandler::process_handshake(ChunkCompressor &compressor, const bool use_compression)
+{
+    const Message msg{
+        .type = MessageType::HANDSHAKE,
+        .payload = HandshakePayload{
+            .compressions = use_compression ? ChunkCompressor::supported() : std::vector<Compression>{}}};
+    messenger.send_json_message(msg);
+
+    const Message &peer_message = messenger.receive_json_message();
+
+    if (peer_message.type != MessageType::HANDSHAKE)
+        throw std::runtime_error("invalid type of message");
+
+    if (auto payload_ptr = std::get_if<HandshakePayload>(&(peer_message.payload)))
+        compressor.set_compression(payload_ptr->compressions.empty() ? Compression::NONE : payload_ptr->compressions.front());
+    else
+        throw std::runtime_error("invalid data received");
+}
+
+// say who we are, peer tells if what it missed from us can just be replayed
+SessionStatePayload ReceiverMessageHandler::process_session_resume(const std::string &session_id, const uint64_t peer_seq)
+{
+    const Message msg{
+        .type = MessageType::SESSION_RESUME,
+        .payload = SessionResumePayload{.session_id = session_id, .peer_seq = peer_seq}};
+    messenger.send_json_message(msg);
+
+    const Message &peer_message = messenger.receive_json_message();
+
+    if (peer_message.type != MessageType::SESSION_STATE)
+        throw std::runtime_error("invalid type of message");
+
+    if (auto payload_ptr = std::get_if<SessionStatePayload>(&(peer_message.payload)))
+        return *payload_ptr;
+    else
+        throw std::runtime_error("invalid data received");
+}
+
+void ReceiverMessageHandler::discard_staged_chunks()
+{
+    for (auto &[filename, chunk_handler] : staged_files)
+        chunk_handler->discard();
+
+    staged_files.clear();
+    receiving_files.clear();
+}
+
 std::string ReceiverMessageHandler::process_request_snap_version()
 {
     Message msg{.type = MessageType::REQ_SNAP_VERSION, .payload = {}};
@@ -500,16 +1042,174 @@ void ReceiverMessageHandler::process_request_peer_dir_list(std::vector<std::stri
 
 void ReceiverMessageHandler::process_get_files(const std::vector<std::string> &files, DirSnapshot &snaps)
 {
-    for (size_t i = 0; i < files.size(); i++)
+    // files can come in parts and interleaved, a file is done with its last part
+    for (size_t completed = 0; completed < files.size();)
     {
         const Message &msg = messenger.receive_json_message();
 
+        // peer asks before sending a big file whether it can continue a partial one
+        if (auto query = std::get_if<ResumeQueryPayload>(&(msg.payload)))
+        {
+            process_resume_query(*query);
+            continue;
+        }
+
         if (msg.type != MessageType::SEND_FILE)
             throw std::runtime_error("invalid message type received!");
 
         if (auto payload = std::get_if<SendFilePayload>(&(msg.payload)))
+        {
             process_file(*payload, snaps);
+
+            if (payload->is_last_part)
+                completed++;
+        }
         else
             throw std::runtime_error("invalid payload received!");
     }
-}
\ No newline at end of file
+}
+AsyncMessenger &ReceiverMessageHandler::get_async_messenger() const
+{
+    if (!async_messenger)
+        throw std::runtime_error("no async messenger to send requests over");
+
+    return *async_messenger;
+}
+
+// request and return the snapshot of peer without holding a thread while waiting
+Task<void> ReceiverMessageHandler::process_request_peer_snap_async(DirSnapshot &peer_snaps)
+{
+    Message msg{.type = MessageType::REQ_SNAP, .payload = {}};
+    AsyncReply reply = co_await get_async_messenger().request(std::move(msg));
+
+    auto payload = std::get_if<DataSnapshotPayload>(&(reply.message.payload));
+
+    if (reply.message.type != MessageType::DATA_SNAP || !payload)
+        throw std::runtime_error("invalid reply to snapshot request");
+
+    peer_snaps.clear();
+
+    for (auto &file_snap : payload->files)
+        peer_snaps[file_snap.filename] = std::move(file_snap);
+}
+
+Task<void> ReceiverMessageHandler::process_request_peer_dir_list_async(std::vector<std::string> &dir_list)
+{
+    Message msg{.type = MessageType::REQ_DIR_LIST, .payload = {}};
+    AsyncReply reply = co_await get_async_messenger().request(std::move(msg));
+
+    auto payload = std::get_if<DirListPayload>(&(reply.message.payload));
+
+    if (reply.message.type != MessageType::DIR_LIST || !payload)
+        throw std::runtime_error("invalid reply to dir list request");
+
+    dir_list = std::move(payload->dirs);
+}
+
+// every file is fetched by a coroutine of its own, their chunk requests share the connection
+Task<void> ReceiverMessageHandler::process_fetch_modified_chunks_async(std::vector<FileModification> modified_files, DirSnapshot &snaps)
+{
+    FetchProgress progress;
+    for (const auto &file_modification : modified_files)
+        progress.total_chunks += file_modification.modified_chunks.size();
+
+    TaskGroup files(get_async_messenger().get_executor());
+
+    for (auto &file_modification : modified_files)
+        files.spawn(fetch_file_changes_async(std::move(file_modification), snaps, progress));
+
+    co_await files.wait();
+
+    std::clog << "\n\n";
+}
+
+// chunks of a file are requested a window at a time, each one is staged in a file of its own
+Task<void> ReceiverMessageHandler::fetch_file_changes_async(FileModification file_modification, DirSnapshot &snaps, FetchProgress &progress)
+{
+    auto chunk_handler = std::make_shared<ChunkHandler>(file_modification.filename);
+    TaskGroup window(get_async_messenger().get_executor());
+
+    // the change turns our curr_snap into peer's prev_snap, only if we still have curr_snap
+    std::optional<FileSnapshot> peer_snap;
+    {
+        std::lock_guard<std::mutex> lock(progress.mutex);
+        if (has_base(file_modification.filename, SnapshotManager::file_digest(file_modification.curr_snap), snaps))
+            peer_snap = file_modification.prev_snap;
+    }
+
+    const auto &modified_chunks = file_modification.modified_chunks;
+
+    for (size_t begin = 0; begin < modified_chunks.size(); begin += FETCH_WINDOW_CHUNKS)
+    {
+        for (size_t i = begin; i < std::min(begin + FETCH_WINDOW_CHUNKS, modified_chunks.size()); i++)
+            window.spawn(fetch_chunk_async(*chunk_handler, modified_chunks[i], progress));
+
+        co_await window.wait();
+    }
+
+    const auto &filepath = working_dir + "/" + file_modification.filename;
+    FileSnapshot file_snap;
+
+    // on the apply pool the executor's thread goes back to receiving chunks of other files
+    const auto apply = [&]()
+    {
+        chunk_handler->finalize_file(filepath, patch_journal);
+        mark_dir_changed(fs::path(filepath).parent_path().string());
+        file_snap = snapshot_applied(*chunk_handler, filepath, working_dir, peer_snap);
+    };
+
+    if (apply_pool)
+        co_await apply_pool->apply(get_async_messenger().get_executor(), file_modification.filename, apply);
+    else
+        apply();
+
+    std::lock_guard<std::mutex> lock(progress.mutex);
+    snaps[file_modification.filename] = std::move(file_snap);
+}
+
+// same as the blocking fetch: added chunks are staged as removable, removed ones are fetched as added
+Task<void> ReceiverMessageHandler::fetch_chunk_async(ChunkHandler &chunk_handler, ModifiedChunkPayload modified_chunk, FetchProgress &progress)
+{
+    ChunkMetadata chunk_md{
+        .chunk_type = ChunkType::REMOVE,
+        .offset = modified_chunk.offset,
+        .chunk_size = modified_chunk.chunk_size,
+        .old_chunk_size = 0,
+        .is_last_chunk = modified_chunk.is_last_chunk};
+
+    std::string chunk_data;
+
+    if (modified_chunk.chunk_type != ChunkType::ADD)
+    {
+        const bool is_modified_chunk = modified_chunk.chunk_type == ChunkType::MODIFY;
+        const size_t chunk_size_to_fetch = is_modified_chunk ? modified_chunk.old_chunk_size : modified_chunk.chunk_size;
+
+        // built before awaiting, gcc 12 destroys temporaries passed to a coroutine in co_await twice
+        Message msg{
+            .type = MessageType::REQ_CHUNK,
+            .payload = RequestChunkPayload{
+                .filename = modified_chunk.filename,
+                .offset = modified_chunk.offset,
+                .chunk_size = chunk_size_to_fetch}};
+
+        AsyncReply reply = co_await get_async_messenger().request(std::move(msg));
+
+        auto payload = std::get_if<SendChunkPayload>(&(reply.message.payload));
+
+        if (!payload)
+            throw std::runtime_error(std::format("invalid reply to chunk request of {}", modified_chunk.filename));
+
+        if (payload->chunk_size != chunk_size_to_fetch)
+            std::cerr << "received inequal chunk on response" << std::endl;
+
+        chunk_md.chunk_type = is_modified_chunk ? ChunkType::MODIFY : ChunkType::ADD;
+        chunk_md.chunk_size = payload->chunk_size;
+        chunk_md.old_chunk_size = is_modified_chunk ? modified_chunk.chunk_size : 0;
+        chunk_data = std::move(reply.data);
+    }
+
+    chunk_handler.save_chunk(chunk_md, chunk_data);
+
+    std::lock_guard<std::mutex> lock(progress.mutex);
+    print_progress_bar("fetching file changes...", static_cast<double>(++progress.chunks_done) / progress.total_chunks);
+}
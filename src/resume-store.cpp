@@ -0,0 +1,162 @@
+#include "../include/resume-store.hpp"
+#include "../include/utils.hpp"
+#include <fstream>
+#include <cstring>
+#include <format>
+#include <fcntl.h>
+#include <unistd.h>
+
+ResumeStore::ResumeStore(const std::string &store_dir) : store_dir(store_dir)
+{
+    if (!fs::exists(this->store_dir))
+        fs::create_directories(this->store_dir);
+}
+
+fs::path ResumeStore::checkpoint_path(const std::string &filename) const
+{
+    return store_dir / (sanitize_filename(filename) + ".json");
+}
+
+fs::path ResumeStore::chunks_path(const std::string &filename) const
+{
+    return store_dir / (sanitize_filename(filename) + ".chunks");
+}
+
+void ResumeStore::sync_file(const std::string &filepath)
+{
+    const int fd = open(filepath.c_str(), O_RDONLY);
+
+    if (fd == -1)
+        throw std::runtime_error(std::format("failed to open {} for syncing: {}", filepath, std::strerror(errno)));
+
+    const int result = fsync(fd);
+    close(fd);
+
+    if (result == -1)
+        throw std::runtime_error(std::format("failed to sync {}: {}", filepath, std::strerror(errno)));
+}
+
+void ResumeStore::save(const ResumeCheckpoint &checkpoint) const
+{
+    const fs::path path = checkpoint_path(checkpoint.filename);
+    const fs::path temp_path = path.string() + ".tmp";
+
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        file << json(checkpoint).dump();
+
+        if (!file)
+            throw std::runtime_error(std::format("failed to write checkpoint of {}", checkpoint.filename));
+    }
+
+    sync_file(temp_path);
+    fs::rename(temp_path, path);
+
+    // the rename itself lives in the directory
+    sync_file(store_dir);
+}
+
+std::optional<ResumeCheckpoint> ResumeStore::load(const std::string &filename) const
+{
+    const fs::path path = checkpoint_path(filename);
+
+    if (!fs::exists(path))
+        return std::nullopt;
+
+    try
+    {
+        std::ifstream file(path);
+        ResumeCheckpoint checkpoint = json::parse(file).get<ResumeCheckpoint>();
+
+        // different names can sanitize to the same checkpoint file
+        if (checkpoint.filename != filename)
+            return std::nullopt;
+
+        return checkpoint;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "ignoring broken checkpoint of " << filename << ": " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+void ResumeStore::remove(const std::string &filename) const
+{
+    fs::remove(checkpoint_path(filename));
+    fs::remove(chunks_path(filename));
+}
+
+// one json line per chunk, synced before the checkpoint which covers them is saved
+void ResumeStore::append_chunks(const std::string &filename, const std::vector<ChunkInfo> &chunks) const
+{
+    const fs::path path = chunks_path(filename);
+
+    {
+        std::ofstream file(path, std::ios::app);
+
+        // a line torn by a crash is ended first so that it doesn't swallow the next one
+        file << '\n';
+
+        for (const auto &chunk : chunks)
+            file << json(chunk).dump() << '\n';
+
+        if (!file)
+            throw std::runtime_error(std::format("failed to log chunks of {}", filename));
+    }
+
+    sync_file(path);
+}
+
+std::vector<ChunkInfo> ResumeStore::load_chunks(const std::string &filename, const uint64_t committed_bytes) const
+{
+    std::vector<ChunkInfo> chunks;
+
+    std::ifstream file(chunks_path(filename));
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        if (line.empty())
+            continue;
+
+        ChunkInfo chunk;
+
+        // a crash while appending leaves a line torn, its chunk is logged again with the rest
+        try
+        {
+            chunk = json::parse(line).get<ChunkInfo>();
+        }
+        catch (const std::exception &)
+        {
+            continue;
+        }
+
+        if (chunk.offset + chunk.chunk_size <= committed_bytes)
+            chunks.push_back(std::move(chunk));
+    }
+
+    return chunks;
+}
+
+std::vector<std::string> ResumeStore::pending_files() const
+{
+    std::vector<std::string> files;
+
+    for (const auto &entry : fs::directory_iterator(store_dir))
+    {
+        if (entry.path().extension() != ".json")
+            continue;
+
+        try
+        {
+            std::ifstream file(entry.path());
+            files.push_back(json::parse(file).get<ResumeCheckpoint>().filename);
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    return files;
+}
@@ -1,10 +1,44 @@
 #include "../include/sender-message-handler.hpp"
 
-SenderMessageHandler::SenderMessageHandler(const Messenger &messenger, const std::string &working_dir) : messenger(messenger), working_dir(working_dir) {}
+SenderMessageHandler::SenderMessageHandler(const Messenger &messenger, const std::string &working_dir)
+    : messenger(messenger),
+      working_dir(working_dir),
+      stripe_min_file_size(get_env_number("SYNCLET_STRIPE_MIN_SIZE", 8 * 1024 * 1024)),
+      transfer_queue(TransferQueue::from_env()) {}
+
+void SenderMessageHandler::set_data_channels(DataChannels *data_channels)
+{
+    this->data_channels = data_channels;
+}
+
+void SenderMessageHandler::set_apply_pool(ApplyPool *apply_pool)
+{
+    this->apply_pool = apply_pool;
+}
 
 // handle file watching events
 void SenderMessageHandler::handle_event(const FileEvent &event, DirSnapshot &curr_snap) const
 {
+    // a removed file's change is of no use anymore if none of it went yet
+    if (event.event_type == EventType::DELETED && !event.is_directory && transfer_queue.remove(event.filepath.string()))
+        unsent_bases.erase(event.filepath.string());
+
+    // queued changes may be of the paths a remove or move takes away
+    if (event.event_type == EventType::DELETED || event.event_type == EventType::MOVED)
+        transfer_queue.run();
+
+    // what peer got of a file sent again goes with the file
+    if (event.event_type == EventType::DELETED && !event.is_directory)
+        resent_snaps.erase(event.filepath.string());
+
+    if (event.event_type == EventType::MOVED && !event.is_directory && event.old_filepath && event.new_filepath)
+        if (auto resent = resent_snaps.extract(event.old_filepath->string()))
+        {
+            resent.key() = event.new_filepath->string();
+            resent.mapped().filename = resent.key();
+            resent_snaps.insert(std::move(resent));
+        }
+
     switch (event.event_type)
     {
     case EventType::CREATED:
@@ -46,6 +80,12 @@ void SenderMessageHandler::handle_create_file(const FileEvent &event, DirSnapsho
 
 // inform peer for creation of files and sync created files
 void SenderMessageHandler::handle_create_file(const std::vector<FileSnapshot> &files) const
+{
+    handle_transfers(files, {});
+}
+
+// inform peer for creation of files, their data is sent through the queue
+void SenderMessageHandler::announce_created_files(const std::vector<FileSnapshot> &files) const
 {
     Message msg;
 
@@ -64,15 +104,6 @@ void SenderMessageHandler::handle_create_file(const std::vector<FileSnapshot> &f
 
     // send filenames so that peer will create that files
     messenger.send_json_message(msg);
-
-    // now sync all the files
-    for (size_t i = 0; i < files.size(); i++)
-    {
-        if (files[i].chunks.empty())
-            continue;
-
-        handle_file_sync(files[i]);
-    }
 }
 
 // inform peer about a single removed file
@@ -130,14 +161,40 @@ void SenderMessageHandler::handle_modify_file(const FileEvent &event, DirSnapsho
 {
     const std::string &full_path = std::format("{}/{}", working_dir, event.filepath.string());
 
-    FileSnapshot &prev_file_snap = snap.at(event.filepath.string());
+    FileSnapshot prev_file_snap = snap.at(event.filepath.string());
     FileSnapshot &&curr_file_snap = SnapshotManager::createSnapshot(full_path, working_dir);
 
+    // an earlier change still waiting in the queue is sent together with this one
+    auto unsent = unsent_bases.find(event.filepath.string());
+    if (unsent != unsent_bases.end())
+    {
+        transfer_queue.remove(unsent->first);
+        prev_file_snap = std::move(unsent->second);
+        unsent_bases.erase(unsent);
+    }
+
+    // the file is being sent again whole, the change is made against what that sends. when it
+    // hasn't started yet it just sends the file as it is now
+    auto resent = resent_snaps.find(event.filepath.string());
+    if (resent != resent_snaps.end())
+    {
+        if (transfer_queue.remove(resent->first))
+        {
+            resent->second = curr_file_snap;
+            queue_file_sync(curr_file_snap);
+            snap[event.filepath] = curr_file_snap;
+            return;
+        }
+
+        prev_file_snap = std::move(resent->second);
+        resent_snaps.erase(resent);
+    }
+
     // will return changes in sorted order means every array(added,modified,removed all will be sorted)
     const FileModification &file_modification = SnapshotManager::get_file_modification(curr_file_snap, prev_file_snap);
 
-    // now we have to send changes
-    handle_file_modification_sync(file_modification);
+    // sent a slice at a time between reading events
+    queue_file_modification_sync(file_modification);
 
     // storing the current snapshot of the file
     snap[event.filepath] = curr_file_snap;
@@ -255,98 +312,425 @@ void SenderMessageHandler::handle_moved_dir(const FileEvent &event, DirSnapshot
 // handle file changes
 void SenderMessageHandler::handle_changes(const FileChanges &file_changes) const
 {
-    if (!file_changes.created_files.empty())
-        handle_create_file(file_changes.created_files);
-
     if (!file_changes.removed_files.empty())
         handle_delete_file(file_changes.removed_files);
 
-    if (!file_changes.modified_files.empty())
-        handle_modify_file(file_changes.modified_files);
+    handle_transfers(file_changes.created_files, file_changes.modified_files);
 }
 
 // inform and sync delta of file
 void SenderMessageHandler::handle_modify_file(const std::vector<FileModification> &modified_files) const
 {
-    for (size_t i = 0; i < modified_files.size(); i++)
-    {
-        handle_file_modification_sync(modified_files[i]);
-    }
+    handle_transfers({}, modified_files);
+}
+
+// new and modified files go through one queue so that small ones aren't stuck behind big ones
+void SenderMessageHandler::handle_transfers(const std::vector<FileSnapshot> &created_files, const std::vector<FileModification> &modified_files) const
+{
+    if (!created_files.empty())
+        announce_created_files(created_files);
+
+    // empty files are already there after the announcement
+    for (const auto &file_snap : created_files)
+        if (!file_snap.chunks.empty())
+            queue_file_sync(file_snap);
+
+    for (const auto &file_modification : modified_files)
+        queue_file_modification_sync(file_modification);
+
+    transfer_queue.run();
+}
+
+bool SenderMessageHandler::send_transfer_slice() const
+{
+    return transfer_queue.run_slice();
+}
+
+bool SenderMessageHandler::has_pending_transfers() const
+{
+    return !transfer_queue.empty();
+}
+
+// chunks of the snap in file order
+std::vector<std::pair<std::string, ChunkInfo>> SenderMessageHandler::sorted_chunks(const FileSnapshot &file_snap) const
+{
+    // cant sort hashmap so storing pairs in vector to sort
+    std::vector<std::pair<std::string, ChunkInfo>> chunks(file_snap.chunks.begin(), file_snap.chunks.end());
+
+    // sort the chunks
+    std::sort(chunks.begin(), chunks.end(), [](const auto &chunk_a, const auto &chunk_b)
+              { return chunk_a.second.chunk_no < chunk_b.second.chunk_no; });
+
+    return chunks;
 }
 
 // sync full file
 void SenderMessageHandler::handle_file_sync(const FileSnapshot &file_snap) const
+{
+    if (!is_unchanged(file_snap) || !send_file_part(file_snap, sorted_chunks(file_snap), should_stripe(file_snap), false, true))
+        throw std::runtime_error(std::format("{} changed while it was being sent", file_snap.filename));
+}
+
+// queue the file to be sent a slice of whole chunks at a time
+void SenderMessageHandler::queue_file_sync(const FileSnapshot &file_snap) const
+{
+    const bool is_striped = should_stripe(file_snap);
+
+    // a striped slice is spread over the channels so each of them gets a full slice
+    const size_t slice_factor = is_striped ? data_channels->size() : 1;
+
+    transfer_queue.push(
+        file_snap.filename,
+        file_snap.file_size,
+        [this, file_snap, is_striped, slice_factor, chunks = sorted_chunks(file_snap), file_digest = std::string(), next = size_t(0)](const size_t slice_bytes) mutable
+        {
+            // the file changed since it was snapped, what was sent of it is of no use
+            if (!is_unchanged(file_snap))
+            {
+                resend_changed_file(file_snap.filename);
+                return SliceResult{.bytes_sent = 0, .is_done = true};
+            }
+
+            // peer checks what it received against the digest
+            if (file_digest.empty())
+                file_digest = SnapshotManager::file_digest(file_snap);
+
+            // a file going in many parts might have been partially received before
+            if (next == 0 && file_snap.file_size > slice_bytes * slice_factor)
+                next = query_resume_offset(file_snap, chunks, file_digest);
+
+            size_t end = next;
+            size_t bytes = 0;
+
+            while (end < chunks.size() && bytes < slice_bytes * slice_factor)
+                bytes += chunks[end++].second.chunk_size;
+
+            const bool is_sent = send_file_part(file_snap,
+                                                std::vector<std::pair<std::string, ChunkInfo>>(chunks.begin() + next, chunks.begin() + end),
+                                                is_striped,
+                                                next != 0,
+                                                end == chunks.size(),
+                                                file_digest);
+            if (!is_sent)
+            {
+                resend_changed_file(file_snap.filename);
+                return SliceResult{.bytes_sent = 0, .is_done = true};
+            }
+
+            next = end;
+
+            return SliceResult{.bytes_sent = bytes, .is_done = end == chunks.size()};
+        });
+}
+
+// false when the file's size or mtime is not what the snap has anymore
+bool SenderMessageHandler::is_unchanged(const FileSnapshot &file_snap) const
+{
+    const std::string &filepath = working_dir + "/" + file_snap.filename;
+    std::error_code ec;
+
+    const auto file_size = fs::file_size(filepath, ec);
+    if (ec || file_size != file_snap.file_size)
+        return false;
+
+    const auto mtime = fs::last_write_time(filepath, ec);
+    return !ec && to_unix_timestamp(mtime) == file_snap.mtime;
+}
+
+// whatever is queued of the file is dropped and it goes whole as it is now, later changes of it
+// are made against the snap sent here
+void SenderMessageHandler::resend_changed_file(const std::string &filename) const
+{
+    transfer_queue.remove(filename);
+    unsent_bases.erase(filename);
+    resent_snaps.erase(filename);
+
+    const std::string &filepath = working_dir + "/" + filename;
+
+    // a removed file is taken care of by its delete event
+    if (!fs::is_regular_file(filepath))
+        return;
+
+    std::clog << filename << " changed before it was sent, sending it again" << std::endl;
+
+    const FileSnapshot &file_snap = SnapshotManager::createSnapshot(filepath, working_dir);
+    resent_snaps[filename] = file_snap;
+    queue_file_sync(file_snap);
+}
+
+// index of the first chunk peer still needs, 0 when it has nothing usable
+size_t SenderMessageHandler::query_resume_offset(const FileSnapshot &file_snap,
+                                                 const std::vector<std::pair<std::string, ChunkInfo>> &chunks,
+                                                 const std::string &file_digest) const
+{
+    messenger.send_json_message(Message{
+        .type = MessageType::RESUME_QUERY,
+        .payload = ResumeQueryPayload{
+            .filename = file_snap.filename,
+            .file_size = file_snap.file_size,
+            .file_digest = file_digest}});
+
+    const Message &peer_message = messenger.receive_json_message();
+    auto payload = std::get_if<ResumeFromPayload>(&(peer_message.payload));
+
+    if (peer_message.type != MessageType::RESUME_FROM || !payload)
+        throw std::runtime_error("invalid reply to resume query");
+
+    if (!payload->offset)
+        return 0;
+
+    // peer must stop exactly at a chunk boundary and have the same chunk before it
+    for (size_t i = 1; i < chunks.size(); i++)
+    {
+        if (chunks[i].second.offset != payload->offset)
+            continue;
+
+        if (chunks[i - 1].second.hash != payload->chunk_hash)
+            break;
+
+        std::clog << std::format("resuming {} at {} of {} bytes", file_snap.filename, payload->offset, file_snap.file_size) << std::endl;
+        return i;
+    }
+
+    std::cerr << std::format("can't resume {} from {}, sending whole file", file_snap.filename, payload->offset) << std::endl;
+    return 0;
+}
+
+// send the given chunks of the file, a file can go in one or many parts. the part is read and
+// checked against the snap before anything of it goes, false when it didn't match
+bool SenderMessageHandler::send_file_part(const FileSnapshot &file_snap,
+                                          const std::vector<std::pair<std::string, ChunkInfo>> &chunks,
+                                          const bool is_striped,
+                                          const bool is_continuation,
+                                          const bool is_last_part,
+                                          const std::string &file_digest) const
 {
     Message msg;
 
     const std::string &filepath = working_dir + "/" + file_snap.filename;
 
+    std::vector<std::pair<size_t, size_t>> ranges;
+    ranges.reserve(chunks.size());
+    for (const auto &[hash, chunk] : chunks)
+        ranges.emplace_back(chunk.offset, chunk.chunk_size);
+
     FileIO fileio(filepath);
+    const std::vector<std::string> &chunks_data = fileio.read_ranges(ranges);
+
+    // a chunk shorter or other than the snap's would leave peer reading the wrong bytes
+    for (size_t i = 0; i < chunks.size(); i++)
+        if (chunks_data[i].size() != chunks[i].second.chunk_size || SnapshotManager::chunk_hash(chunks_data[i]) != chunks[i].first)
+            return false;
 
     // send the file metadata
     msg.type = MessageType::SEND_FILE;
     msg.payload = SendFilePayload{
         .filename = file_snap.filename,
         .file_size = file_snap.file_size,
-        .no_of_chunks = static_cast<int>(file_snap.chunks.size()),
+        .no_of_chunks = static_cast<int>(chunks.size()),
+        .is_striped = is_striped,
+        .is_continuation = is_continuation,
+        .is_last_part = is_last_part,
+        .file_digest = file_digest,
     };
     messenger.send_json_message(msg);
 
     // now sending chunks
-
-    // cant sort hashmap so storing pairs in vector to sort
-    std::vector<std::pair<std::string, ChunkInfo>> chunks(file_snap.chunks.begin(), file_snap.chunks.end());
-
-    // sort the chunks
-    std::sort(chunks.begin(), chunks.end(), [](const auto &chunk_a, const auto &chunk_b)
-              { return chunk_a.second.chunk_no < chunk_b.second.chunk_no; });
+    if (is_striped)
+    {
+        send_striped_chunks(file_snap, chunks, chunks_data);
+        return true;
+    }
 
     // now send the file chunk by chunk
     for (size_t i = 0; i < chunks.size(); i++)
     {
-        msg.type = MessageType::SEND_CHUNK;
-        msg.payload = SendChunkPayload{
-            .filename = file_snap.filename,
-            .chunk_size = chunks[i].second.chunk_size,
-            .chunk_no = chunks[i].second.chunk_no,
-            .is_last_chunk = (i == chunks.size() - 1)};
-
-        // send chunk metadata
-        messenger.send_json_message(msg);
-
-        // send chunk data
-        messenger.send_file_data(fileio, chunks[i].second.offset, chunks[i].second.chunk_size);
+        // send chunk metadata followed by its data
+        messenger.send_chunk_message(MessageType::SEND_CHUNK,
+                                     SendChunkPayload{
+                                         .filename = file_snap.filename,
+                                         .chunk_size = chunks[i].second.chunk_size,
+                                         .chunk_no = chunks[i].second.chunk_no,
+                                         .is_last_chunk = is_last_part && (i == chunks.size() - 1),
+                                         .offset = chunks[i].second.offset},
+                                     chunks_data[i]);
 
         print_progress_bar(std::format("sending {}...", file_snap.filename), static_cast<double>(i + 1) / chunks.size());
     }
     std::clog << "\n\n";
+
+    return true;
+}
+
+// big files are worth striping only when there are channels to stripe over
+bool SenderMessageHandler::should_stripe(const FileSnapshot &file_snap) const
+{
+    return data_channels &&
+           !data_channels->empty() &&
+           file_snap.chunks.size() > 1 &&
+           file_snap.file_size >= stripe_min_file_size;
+}
+
+// send chunk i over channel i % n
+void SenderMessageHandler::send_striped_chunks(const FileSnapshot &file_snap,
+                                               const std::vector<std::pair<std::string, ChunkInfo>> &chunks,
+                                               const std::vector<std::string> &chunks_data) const
+{
+    const size_t no_of_channels = data_channels->size();
+
+    std::atomic<size_t> chunks_sent = 0;
+    std::mutex progress_mutex;
+
+    data_channels->for_each_channel(
+        [&](const size_t channel_no, Messenger &channel_messenger)
+        {
+            for (size_t i = channel_no; i < chunks.size(); i += no_of_channels)
+            {
+                const auto &chunk = chunks[i].second;
+
+                channel_messenger.send_chunk_message(MessageType::SEND_CHUNK,
+                                                     SendChunkPayload{
+                                                         .filename = file_snap.filename,
+                                                         .chunk_size = chunk.chunk_size,
+                                                         .chunk_no = chunk.chunk_no,
+                                                         .is_last_chunk = (i + no_of_channels >= chunks.size()),
+                                                         .offset = chunk.offset},
+                                                     chunks_data[i]);
+
+                const size_t sent = ++chunks_sent;
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                print_progress_bar(std::format("sending {}...", file_snap.filename), static_cast<double>(sent) / chunks.size());
+            }
+        });
+
+    std::clog << "\n\n";
 }
 
 // sync modified part of file
 void SenderMessageHandler::handle_file_modification_sync(const FileModification &file_modification) const
+{
+    if (!send_modified_chunks(file_modification, 0, file_modification.modified_chunks.size()))
+        throw std::runtime_error(std::format("{} changed while its changes were being sent", file_modification.filename));
+}
+
+// queue the changes to be sent a slice of whole chunks at a time, peer stages them till the last one
+void SenderMessageHandler::queue_file_modification_sync(const FileModification &file_modification) const
+{
+    unsent_bases[file_modification.filename] = file_modification.prev_snap;
+
+    size_t bytes_to_send = 0;
+    for (const auto &modified_chunk : file_modification.modified_chunks)
+        if (modified_chunk.chunk_type != ChunkType::REMOVE)
+            bytes_to_send += modified_chunk.chunk_size;
+
+    transfer_queue.push(
+        file_modification.filename,
+        bytes_to_send,
+        [this, file_modification, next = size_t(0)](const size_t slice_bytes) mutable
+        {
+            const auto &modified_chunks = file_modification.modified_chunks;
+
+            // peer starts staging it, a later change can't be merged into it anymore
+            if (next == 0)
+                unsent_bases.erase(file_modification.filename);
+
+            size_t end = next;
+            size_t bytes = 0;
+
+            while (end < modified_chunks.size() && bytes < slice_bytes)
+            {
+                if (modified_chunks[end].chunk_type != ChunkType::REMOVE)
+                    bytes += modified_chunks[end].chunk_size;
+                end++;
+            }
+
+            // peer drops what it staged of the change when the whole file comes instead
+            if (!send_modified_chunks(file_modification, next, end))
+            {
+                resend_changed_file(file_modification.filename);
+                return SliceResult{.bytes_sent = 0, .is_done = true};
+            }
+
+            next = end;
+
+            return SliceResult{.bytes_sent = bytes, .is_done = end == modified_chunks.size()};
+        });
+}
+
+// send the modified chunks from begin till end, false when the file is no longer what the
+// change was made from and nothing was sent
+bool SenderMessageHandler::send_modified_chunks(const FileModification &file_modification, const size_t begin, const size_t end) const
 {
     Message msg;
 
     const std::string &filepath = working_dir + "/" + file_modification.filename;
 
+    if (!is_unchanged(file_modification.curr_snap))
+        return false;
+
+    // data of the chunks is read together, removed chunks have none
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (size_t i = begin; i < end; i++)
+        if (file_modification.modified_chunks[i].chunk_type != ChunkType::REMOVE)
+            ranges.emplace_back(file_modification.modified_chunks[i].offset, file_modification.modified_chunks[i].chunk_size);
+
     FileIO fileio(filepath);
+    const std::vector<std::string> &chunks_data = fileio.read_ranges(ranges);
 
-    for (size_t i = 0; i < file_modification.modified_chunks.size(); i++)
+    // what was read must be the chunks curr_snap has at those offsets
+    std::unordered_map<uint64_t, const std::string *> hash_at;
+    for (const auto &[hash, chunk] : file_modification.curr_snap.chunks)
+        hash_at[chunk.offset] = &hash;
+
+    for (size_t i = 0; i < ranges.size(); i++)
     {
-        const auto &modified_chunk = file_modification.modified_chunks[i];
+        auto it = hash_at.find(ranges[i].first);
+
+        if (it == hash_at.end() || chunks_data[i].size() != ranges[i].second || SnapshotManager::chunk_hash(chunks_data[i]) != *it->second)
+            return false;
+    }
+
+    size_t next_data = 0;
 
-        msg.type = MessageType::MODIFIED_CHUNK;
-        msg.payload = modified_chunk;
+    for (size_t i = begin; i < end; i++)
+    {
+        const auto &modified_chunk = file_modification.modified_chunks[i];
 
-        messenger.send_json_message(msg);
+        // peer takes the file's new snap from the last chunk instead of reading the file again
+        ModifiedChunkPayload payload = modified_chunk;
+        if (payload.is_last_chunk)
+            SnapshotManager::attach_file_snap(payload, file_modification);
 
         // no need to send data in remove chunk case
-        if (modified_chunk.chunk_type != ChunkType::REMOVE)
-            messenger.send_file_data(fileio, modified_chunk.offset, modified_chunk.chunk_size);
+        if (payload.chunk_type != ChunkType::REMOVE)
+            messenger.send_chunk_message(MessageType::MODIFIED_CHUNK,
+                                         payload,
+                                         chunks_data[next_data++]);
+        else
+        {
+            msg.type = MessageType::MODIFIED_CHUNK;
+            msg.payload = std::move(payload);
+            messenger.send_json_message(msg);
+        }
 
         print_progress_bar(std::format("sending {} changes...", modified_chunk.filename), static_cast<double>(i + 1) / file_modification.modified_chunks.size());
     }
     std::clog << "\n\n";
+
+    return true;
+}
+
+// pick the best compression peer offered and tell it back
+void SenderMessageHandler::handle_handshake(const HandshakePayload &payload, ChunkCompressor &compressor)
+{
+    const Compression compression = ChunkCompressor::pick(payload.compressions);
+    compressor.set_compression(compression);
+
+    Message msg;
+    msg.type = MessageType::HANDSHAKE;
+    msg.payload = HandshakePayload{.compressions = {compression}};
+
+    messenger.send_json_message(msg);
 }
 
 // send the snapshot version to peer
@@ -385,21 +769,29 @@ void SenderMessageHandler::handle_request_snap(DirSnapshot &snapshot)
 // send the requested chunk to peer
 void SenderMessageHandler::handle_request_chunk(const RequestChunkPayload &payload)
 {
-    FileIO fileio(working_dir + "/" + payload.filename);
+    std::string chunk_data;
 
-    const std::string &chunk_data = fileio.read_file_from_offset(payload.offset, payload.chunk_size);
-
-    const Message &msg{.type = MessageType::SEND_CHUNK,
-                       .payload = SendChunkPayload{
-                           .filename = payload.filename,
-                           .chunk_size = chunk_data.size(),
-                           .chunk_no = 0,
-                           .is_last_chunk = true,
-                       }};
-
-    messenger.send_json_message(msg);
+    // an in place patch of the file may be running on the pool, the read waits for it
+    const auto read_chunk = [&]()
+    {
+        FileIO fileio(working_dir + "/" + payload.filename);
+        chunk_data = fileio.read_file_from_offset(payload.offset, payload.chunk_size);
+    };
 
-    messenger.send_file_data(fileio, payload.offset, payload.chunk_size);
+    if (apply_pool)
+        apply_pool->run(payload.filename, read_chunk);
+    else
+        read_chunk();
+
+    messenger.send_chunk_message(MessageType::SEND_CHUNK,
+                                 SendChunkPayload{
+                                     .filename = payload.filename,
+                                     .chunk_size = chunk_data.size(),
+                                     .chunk_no = 0,
+                                     .is_last_chunk = payload.is_last_chunk,
+                                     .offset = payload.offset,
+                                 },
+                                 chunk_data);
 }
 
 // send the requested files to peer
@@ -410,8 +802,9 @@ void SenderMessageHandler::handle_request_download_files(const RequestDownloadFi
     // and these will be present in the snap
     for (size_t i = 0; i < payload.files.size(); i++)
     {
-        handle_file_sync(curr_snap[payload.files[i]]);
+        queue_file_sync(curr_snap[payload.files[i]]);
     }
+    transfer_queue.run();
 }
 
 void SenderMessageHandler::handle_request_dir_list()
@@ -434,4 +827,104 @@ void SenderMessageHandler::handle_request_dir_list()
         .payload = std::move(dir_list_payload)};
 
     messenger.send_json_message(msg);
-}
\ No newline at end of file
+}
+
+// a known session with nothing new from other peers can skip the full snapshot exchange
+void SenderMessageHandler::handle_session_resume(const SessionResumePayload &payload,
+                                                 const std::unordered_map<std::string, uint64_t> &applied_seqs,
+                                                 const ChangeLog &change_log)
+{
+    const auto it = applied_seqs.find(payload.session_id);
+    const auto &changes = change_log.changes_since(payload.peer_seq);
+
+    const bool has_peer_changes = !changes ||
+                                  std::ranges::any_of(*changes, [&](const ChangeRecord &change)
+                                                      { return change.origin != payload.session_id; });
+
+    const Message msg{
+        .type = MessageType::SESSION_STATE,
+        .payload = SessionStatePayload{
+            .is_known = it != applied_seqs.end(),
+            .applied_seq = it != applied_seqs.end() ? it->second : 0,
+            .seq = change_log.current_seq(),
+            .has_peer_changes = has_peer_changes}};
+
+    messenger.send_json_message(msg);
+}
+
+void SenderMessageHandler::handle_change_seq(const std::string &session_id, const uint64_t seq) const
+{
+    const Message msg{
+        .type = MessageType::CHANGE_SEQ,
+        .payload = ChangeSeqPayload{.session_id = session_id, .seq = seq}};
+
+    messenger.send_json_message(msg);
+}
+
+// events may have been half sent, so every path is sent as it is on disk now
+void SenderMessageHandler::handle_missed_changes(const std::vector<ChangeRecord> &changes, DirSnapshot &curr_snap) const
+{
+    std::set<std::string> removed_files, removed_dirs, dirs, files;
+
+    const auto add_file = [&](const std::string &path)
+    {
+        files.insert(path);
+        removed_files.erase(path);
+    };
+
+    for (const auto &change : changes)
+    {
+        const std::string &fullpath = std::format("{}/{}", working_dir, change.path);
+
+        if (fs::is_directory(fullpath))
+        {
+            dirs.insert(change.path);
+
+            // a moved or recreated dir brings its contents along
+            for (auto &entry : fs::recursive_directory_iterator(fullpath))
+            {
+                const std::string &path = extract_filename_from_path(working_dir, entry.path().string());
+
+                if (entry.is_directory())
+                    dirs.insert(path);
+                else if (entry.is_regular_file())
+                    add_file(path);
+            }
+        }
+        else if (fs::is_regular_file(fullpath))
+            add_file(change.path);
+        else if (change.is_directory)
+            removed_dirs.insert(change.path);
+        else if (!files.contains(change.path))
+            removed_files.insert(change.path);
+    }
+
+    for (const auto &dir_path : removed_dirs)
+        std::erase_if(curr_snap, [&](const auto &entry)
+                      { return entry.first.starts_with(dir_path + "/"); });
+
+    for (const auto &filename : removed_files)
+        curr_snap.erase(filename);
+
+    std::vector<FileSnapshot> file_snaps;
+    for (const auto &filename : files)
+    {
+        curr_snap[filename] = SnapshotManager::createSnapshot(std::format("{}/{}", working_dir, filename), working_dir);
+        file_snaps.push_back(curr_snap[filename]);
+    }
+
+    std::clog << std::format("replaying {} missed paths", removed_files.size() + removed_dirs.size() + dirs.size() + files.size()) << std::endl;
+
+    if (!removed_dirs.empty())
+        handle_delete_dir(std::vector<std::string>(removed_dirs.begin(), removed_dirs.end()));
+
+    if (!removed_files.empty())
+        handle_delete_file(std::vector<std::string>(removed_files.begin(), removed_files.end()));
+
+    // parents sort before their children
+    if (!dirs.empty())
+        handle_create_dir(std::vector<std::string>(dirs.begin(), dirs.end()));
+
+    if (!file_snaps.empty())
+        handle_transfers(file_snaps, {});
+}
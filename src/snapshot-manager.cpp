@@ -1,4 +1,40 @@
 #include "../include/snapshot-manager.hpp"
+#include <future>
+#include <set>
+
+namespace
+{
+    struct ScannedEntry
+    {
+        std::string path;
+        bool is_directory;
+        uint64_t file_size;
+        std::time_t mtime;
+    };
+
+    // regular files and dirs only, an entry gone meanwhile is skipped
+    void add_scanned(std::vector<ScannedEntry> &entries, const fs::directory_entry &entry, const fs::path &data_dir)
+    {
+        std::error_code error;
+
+        if (entry.is_symlink(error))
+            return;
+
+        const std::string path = extract_filename_from_path(data_dir.string(), entry.path().string());
+
+        if (entry.is_directory(error))
+            entries.push_back(ScannedEntry{.path = path, .is_directory = true, .file_size = 0, .mtime = 0});
+
+        else if (entry.is_regular_file(error))
+        {
+            const uint64_t file_size = entry.file_size(error);
+            const auto mtime = entry.last_write_time(error);
+
+            if (!error)
+                entries.push_back(ScannedEntry{.path = path, .is_directory = false, .file_size = file_size, .mtime = to_unix_timestamp(mtime)});
+        }
+    }
+}
 
 SnapshotManager::SnapshotManager(const std::string &data_dir, const std::string &snap_file) : data_dir_path(data_dir), snap_file_path(snap_file) {}
 
@@ -22,6 +58,52 @@ std::string SnapshotManager::create_hash(const std::vector<char> &data)
     return oss.str();
 }
 
+std::string SnapshotManager::chunk_hash(const std::string &data)
+{
+    return create_hash(std::vector<char>(data.begin(), data.end()));
+}
+
+std::string SnapshotManager::file_digest(const FileSnapshot &file_snap)
+{
+    std::vector<const ChunkInfo *> chunks;
+    chunks.reserve(file_snap.chunks.size());
+
+    for (const auto &[_, chunk] : file_snap.chunks)
+        chunks.push_back(&chunk);
+
+    std::sort(chunks.begin(), chunks.end(), [](const auto *chunk_a, const auto *chunk_b)
+              { return chunk_a->offset < chunk_b->offset; });
+
+    std::ostringstream ss;
+    ss << file_snap.file_size;
+
+    for (const auto *chunk : chunks)
+        ss << "|" << chunk->offset << ":" << chunk->chunk_size << ":" << chunk->hash;
+
+    const std::string &digest_str = ss.str();
+    return create_hash(std::vector<char>(digest_str.begin(), digest_str.end()));
+}
+
+void SnapshotManager::attach_file_snap(ModifiedChunkPayload &last_chunk, const FileModification &file_modification)
+{
+    last_chunk.file_size = file_modification.curr_snap.file_size;
+    last_chunk.base_digest = file_digest(file_modification.prev_snap);
+    last_chunk.file_chunks.clear();
+
+    for (const auto &[_, chunk] : file_modification.curr_snap.chunks)
+        last_chunk.file_chunks.push_back(chunk);
+}
+
+FileSnapshot SnapshotManager::from_chunks(const std::string &filename, const uint64_t file_size, const std::vector<ChunkInfo> &chunks)
+{
+    FileSnapshot file_snap(filename, file_size, 0, {});
+
+    for (const auto &chunk : chunks)
+        file_snap.chunks[chunk.hash] = chunk;
+
+    return file_snap;
+}
+
 // creates snapshot of the file using content dependent chunking
 FileSnapshot SnapshotManager::createSnapshot(const std::string &file_path, const std::string &dir_to_skip)
 {
@@ -369,6 +451,9 @@ FileModification SnapshotManager::get_file_modification(const FileSnapshot &file
     if (!changes.modified_chunks.empty())
         changes.modified_chunks.back().is_last_chunk = true;
 
+    changes.curr_snap = file_curr_snap;
+    changes.prev_snap = file_prev_snap;
+
     return changes;
 }
 
@@ -475,4 +560,113 @@ std::pair<std::string, DirSnapshot> SnapshotManager::load_snapshot()
     }
 
     return std::make_pair(j["version"].get<std::string>(), snapshots);
-}
\ No newline at end of file
+}
+std::vector<FileEvent> SnapshotManager::rescan(const std::string &dir_path, const DirSnapshot &snap) const
+{
+    const fs::path scan_root = dir_path.empty() ? data_dir_path : data_dir_path / dir_path;
+
+    std::vector<ScannedEntry> entries;
+    std::vector<fs::path> subdirs;
+    std::error_code error;
+
+    for (const auto &entry : fs::directory_iterator(scan_root, error))
+    {
+        add_scanned(entries, entry, data_dir_path);
+
+        std::error_code entry_error;
+        if (entry.is_directory(entry_error) && !entry.is_symlink(entry_error))
+            subdirs.push_back(entry.path());
+    }
+
+    // subtrees are listed on a few threads at once
+    const size_t no_of_threads = std::clamp<size_t>(get_env_number("SYNCLET_RESCAN_THREADS", 4), 1, std::max<size_t>(subdirs.size(), 1));
+
+    std::vector<std::future<std::vector<ScannedEntry>>> results;
+    for (size_t t = 0; t < no_of_threads; t++)
+        results.push_back(std::async(std::launch::async, [&, t]()
+                                     {
+                                         std::vector<ScannedEntry> found;
+
+                                         for (size_t i = t; i < subdirs.size(); i += no_of_threads)
+                                         {
+                                             std::error_code walk_error;
+                                             for (auto it = fs::recursive_directory_iterator(subdirs[i], fs::directory_options::skip_permission_denied, walk_error);
+                                                  !walk_error && it != fs::recursive_directory_iterator();
+                                                  it.increment(walk_error))
+                                                 add_scanned(found, *it, data_dir_path);
+                                         }
+
+                                         return found; }));
+
+    for (auto &result : results)
+        std::ranges::move(result.get(), std::back_inserter(entries));
+
+    // parents come before what is in them
+    std::ranges::sort(entries, {}, &ScannedEntry::path);
+
+    const std::string prefix = dir_path.empty() ? "" : dir_path + "/";
+
+    // a dir with a file in the snap is known to peer
+    std::unordered_set<std::string> known_dirs;
+    for (const auto &[filename, _] : snap)
+    {
+        if (!filename.starts_with(prefix))
+            continue;
+
+        for (fs::path parent = fs::path(filename).parent_path(); parent.string().size() > dir_path.size(); parent = parent.parent_path())
+            known_dirs.insert(parent.string());
+    }
+
+    std::vector<FileEvent> events;
+    std::unordered_set<std::string> on_disk;
+
+    for (const auto &entry : entries)
+    {
+        on_disk.insert(entry.path);
+
+        if (entry.is_directory)
+        {
+            if (!known_dirs.contains(entry.path))
+                events.emplace_back(entry.path, true, EventType::CREATED);
+            continue;
+        }
+
+        auto it = snap.find(entry.path);
+        if (it == snap.end())
+        {
+            events.emplace_back(entry.path, false, EventType::CREATED);
+            events.emplace_back(entry.path, false, EventType::MODIFIED);
+        }
+        else if (it->second.file_size != entry.file_size || it->second.mtime != entry.mtime)
+            events.emplace_back(entry.path, false, EventType::MODIFIED);
+    }
+
+    // a dir which is gone goes as one event, files in dirs still there go one by one
+    std::set<std::string> removed_dirs;
+    std::vector<std::string> removed_files;
+
+    for (const auto &[filename, _] : snap)
+    {
+        if (!filename.starts_with(prefix) || on_disk.contains(filename))
+            continue;
+
+        std::string topmost_missing;
+        for (fs::path parent = fs::path(filename).parent_path(); parent.string().size() > dir_path.size(); parent = parent.parent_path())
+            if (!on_disk.contains(parent.string()))
+                topmost_missing = parent.string();
+
+        if (topmost_missing.empty())
+            removed_files.push_back(filename);
+        else
+            removed_dirs.insert(topmost_missing);
+    }
+
+    for (const auto &dir : removed_dirs)
+        events.emplace_back(dir, true, EventType::DELETED);
+
+    std::ranges::sort(removed_files);
+    for (const auto &filename : removed_files)
+        events.emplace_back(filename, false, EventType::DELETED);
+
+    return events;
+}
@@ -0,0 +1,139 @@
+#include "../include/snapshot-shards.hpp"
+#include "../include/utils.hpp"
+#include <thread>
+
+SnapshotShards::SnapshotShards(const size_t no_of_shards)
+{
+    for (size_t i = 0; i < std::max<size_t>(no_of_shards, 1); i++)
+        shards.push_back(std::make_unique<Shard>());
+}
+
+size_t SnapshotShards::shards_from_env()
+{
+    return get_env_number("SYNCLET_SERVER_SHARDS", std::max(1u, std::thread::hardware_concurrency()));
+}
+
+size_t SnapshotShards::shard_of(const std::string &path) const
+{
+    return std::hash<std::string>{}(path) % shards.size();
+}
+
+void SnapshotShards::run_each(const std::vector<std::string> &paths, std::function<void(const std::string &, DirSnapshot &)> fn)
+{
+    std::shared_lock<std::shared_mutex> lock(epoch);
+
+    std::vector<std::vector<std::string>> paths_of(shards.size());
+    for (const auto &path : paths)
+        paths_of[shard_of(path)].push_back(path);
+
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        if (paths_of[i].empty())
+            continue;
+
+        std::lock_guard<std::mutex> shard_lock(shards[i]->mutex);
+
+        for (const auto &path : paths_of[i])
+            fn(path, shards[i]->snaps);
+    }
+}
+
+std::optional<FileSnapshot> SnapshotShards::get(const std::string &filename)
+{
+    return run(filename, [&](DirSnapshot &snaps) -> std::optional<FileSnapshot>
+               {
+                   auto it = snaps.find(filename);
+                   if (it == snaps.end())
+                       return std::nullopt;
+
+                   return it->second; });
+}
+
+std::optional<FileSnapshot> SnapshotShards::put(const std::string &filename, FileSnapshot file_snap)
+{
+    return run(filename, [&](DirSnapshot &snaps) -> std::optional<FileSnapshot>
+               {
+                   std::optional<FileSnapshot> prev_snap;
+
+                   auto it = snaps.find(filename);
+                   if (it != snaps.end())
+                       prev_snap = std::move(it->second);
+
+                   snaps[filename] = std::move(file_snap);
+                   return prev_snap; });
+}
+
+std::optional<FileSnapshot> SnapshotShards::take(const std::string &filename)
+{
+    return run(filename, [&](DirSnapshot &snaps) -> std::optional<FileSnapshot>
+               {
+                   auto node = snaps.extract(filename);
+                   if (node.empty())
+                       return std::nullopt;
+
+                   return std::move(node.mapped()); });
+}
+
+// only called holding the epoch exclusively, nobody else is in any shard then
+DirSnapshot SnapshotShards::extract_entries(std::function<bool(const std::string &)> pred)
+{
+    DirSnapshot result;
+
+    for (auto &shard : shards)
+    {
+        for (auto it = shard->snaps.begin(); it != shard->snaps.end();)
+        {
+            if (pred(it->first))
+            {
+                result.insert(std::move(*it));
+                it = shard->snaps.erase(it);
+            }
+            else
+                it++;
+        }
+    }
+
+    return result;
+}
+
+void SnapshotShards::insert(DirSnapshot snaps)
+{
+    std::shared_lock<std::shared_mutex> lock(epoch);
+    insert_entries(std::move(snaps));
+}
+
+void SnapshotShards::insert_entries(DirSnapshot snaps)
+{
+    if (snaps.empty())
+        return;
+
+    std::vector<DirSnapshot> parts(shards.size());
+    for (auto &[filename, file_snap] : snaps)
+        parts[shard_of(filename)][filename] = std::move(file_snap);
+
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        if (parts[i].empty())
+            continue;
+
+        std::lock_guard<std::mutex> shard_lock(shards[i]->mutex);
+
+        for (auto &[filename, file_snap] : parts[i])
+            shards[i]->snaps[filename] = std::move(file_snap);
+    }
+}
+
+DirSnapshot SnapshotShards::collect()
+{
+    std::shared_lock<std::shared_mutex> lock(epoch);
+
+    DirSnapshot result;
+
+    for (auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> shard_lock(shard->mutex);
+        result.insert(shard->snaps.begin(), shard->snaps.end());
+    }
+
+    return result;
+}
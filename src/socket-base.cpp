@@ -1,18 +1,76 @@
 #include "../include/socket-base.hpp"
+#include "../include/utils.hpp"
 
 SocketBase::SocketBase() = default;
 
 SocketBase::SocketBase(int fd) : sockfd(fd) {}
 
+bool LinkShaping::is_enabled() const
+{
+    return rtt.count() > 0 && window_bytes > 0;
+}
+
+LinkShaping LinkShaping::from_env()
+{
+    LinkShaping shaping;
+    shaping.rtt = std::chrono::milliseconds(get_env_number("SYNCLET_LINK_RTT_MS", 0));
+    shaping.window_bytes = get_env_number("SYNCLET_LINK_WINDOW_KB", 0) * 1024;
+    return shaping;
+}
+
+void SocketBase::setLinkShaping(const LinkShaping &shaping)
+{
+    link_shaping = shaping;
+    window_start = std::chrono::steady_clock::now();
+    window_sent = 0;
+}
+
+size_t SocketBase::waitForWindow(const size_t wanted)
+{
+    if (!link_shaping.is_enabled())
+        return wanted;
+
+    // window used up so wait till this rtt ends
+    if (window_sent >= link_shaping.window_bytes)
+    {
+        std::this_thread::sleep_until(window_start + link_shaping.rtt);
+        window_sent = 0;
+    }
+
+    // a fresh rtt starts when the previous one is over
+    const auto now = std::chrono::steady_clock::now();
+    if (now - window_start >= link_shaping.rtt)
+    {
+        window_start = now;
+        window_sent = 0;
+    }
+
+    return std::min(wanted, link_shaping.window_bytes - window_sent);
+}
+
 void SocketBase::sendAll(const std::string &data)
+{
+    sendAll(data.data(), data.size());
+}
+
+void SocketBase::sendAll(const char *data, const size_t size)
 {
     size_t totalSent = 0;
-    while (totalSent < data.size())
+    while (totalSent < size)
     {
-        ssize_t sent = send(sockfd, data.c_str() + totalSent, data.size() - totalSent, 0);
+        const size_t allowed = waitForWindow(size - totalSent);
+
+        // a closed peer should fail the send instead of killing us with SIGPIPE
+        ssize_t sent = send(sockfd, data + totalSent, allowed, MSG_NOSIGNAL);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            waitUntilReady(POLLOUT);
+            continue;
+        }
         if (sent < 0)
             throw std::runtime_error(std::string("send failed: ") + strerror(errno));
         totalSent += sent;
+        window_sent += sent;
     }
 }
 
@@ -40,6 +98,11 @@ std::string SocketBase::receiveSome(const size_t maxSize = 1024)
                                       maxSize - total_received_bytes,
                                       0);
 
+        if (received_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            waitUntilReady(POLLIN);
+            continue;
+        }
         if (received_bytes < 0)
             throw std::runtime_error(std::string("recv failed: ") + std::strerror(errno));
         if (received_bytes == 0)
@@ -51,6 +114,22 @@ std::string SocketBase::receiveSome(const size_t maxSize = 1024)
     return result;
 }
 
+void SocketBase::waitUntilReady(const short events)
+{
+    struct pollfd pfd{.fd = sockfd, .events = events, .revents = 0};
+
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+}
+
+void SocketBase::setNonBlocking()
+{
+    const int flags = fcntl(sockfd, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+        throw std::runtime_error(std::string("fcntl failed: ") + std::strerror(errno));
+}
+
 void SocketBase::closeConnection()
 {
     if (sockfd != -1)
@@ -17,6 +17,7 @@ TcpConnection &TcpConnection::operator=(TcpConnection &&other) noexcept
     this->closeConnection();
     sockfd = other.sockfd;
     other.sockfd = -1;
+    setLinkShaping(other.link_shaping);
   }
   return *this;
 };
@@ -24,6 +25,7 @@ TcpConnection::TcpConnection(TcpConnection &&other) noexcept
 {
   sockfd = other.sockfd;
   other.sockfd = -1;
+  setLinkShaping(other.link_shaping);
 }
 
 void TcpConnection::connectToServer(const std::string &host, const std::string &port)
@@ -77,7 +79,7 @@ TcpServer::TcpServer(const std::string &ip, const std::string &port)
   if (bind(listen_fd, res->ai_addr, res->ai_addrlen) < 0)
     throw std::runtime_error("bind failed");
 
-  if (listen(listen_fd, 10) < 0)
+  if (listen(listen_fd, SOMAXCONN) < 0)
     throw std::runtime_error("listen failed");
 
   freeaddrinfo(res);
@@ -96,6 +98,30 @@ TcpConnection TcpServer::acceptClient()
   return TcpConnection(client_fd);
 }
 
+std::unique_ptr<TcpConnection> TcpServer::tryAcceptClient()
+{
+  int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+  if (client_fd < 0)
+  {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+      return nullptr;
+
+    throw std::runtime_error(std::string("accept failed: ") + std::strerror(errno));
+  }
+
+  return std::make_unique<TcpConnection>(client_fd);
+}
+
+void TcpServer::setNonBlocking()
+{
+  const int flags = fcntl(listen_fd, F_GETFL, 0);
+
+  if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    throw std::runtime_error(std::string("fcntl failed: ") + std::strerror(errno));
+}
+
+int TcpServer::getFD() const { return listen_fd; }
+
 TcpServer::~TcpServer()
 {
   if (listen_fd != -1)
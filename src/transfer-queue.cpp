@@ -0,0 +1,93 @@
+#include "../include/transfer-queue.hpp"
+#include "../include/utils.hpp"
+#include <algorithm>
+
+TransferQueue::TransferQueue(const size_t slice_bytes, const std::chrono::milliseconds aging)
+    : slice_bytes(std::max<size_t>(slice_bytes, 1)),
+      aging(aging) {}
+
+TransferQueue TransferQueue::from_env()
+{
+    return TransferQueue(get_env_number("SYNCLET_SLICE_SIZE", 4 * 1024 * 1024),
+                         std::chrono::milliseconds(get_env_number("SYNCLET_AGING_MS", 10000)));
+}
+
+void TransferQueue::push(const std::string &filename, const size_t estimated_bytes, std::function<SliceResult(const size_t)> send_slice)
+{
+    jobs.push_back(TransferJob{
+        .id = next_id++,
+        .filename = filename,
+        .remaining_bytes = estimated_bytes,
+        .enqueued_at = std::chrono::steady_clock::now(),
+        .send_slice = std::move(send_slice)});
+}
+
+// a job counts as half its size after waiting for one aging period, a third after two...
+size_t TransferQueue::pick_next(const std::chrono::steady_clock::time_point now) const
+{
+    size_t best = 0;
+    double best_score = 0;
+
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const bool is_file_queued_before = std::any_of(jobs.begin(), jobs.begin() + i, [&](const TransferJob &job)
+                                                       { return job.filename == jobs[i].filename; });
+        if (is_file_queued_before)
+            continue;
+
+        const double waited = std::chrono::duration<double>(now - jobs[i].enqueued_at).count();
+        const double aging_periods = aging.count() ? waited * 1000 / aging.count() : 0;
+        const double score = jobs[i].remaining_bytes / (1 + aging_periods);
+
+        if (i == 0 || score < best_score)
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+bool TransferQueue::run_slice()
+{
+    if (jobs.empty())
+        return false;
+
+    const size_t i = pick_next(std::chrono::steady_clock::now());
+    const uint64_t id = jobs[i].id;
+
+    // jobs can move while the slice is sent, the job is found again by its id. being started
+    // it is never removed meanwhile
+    jobs[i].is_started = true;
+    auto send_slice = std::move(jobs[i].send_slice);
+    const SliceResult result = send_slice(slice_bytes);
+
+    auto job = std::find_if(jobs.begin(), jobs.end(), [&](const TransferJob &job)
+                            { return job.id == id; });
+
+    job->send_slice = std::move(send_slice);
+    job->remaining_bytes -= std::min(job->remaining_bytes, result.bytes_sent);
+
+    if (result.is_done)
+        jobs.erase(job);
+
+    return true;
+}
+
+void TransferQueue::run()
+{
+    while (run_slice())
+        ;
+}
+
+bool TransferQueue::remove(const std::string &filename)
+{
+    return std::erase_if(jobs, [&](const TransferJob &job)
+                         { return !job.is_started && job.filename == filename; }) != 0;
+}
+
+bool TransferQueue::empty() const
+{
+    return jobs.empty();
+}
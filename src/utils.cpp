@@ -1,4 +1,5 @@
 #include "../include/utils.hpp"
+#include <random>
 
 std::string sanitize_filename(const std::string &filename)
 {
@@ -70,4 +71,44 @@ void print_progress_bar(const std::string &message, double progress, size_t bar_
               << ss.str()
               << "] " << std::fixed << std::setprecision(2)
               << (progress * 100) << "% completed" << std::flush;
+}
+
+size_t get_env_number(const std::string &name, const size_t default_value)
+{
+    const char *value = std::getenv(name.c_str());
+
+    if (!value || *value == '\0')
+        return default_value;
+
+    try
+    {
+        return std::stoull(value);
+    }
+    catch (const std::exception &)
+    {
+        std::cerr << "invalid value for " << name << ", using " << default_value << std::endl;
+        return default_value;
+    }
+}
+
+std::string get_env_string(const std::string &name, const std::string &default_value)
+{
+    const char *value = std::getenv(name.c_str());
+
+    if (!value || *value == '\0')
+        return default_value;
+
+    return value;
+}
+
+std::string generate_session_id()
+{
+    std::random_device rd;
+    std::mt19937_64 gen(rd());
+
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << gen()
+       << std::setw(16) << std::setfill('0') << gen();
+
+    return ss.str();
 }
\ No newline at end of file
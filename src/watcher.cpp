@@ -1,47 +1,172 @@
 #include "../include/watcher.hpp"
+#include "../include/fanotify-watcher.hpp"
 
-Watcher::Watcher(const std::string &dir) : watch_dir(dir)
+std::unique_ptr<Watcher> Watcher::create(const std::string &dir)
+{
+    if (get_env_number("SYNCLET_FANOTIFY", 0))
+    {
+        try
+        {
+            return std::make_unique<FanotifyWatcher>(dir);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << ", watching with inotify" << std::endl;
+        }
+    }
+
+    return std::make_unique<InotifyWatcher>(dir);
+}
+
+InotifyWatcher::InotifyWatcher(const std::string &dir) : watch_dir(dir)
 {
     infd = inotify_init1(IN_NONBLOCK);
     if (infd == -1)
         throw std::runtime_error("failed to init inotify");
 
     // applying watchers to the directory recursively
-    apply_watchers(watch_dir);
+    root.name = watch_dir;
+    apply_watchers(&root);
 
     // applying epoll setup + timer
     apply_epoll_timer();
 }
 
-void Watcher::apply_watchers(const std::string &dir)
+void InotifyWatcher::apply_watchers(DirNode *node)
 {
     uint32_t masks = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
 
+    const std::string dir = path_of(node);
+
     // adding watcher to given directory
-    int wd = inotify_add_watch(infd, dir.c_str(), masks);
+    const int wd = inotify_add_watch(infd, dir.c_str(), masks);
     if (wd == -1)
         throw std::runtime_error(std::format("failed to add watcher to {}", dir));
 
-    // adding the wd to map with the dir
-    wd_to_dir[wd] = dir;
+    // the dir is watched already, it moved here while events were lost. its node comes along
+    // with the subtree instead of a second node whose removal would take the watch away
+    if (auto it = wd_to_node.find(wd); it != wd_to_node.end() && it->second != node)
+    {
+        DirNode *parent = node->parent;
+        const std::string name = node->name;
+
+        std::unique_ptr<DirNode> moved = detach(it->second, false);
+        moved->name = name;
+        moved->parent = parent;
+
+        DirNode *moved_node = moved.get();
+        parent->children[name] = std::move(moved);
+
+        watch_untracked(moved_node);
+        return;
+    }
+
+    node->wd = wd;
+    wd_to_node[node->wd] = node;
 
     // applying watchers to every sub directory
-    for (auto entry : fs::recursive_directory_iterator(dir))
+    for (auto entry : fs::directory_iterator(dir))
     {
-        if (entry.is_directory())
-        {
-            std::string path = entry.path().string();
+        if (entry.is_directory() && !entry.is_symlink())
+            apply_watchers(add_child(node, entry.path().filename().string()));
+    }
+}
+
+std::string InotifyWatcher::path_of(const DirNode *node) const
+{
+    std::vector<const std::string *> names;
+    for (; node; node = node->parent)
+        names.push_back(&node->name);
+
+    std::string path;
+    for (auto it = names.rbegin(); it != names.rend(); it++)
+    {
+        if (!path.empty())
+            path += '/';
+        path += **it;
+    }
+
+    return path;
+}
+
+std::string_view InotifyWatcher::relative_path(const DirNode *parent, std::string_view name)
+{
+    path_nodes.clear();
+    for (; parent != &root; parent = parent->parent)
+        path_nodes.push_back(parent);
+
+    path_buffer.clear();
+    for (auto it = path_nodes.rbegin(); it != path_nodes.rend(); it++)
+    {
+        path_buffer += (*it)->name;
+        path_buffer += '/';
+    }
+    path_buffer += name;
+
+    return path_buffer;
+}
+
+InotifyWatcher::DirNode *InotifyWatcher::find_node(const std::string &dir_path)
+{
+    DirNode *node = &root;
+
+    for (const auto &name : fs::path(dir_path))
+    {
+        auto it = node->children.find(name.string());
+        if (it == node->children.end())
+            return nullptr;
+
+        node = it->second.get();
+    }
+
+    return node;
+}
+
+InotifyWatcher::DirNode *InotifyWatcher::add_child(DirNode *parent, const std::string &name)
+{
+    auto &child = parent->children[name];
+
+    // a dir made again under the same name is a fresh one
+    if (child)
+        detach(child.get(), true);
 
-            wd = inotify_add_watch(infd, path.c_str(), masks);
-            if (wd == -1)
-                throw std::runtime_error(std::format("failed to add watcher to {}", path));
+    child = std::make_unique<DirNode>();
+    child->name = name;
+    child->parent = parent;
+
+    return child.get();
+}
 
-            wd_to_dir[wd] = path;
+std::unique_ptr<InotifyWatcher::DirNode> InotifyWatcher::detach(DirNode *node, const bool rm_watches)
+{
+    std::unique_ptr<DirNode> detached = std::move(node->parent->children[node->name]);
+    node->parent->children.erase(node->name);
+    node->parent = nullptr;
+
+    if (!rm_watches)
+        return detached;
+
+    // nothing under it is ours anymore
+    std::vector<DirNode *> stack{node};
+    while (!stack.empty())
+    {
+        DirNode *curr = stack.back();
+        stack.pop_back();
+
+        if (curr->wd != -1)
+        {
+            wd_to_node.erase(curr->wd);
+            inotify_rm_watch(infd, curr->wd);
         }
+
+        for (auto &[_, child] : curr->children)
+            stack.push_back(child.get());
     }
+
+    return detached;
 }
 
-void Watcher::apply_epoll_timer()
+void InotifyWatcher::apply_epoll_timer()
 {
     epollfd = epoll_create1(0);
     if (epollfd == -1)
@@ -69,21 +194,22 @@ void Watcher::apply_epoll_timer()
     timerfd_settime(timerfd, 0, &its, nullptr);
 }
 
-void Watcher::register_timer()
+void InotifyWatcher::register_timer()
 {
 
     struct epoll_event timer_event;
     timer_event.events = EPOLLIN;
     timer_event.data.fd = timerfd;
 
-    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &timer_event) == -1)
+    // still there when the last move completed before the timer went off
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &timer_event) == -1 && errno != EEXIST)
     {
         std::string error = std::strerror(errno);
         throw std::runtime_error(std::format("epoll_ctl: {}", error));
     }
 }
 
-void Watcher::unregister_timer()
+void InotifyWatcher::unregister_timer()
 {
     if (epoll_ctl(epollfd, EPOLL_CTL_DEL, timerfd, nullptr) == -1)
     {
@@ -92,59 +218,156 @@ void Watcher::unregister_timer()
     }
 }
 
-void Watcher::fill_events(std::vector<FileEvent> &file_events, struct inotify_event *event)
+void InotifyWatcher::read_events()
 {
+    while (true)
+    {
+        const ssize_t len = read(infd, buffer.data(), buffer.size());
+        if (len < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+                perror("read");
+            return;
+        }
 
-    // taking the parent dir where this file event occured
-    std::string dir = wd_to_dir[event->wd];
+        ssize_t offset = 0;
+        while (offset < len)
+        {
+            struct inotify_event *event = (struct inotify_event *)&buffer[offset];
 
-    std::string filepath = extract_filename_from_path(watch_dir, dir + "/" + event->name);
+            // here we have to fill the event batch
+            fill_events(event);
 
-    // check if it is a directory
-    const bool is_dir = event->mask & IN_ISDIR ? true : false;
+            offset += EVENT_SIZE + event->len;
+        }
+
+        // a read which filled the buffer means events are coming fast, fewer reads keep up better
+        if (static_cast<size_t>(len) + EVENT_SIZE + NAME_MAX + 1 > buffer.size() && buffer.size() < MAX_BUFFER_SIZE)
+            buffer = std::vector<char>(buffer.size() * 2);
+        else if (static_cast<size_t>(len) < buffer.size() / 8 && buffer.size() > MIN_BUFFER_SIZE)
+            buffer = std::vector<char>(buffer.size() / 2);
+    }
+}
+
+std::vector<std::string> InotifyWatcher::take_dirty_dirs()
+{
+    std::vector<std::string> dirs = std::exchange(dirty_dirs, {});
+
+    // a dir under another dirty one is rescanned along with it
+    std::ranges::sort(dirs);
+    std::vector<std::string> topmost;
+    for (auto &dir : dirs)
+    {
+        if (!topmost.empty() && (topmost.back().empty() || dir == topmost.back() || dir.starts_with(topmost.back() + "/")))
+            continue;
+        topmost.push_back(std::move(dir));
+    }
+
+    // dirs made while events were lost have no watch yet
+    for (const auto &dir : topmost)
+        if (DirNode *node = find_node(dir))
+            watch_untracked(node);
+
+    return topmost;
+}
+
+void InotifyWatcher::watch_untracked(DirNode *node)
+{
+    std::unordered_set<std::string> on_disk;
+
+    std::error_code error;
+    for (const auto &entry : fs::directory_iterator(path_of(node), error))
+    {
+        if (!entry.is_directory() || entry.is_symlink())
+            continue;
+
+        const std::string name = entry.path().filename().string();
+        on_disk.insert(name);
+
+        auto it = node->children.find(name);
+
+        if (it != node->children.end())
+            watch_untracked(it->second.get());
+        else
+            apply_watchers(add_child(node, name));
+    }
+
+    // dirs removed or moved away while events were lost, a moved one is found where it went
+    std::vector<DirNode *> stale;
+    for (const auto &[name, child] : node->children)
+        if (!on_disk.contains(name))
+            stale.push_back(child.get());
+
+    for (DirNode *child : stale)
+        detach(child, true);
+}
+
+void InotifyWatcher::fill_events(struct inotify_event *event)
+{
+    // events were dropped and nothing says where, the whole tree is rescanned
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        std::cerr << "inotify queue overflowed, rescanning " << watch_dir << std::endl;
+        dirty_dirs.push_back("");
+        return;
+    }
+
+    // taking the parent dir where this file event occured, a watch removed already has none
+    auto node_it = wd_to_node.find(event->wd);
+    if (node_it == wd_to_node.end())
+        return;
+
+    DirNode *parent = node_it->second;
 
     // ignore mask means directory is deleted then remove it from our track
     if (event->mask & IN_IGNORED)
     {
-        wd_to_dir.erase(event->wd);
+        wd_to_node.erase(node_it);
+        parent->wd = -1;
+
+        if (parent != &root)
+            detach(parent, true);
+        return;
     }
 
+    const std::string_view filepath = relative_path(parent, event->name);
+
+    // check if it is a directory
+    const bool is_dir = event->mask & IN_ISDIR ? true : false;
+
     //  when file/dir is created
-    else if (event->mask & IN_CREATE)
+    if (event->mask & IN_CREATE)
     {
-        file_events.emplace_back(
-            filepath,
-            is_dir,
-            EventType::CREATED);
+        batch.add(filepath, is_dir, EventType::CREATED);
+        if (log_events)
+            std::cout << "file create event: " << filepath << '\n';
 
-        // if dir added then apply watcher
+        // if dir added then apply watcher, whatever got in before it is found by a rescan
         if (is_dir)
-            apply_watchers(watch_dir + "/" + filepath);
-
-        std::cout << "file create event: " << filepath << std::endl;
+        {
+            dirty_dirs.emplace_back(filepath);
+            apply_watchers(add_child(parent, event->name));
+        }
     }
 
     // when file/dir is deleted
     else if (event->mask & IN_DELETE)
     {
 
-        file_events.emplace_back(
-            filepath,
-            is_dir,
-            EventType::DELETED);
+        batch.add(filepath, is_dir, EventType::DELETED);
 
         // dir deletion handled in in_ignore case
 
-        std::cout << "file delete event: " << filepath << std::endl;
+        if (log_events)
+            std::cout << "file delete event: " << filepath << '\n';
     }
 
     // when file is modified
     else if (event->mask & IN_CLOSE_WRITE)
     {
-        file_events.emplace_back(filepath,
-                                 is_dir,
-                                 EventType::MODIFIED);
-        std::cout << "file modify event: " << filepath << std::endl;
+        batch.add(filepath, is_dir, EventType::MODIFIED);
+        if (log_events)
+            std::cout << "file modify event: " << filepath << '\n';
     }
 
     // when file/dir is moved from here
@@ -157,7 +380,7 @@ void Watcher::fill_events(std::vector<FileEvent> &file_events, struct inotify_ev
             std::clog << "timer added" << std::endl;
         }
 
-        file_moved_tracker.emplace(event->cookie, FileMovePair(filepath, is_dir));
+        file_moved_tracker.emplace(event->cookie, FileMovePair(std::string(filepath), is_dir));
     }
 
     // when file/dir is moved here
@@ -168,54 +391,50 @@ void Watcher::fill_events(std::vector<FileEvent> &file_events, struct inotify_ev
         // when there is no moved_from event happened then it is file/dir is created
         if (it == file_moved_tracker.end())
         {
-            file_events.emplace_back(
-                filepath,
-                is_dir,
-                EventType::CREATED);
-            std::cout << "file create event: " << filepath << std::endl;
+            batch.add(filepath, is_dir, EventType::CREATED);
+            if (log_events)
+                std::cout << "file create event: " << filepath << '\n';
 
-            // applying watcher to the new dir
+            // applying watcher to the new dir, its contents came along without events
             if (is_dir)
-                apply_watchers(watch_dir + "/" + filepath);
+            {
+                dirty_dirs.emplace_back(filepath);
+                apply_watchers(add_child(parent, event->name));
+            }
 
             return;
         }
 
         // file/dir is renamed/moved
-        file_events.emplace_back(
-            it->second.is_directory,
-            it->second.old_file_path,
-            filepath,
-            EventType::MOVED);
+        batch.add_move(it->second.old_file_path, filepath, it->second.is_directory);
+        if (log_events)
+            std::cout << "file move event: " << it->second.old_file_path << " -> " << filepath << '\n';
 
-        // when it is a directory then update wd-to-dir map
+        // when it is a directory then its subtree goes under the new parent as it is
         if (it->second.is_directory)
         {
-            for (auto &p : wd_to_dir)
+            if (DirNode *moved = find_node(it->second.old_file_path))
             {
-                const std::string full_path = std::format("{}/{}", watch_dir, it->second.old_file_path);
-                const std::string new_full_path = std::format("{}/{}", watch_dir, filepath);
-
-                if (p.second == full_path)
-                {
-                    p.second = new_full_path;
-                    break;
-                }
+                std::unique_ptr<DirNode> subtree = detach(moved, false);
+                subtree->name = event->name;
+                subtree->parent = parent;
+
+                auto &slot = parent->children[event->name];
+                if (slot)
+                    detach(slot.get(), true);
+                parent->children[event->name] = std::move(subtree);
             }
         }
 
-        std::cout << "file move event: " << it->second.old_file_path << " -> " << filepath << std::endl;
-
         // now remove the rename entry from map
         file_moved_tracker.erase(it);
     }
 }
 
-std::vector<FileEvent> Watcher::poll_events()
+const EventBatch &InotifyWatcher::poll_events()
 {
     // max 10 events
     struct epoll_event events[MAX_EVENTS];
-    char buffer[BUFFER_SIZE];
 
     // -1 = block until event
     // returns no of events
@@ -227,7 +446,7 @@ std::vector<FileEvent> Watcher::poll_events()
     }
 
     // all the events will be stored in this
-    std::vector<FileEvent> file_events;
+    batch.clear();
 
     // iterate over all the events
     for (int i = 0; i < n_events; i++)
@@ -235,34 +454,7 @@ std::vector<FileEvent> Watcher::poll_events()
         int fd = events[i].data.fd;
 
         if (infd == fd)
-        {
-            int len = read(infd, buffer, BUFFER_SIZE);
-            if (len < 0)
-            {
-                perror("read");
-                continue;
-            }
-
-            int offset = 0;
-            while (offset < len)
-            {
-                struct inotify_event *event = (struct inotify_event *)&buffer[offset];
-
-                // wd is of the parent dir where watcher applied
-                std::string dir = wd_to_dir[event->wd];
-
-                // name of the dir /file created
-                std::string file = event->len > 0 ? event->name : "";
-
-                // fullpath including parent folder and file/dir
-                std::string full_path = std::format("{}/{}", dir, file);
-
-                // here we have to fill the event array
-                fill_events(file_events, event);
-
-                offset += EVENT_SIZE + event->len;
-            }
-        }
+            read_events();
 
         // when timer expired
         else if (timerfd == fd)
@@ -288,22 +480,13 @@ std::vector<FileEvent> Watcher::poll_events()
                 // if >200ms passed for moved file then it is deleted
                 if (std::chrono::duration_cast<std::chrono::milliseconds>(now - move_pair.time_stamp).count() > 200)
                 {
-                    file_events.emplace_back(move_pair.old_file_path, move_pair.is_directory,
-                                             EventType::DELETED);
+                    batch.add(move_pair.old_file_path, move_pair.is_directory, EventType::DELETED);
 
-                    // remove the entry from wd-to-dir
+                    // the dir went out of the tree, stop watching everything under it
                     if (move_pair.is_directory)
                     {
-                        for (auto &p : wd_to_dir)
-                        {
-                            const std::string full_path = std::format("{}/{}", watch_dir, it->second.old_file_path);
-
-                            if (p.second == full_path)
-                            {
-                                wd_to_dir.erase(p.first);
-                                break;
-                            }
-                        }
+                        if (DirNode *moved = find_node(move_pair.old_file_path))
+                            detach(moved, true);
                     }
 
                     it = file_moved_tracker.erase(it);
@@ -314,16 +497,21 @@ std::vector<FileEvent> Watcher::poll_events()
         }
     }
 
-    return file_events;
+    return batch;
+}
+
+int InotifyWatcher::get_fd() const
+{
+    return epollfd;
 }
 
-Watcher::~Watcher()
+InotifyWatcher::~InotifyWatcher()
 {
     if (epollfd != -1)
         close(epollfd);
     if (timerfd != -1)
         close(timerfd);
-    for (auto &[wd, _] : wd_to_dir)
+    for (auto &[wd, _] : wd_to_node)
     {
         if (wd != -1)
             inotify_rm_watch(infd, wd);